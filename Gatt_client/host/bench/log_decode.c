@@ -0,0 +1,63 @@
+/*
+ * Turns the MLOG lines a board built with CONFIG_MORSE_LOG_BINARY prints back into the text it would have printed
+ * without it, with the same format table as the board. Other lines pass through as they are, so a whole monitor log
+ * goes in and a readable one comes out. Lines that start MLOG but don't parse are kept and counted.
+ *
+ * usage: log_decode [file...], standard input without files
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "morse_log.h"
+
+#define DECODE_LINE_MAX 1024
+
+static long decode_entries;
+static long decode_bad;
+
+static void decode_file(FILE *in)
+{
+    char line[DECODE_LINE_MAX];
+    char text[MORSE_LOG_TEXT_MAX];
+    morse_log_entry entry;
+
+    while (fgets(line, sizeof(line), in))
+    {
+        if (!strstr(line, MORSE_LOG_LINE))
+        {
+            fputs(line, stdout);
+            continue;
+        }
+        if (morse_log_decode(line, &entry) != 0)
+        {
+            decode_bad++;
+            fputs(line, stdout);
+            continue;
+        }
+        morse_log_format(&entry, text, sizeof(text));
+        printf("%s: [%lld us] %s\n", morse_log_tag(&entry), (long long)entry.time, text);
+        decode_entries++;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        decode_file(stdin);
+    }
+    for (int i = 1; i < argc; i++)
+    {
+        FILE *in = fopen(argv[i], "r");
+
+        if (!in)
+        {
+            fprintf(stderr, "can't open %s\n", argv[i]);
+            return 1;
+        }
+        decode_file(in);
+        fclose(in);
+    }
+    fprintf(stderr, "%ld entries decoded, %ld lines not understood\n", decode_entries, decode_bad);
+    return decode_bad ? 1 : 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * Stress run of morse_log with several writers, as on the board where both cores and their interrupts log. Each
+ * writer logs its number, a running counter and its complement, and tries again when the ring is full. The reader
+ * checks every writer's entries arrive once, in order and whole, and every entry round trips through the MLOG line.
+ * Exits non-zero on a lost, duplicated or torn entry.
+ *
+ * Then times one writer alone against formatting the same entry with snprintf, what a log call cost before.
+ *
+ * usage: log_stress [writers [entries per writer]]
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "morse_log.h"
+
+#define STRESS_DEFAULT_WRITERS 4
+#define STRESS_DEFAULT_ENTRIES 5000000L
+#define STRESS_WRITERS_MAX 16
+#define STRESS_TIMED_ENTRIES 10000000L
+
+static morse_log stress_log;
+static long stress_entries;
+static long stress_full; // writes refused because the ring was full, all writers
+
+static void *stress_writer(void *arg)
+{
+    uint32_t writer = (uint32_t)(uintptr_t)arg;
+    long full = 0;
+
+    for (long i = 0; i < stress_entries; i++)
+    {
+        const uint32_t args[] = {writer, (uint32_t)i, ~(uint32_t)i, writer * 3};
+
+        while (!morse_log_write(&stress_log, MORSE_LOG_SEND_SINGLE, args, 4))
+        {
+            full++;
+            sched_yield();
+        }
+    }
+    __atomic_fetch_add(&stress_full, full, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static double stress_seconds(const struct timespec *t0, const struct timespec *t1)
+{
+    return (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t threads[STRESS_WRITERS_MAX];
+    uint32_t next[STRESS_WRITERS_MAX] = {0};
+    int writers = argc > 1 ? atoi(argv[1]) : STRESS_DEFAULT_WRITERS;
+    long total;
+    long read = 0;
+    long reader_empty = 0;
+    morse_log_entry entry, decoded;
+    char line[MORSE_LOG_TEXT_MAX];
+    struct timespec t0, t1;
+
+    stress_entries = argc > 2 ? atol(argv[2]) : STRESS_DEFAULT_ENTRIES;
+    if (writers < 1 || writers > STRESS_WRITERS_MAX || stress_entries < 1)
+    {
+        printf("usage: %s [writers [entries per writer]], 1 to %d writers\n", argv[0], STRESS_WRITERS_MAX);
+        return 1;
+    }
+    total = writers * stress_entries;
+    morse_log_init(&stress_log);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < writers; i++)
+    {
+        pthread_create(&threads[i], NULL, stress_writer, (void *)(uintptr_t)i);
+    }
+    while (read < total)
+    {
+        if (!morse_log_read(&stress_log, &entry))
+        {
+            reader_empty++;
+            sched_yield();
+            continue;
+        }
+        uint32_t writer = entry.args[0];
+        if (writer >= (uint32_t)writers || entry.args[1] != next[writer] || entry.args[2] != ~entry.args[1] ||
+            entry.args[3] != writer * 3 || entry.args[4] != 0 || entry.event != MORSE_LOG_SEND_SINGLE)
+        {
+            printf("entry %ld: writer %u counter %u/%x, expected %u\n", read, writer, entry.args[1], entry.args[2],
+                   writer < (uint32_t)writers ? next[writer] : 0);
+            return 1;
+        }
+        if ((read & 0xFFF) == 0)
+        {
+            morse_log_encode(&entry, line, sizeof(line));
+            if (morse_log_decode(line, &decoded) != 0 || memcmp(&decoded.args, &entry.args, sizeof(entry.args)) != 0 ||
+                decoded.time != entry.time || decoded.event != entry.event)
+            {
+                printf("entry %ld doesn't round trip: %s\n", read, line);
+                return 1;
+            }
+        }
+        next[writer]++;
+        read++;
+    }
+    for (int i = 0; i < writers; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (morse_log_read(&stress_log, &entry) || morse_log_take_dropped(&stress_log) != (uint32_t)stress_full)
+    {
+        printf("entries left in the log, or drops miscounted\n");
+        return 1;
+    }
+    printf("%d writers, %ld entries in order, none lost, duplicated or torn\n", writers, total);
+    printf("%.0f entries/s, writers saw full %ld times, reader saw empty %ld times\n", total / stress_seconds(&t0, &t1), stress_full,
+           reader_empty);
+
+    // one writer, drained every ring length so it never fills
+    morse_log_init(&stress_log);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (long i = 0; i < STRESS_TIMED_ENTRIES; i++)
+    {
+        const uint32_t args[] = {(uint32_t)i, 0, 527};
+
+        morse_log_write(&stress_log, MORSE_LOG_SEND_SINGLE, args, 3);
+        if ((i & MORSE_LOG_MASK) == MORSE_LOG_MASK)
+        {
+            stress_log.tail = atomic_load(&stress_log.head); // skip the reads, only the writes are timed
+            for (int s = 0; s < MORSE_LOG_LENGTH; s++)
+            {
+                atomic_store(&stress_log.slots[s].seq, stress_log.tail + s);
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("%-28s %8.1f ns\n", "morse_log_write", stress_seconds(&t0, &t1) * 1e9 / STRESS_TIMED_ENTRIES);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (long i = 0; i < STRESS_TIMED_ENTRIES; i++)
+    {
+        entry.args[0] = (uint32_t)i;
+        morse_log_format(&entry, line, sizeof(line));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("%-28s %8.1f ns, %d characters, before the uart\n", "format the same entry", stress_seconds(&t0, &t1) * 1e9 / STRESS_TIMED_ENTRIES,
+           (int)strlen(line));
+    return 0;
+}
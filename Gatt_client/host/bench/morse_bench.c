@@ -0,0 +1,340 @@
+/*
+ * Host benchmark for the client decode path. Keys random messages through the gpio handlers on the
+ * virtual clock, timing the handlers plus draining their input and the send press, then times get_letter_morse_code() against
+ * the old switch decoder and the gpio handlers on their own.
+ *
+ * The lookups are timed on random codes and on the codes of english text, each through a call the compiler can't fold or
+ * inline, as in the firmware where the decoder is in another file. A function that only returns its argument gives the
+ * cost of the call and the loop, what is left over is the lookup. gcc turns the old switch into a bounds checked table
+ * of its own, so the two are expected to cost the same.
+ *
+ * usage: morse_bench [symbols per size]
+ */
+#include <stdlib.h>
+#include <time.h>
+
+#include "morse_functions.h"
+
+#define BENCH_DEFAULT_SYMBOLS 4000000 // symbols decoded per message size, sets the iteration count
+// keying timings on the virtual clock, standard proportions at 20 wpm
+#define BENCH_UNIT 60000
+#define BENCH_DOT_HOLD BENCH_UNIT
+#define BENCH_DASH_HOLD (3 * BENCH_UNIT)
+#define BENCH_SYMBOL_GAP BENCH_UNIT
+#define BENCH_CHARACTER_GAP (3 * BENCH_UNIT)
+#define BENCH_SEND_GAP BUTTON_LOCKOUT_US // the send button keeps a lockout
+
+#define BENCH_LOOKUP_ROUNDS 200
+#define BENCH_LOOKUP_PASSES 10 // the fastest pass is kept, the others had the machine's noise in them
+#define BENCH_LOOKUP_STREAM 4096 // random codes per lookup round, long enough to defeat the branch predictor
+#define BENCH_LEGACY_LENGTH 36 // the switch decoder only knows a-z and 0-9
+// the characters the switch knows of an everyday message, keyed over and over
+#define BENCH_TEXT "the quick brown fox jumps over the lazy dog meet at the north gate at 6 running late start without me " \
+                   "battery at 40 percent heading back to base now cq cq de w1aw k"
+#define BENCH_EDGE_ROUNDS 200000
+#define BENCH_EDGE_BURST 64 // edges queued between drains, half the ring
+
+char legacy_get_letter_morse_code(int decimalValue);
+
+// morse strings for the characters the firmware decodes, '.' = 0 and '-' = 1 in message_buf
+static const struct
+{
+    char letter;
+    const char *code;
+} bench_alphabet[] = {
+    {'a', ".-"}, {'b', "-..."}, {'c', "-.-."}, {'d', "-.."}, {'e', "."}, {'f', "..-."},
+    {'g', "--."}, {'h', "...."}, {'i', ".."}, {'j', ".---"}, {'k', "-.-"}, {'l', ".-.."},
+    {'m', "--"}, {'n', "-."}, {'o', "---"}, {'p', ".--."}, {'q', "--.-"}, {'r', ".-."},
+    {'s', "..."}, {'t', "-"}, {'u', "..-"}, {'v', "...-"}, {'w', ".--"}, {'x', "-..-"},
+    {'y', "-.--"}, {'z', "--.."}, {'0', "-----"}, {'1', ".----"}, {'2', "..---"}, {'3', "...--"},
+    {'4', "....-"}, {'5', "....."}, {'6', "-...."}, {'7', "--..."}, {'8', "---.."}, {'9', "----."},
+    {'.', ".-.-.-"}, {',', "--..--"}, {':', "---..."}, {'?', "..--.."}, {'\'', ".----."}, {'-', "-....-"},
+    {'/', "-..-."}, {'(', "-.--."}, {')', "-.--.-"}, {'"', ".-..-."}, {'=', "-...-"}, {'+', ".-.-."},
+    {'@', ".--.-."}, {'!', "-.-.--"}, {'&', ".-..."}, {';', "-.-.-."}, {'_', "..--.-"}, {'$', "...-..-"},
+    {MORSE_PROSIGN_KA, "-.-.-"}, {MORSE_PROSIGN_SK, "...-.-"}, {MORSE_PROSIGN_SN, "...-."},
+};
+#define BENCH_ALPHABET_LENGTH (sizeof(bench_alphabet) / sizeof(bench_alphabet[0]))
+
+static uint32_t bench_seed = 0x1234567;
+
+static uint32_t bench_rand()
+{
+    // xorshift32, fixed seed so every run decodes the same messages
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 17;
+    bench_seed ^= bench_seed << 5;
+    return bench_seed;
+}
+
+static int64_t bench_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Builds a random message in the message_buf format, characters separated by 2s.
+ * @param max_symbols upper bound on the number of symbols, separators included.
+ * @param symbols receives the symbols.
+ * @param expected receives the characters, NUL terminated.
+ * @return the number of symbols written.
+ */
+static uint32_t bench_make_message(uint32_t max_symbols, uint8_t *symbols, char *expected)
+{
+    uint32_t end = 0;
+    uint32_t chars = 0;
+
+    // the start handler keeps the last two message_buf entries free
+    if (max_symbols > MESS_BUFFER_LENGTH - 2)
+    {
+        max_symbols = MESS_BUFFER_LENGTH - 2;
+    }
+
+    while (chars < CHAR_BUFFER_LENGTH)
+    {
+        int pick = bench_rand() % BENCH_ALPHABET_LENGTH;
+        uint32_t len = strlen(bench_alphabet[pick].code);
+
+        // room for the code and the separator in front of it
+        if (end + len + (chars != 0) > max_symbols)
+        {
+            break;
+        }
+        if (chars != 0)
+        {
+            symbols[end++] = 2;
+        }
+        for (uint32_t i = 0; i < len; i++)
+        {
+            symbols[end++] = bench_alphabet[pick].code[i] == '-';
+        }
+        expected[chars++] = bench_alphabet[pick].letter;
+    }
+    expected[chars] = '\0';
+    return end;
+}
+
+/**
+ * Keys the symbols through the gpio handlers on the virtual clock, the same presses an operator would make.
+ * The queued input is drained after every press, as if the poll event task ran in between.
+ */
+static void bench_key_message(const uint8_t *symbols, uint32_t length)
+{
+    int64_t gap = BENCH_SYMBOL_GAP;
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        if (symbols[i] == 2)
+        {
+            gap = BENCH_CHARACTER_GAP;
+            continue;
+        }
+        host_gpio_press(gap, symbols[i] ? BENCH_DASH_HOLD : BENCH_DOT_HOLD);
+        morse_process_input();
+        gap = BENCH_SYMBOL_GAP;
+    }
+}
+
+static void bench_decode(uint32_t max_symbols, long symbol_budget)
+{
+    static uint8_t symbols[MESS_BUFFER_LENGTH];
+    char expected[CHAR_BUFFER_LENGTH + 1];
+    uint32_t length = bench_make_message(max_symbols, symbols, expected);
+    uint32_t chars = strlen(expected);
+    long iterations = symbol_budget / length + 1;
+    int64_t key_total = 0;
+    int64_t send_total = 0;
+    int64_t send_worst = 0;
+
+    for (long i = 0; i < iterations; i++)
+    {
+        // what poll_event_task does after writing to the server
+        char_mess_buf_end = 0;
+        mess_buf_end = 0;
+
+        int64_t t0 = bench_now_ns();
+        bench_key_message(symbols, length);
+        int64_t t1 = bench_now_ns();
+        host_gpio_send(BENCH_SEND_GAP);
+        bool sent = morse_process_input();
+        int64_t t2 = bench_now_ns();
+
+        if (!sent || !host_send_requested)
+        {
+            printf("send press lost at size %u\n", max_symbols);
+            exit(1);
+        }
+        host_send_requested = false;
+
+        key_total += t1 - t0;
+        send_total += t2 - t1;
+        if (t2 - t1 > send_worst)
+        {
+            send_worst = t2 - t1;
+        }
+    }
+
+    if (char_mess_buf_end != chars || memcmp(char_message_buf, expected, chars) != 0)
+    {
+        printf("decode mismatch at size %u: got \"%.*s\", expected \"%s\"\n", max_symbols, (int)char_mess_buf_end, char_message_buf, expected);
+        exit(1);
+    }
+
+    // the packed message buffer has to hand back exactly what was keyed
+    int64_t t0 = bench_now_ns();
+    uint32_t read_errors = (mess_buf_end != length);
+    for (uint32_t i = 0; i < length; i++)
+    {
+        read_errors += message_buf_get(i) != symbols[i];
+    }
+    int64_t read_total = bench_now_ns() - t0;
+    if (read_errors)
+    {
+        printf("message_buf mismatch at size %u\n", max_symbols);
+        exit(1);
+    }
+
+    printf("%6u %7u %7u %12.0f %10.2f %10.2f %10.0f %10lld\n", max_symbols, length, chars,
+           chars * iterations / ((key_total + send_total) / 1e9), (double)key_total / ((double)length * iterations),
+           (double)read_total / length, (double)send_total / iterations, (long long)send_worst);
+}
+
+static int bench_code_value(const char *code)
+{
+    int decimal = 1;
+    for (const char *c = code; *c; c++)
+    {
+        decimal = (decimal << 1) + (*c == '-');
+    }
+    return decimal;
+}
+
+/**
+ * A lookup that does nothing, for the cost of the call and the loop around it.
+ */
+__attribute__((noinline)) static char bench_lookup_none(int decimalValue)
+{
+    return (char)decimalValue;
+}
+
+static double bench_lookup_ns(char (*volatile lookup)(int), const int *stream)
+{
+    volatile char sink;
+    int64_t best = INT64_MAX;
+
+    for (int pass = 0; pass < BENCH_LOOKUP_PASSES; pass++)
+    {
+        int64_t t0 = bench_now_ns();
+        for (long r = 0; r < BENCH_LOOKUP_ROUNDS; r++)
+        {
+            for (uint32_t i = 0; i < BENCH_LOOKUP_STREAM; i++)
+            {
+                sink = lookup(stream[i]);
+            }
+        }
+        int64_t total = bench_now_ns() - t0;
+        if (total < best)
+        {
+            best = total;
+        }
+    }
+    (void)sink;
+
+    return (double)best / ((double)BENCH_LOOKUP_ROUNDS * BENCH_LOOKUP_STREAM);
+}
+
+static void bench_lookup_print(const char *name, const int *stream)
+{
+    double none = bench_lookup_ns(bench_lookup_none, stream);
+    double legacy = bench_lookup_ns(legacy_get_letter_morse_code, stream);
+    double table = bench_lookup_ns(get_letter_morse_code, stream);
+
+    printf("lookup, %s\n", name);
+    printf("  call only: %.2f ns/lookup\n", none);
+    printf("  switch:    %.2f ns/lookup, %.2f over the call\n", legacy, legacy - none);
+    printf("  table:     %.2f ns/lookup, %.2f over the call\n", table, table - none);
+}
+
+static void bench_lookup()
+{
+    static int stream[BENCH_LOOKUP_STREAM];
+    uint32_t text_length = strlen(BENCH_TEXT);
+    uint32_t count = 0;
+
+    // the table has to agree with the switch wherever the switch knows the code
+    for (uint32_t i = 0; i < BENCH_LEGACY_LENGTH; i++)
+    {
+        int decimal = bench_code_value(bench_alphabet[i].code);
+        if (get_letter_morse_code(decimal) != legacy_get_letter_morse_code(decimal))
+        {
+            printf("table and switch disagree on '%c'\n", bench_alphabet[i].letter);
+            exit(1);
+        }
+    }
+    for (uint32_t i = 0; i < BENCH_LOOKUP_STREAM; i++)
+    {
+        stream[i] = bench_code_value(bench_alphabet[bench_rand() % BENCH_LEGACY_LENGTH].code);
+    }
+    bench_lookup_print("random a-z0-9 codes", stream);
+
+    // the letter frequencies of text, so the common codes repeat as they do when keying
+    for (uint32_t i = 0; count < BENCH_LOOKUP_STREAM; i = (i + 1) % text_length)
+    {
+        for (uint32_t a = 0; a < BENCH_LEGACY_LENGTH; a++)
+        {
+            if (bench_alphabet[a].letter == BENCH_TEXT[i])
+            {
+                stream[count++] = bench_code_value(bench_alphabet[a].code);
+            }
+        }
+    }
+    bench_lookup_print("codes of english text", stream);
+}
+
+/**
+ * Times the gpio handlers alone, which only timestamp the edge and queue it. The ring is drained between bursts,
+ * outside the timed part.
+ */
+static void bench_edges()
+{
+    int64_t total = 0;
+
+    for (long r = 0; r < BENCH_EDGE_ROUNDS; r++)
+    {
+        int64_t t0 = bench_now_ns();
+        for (int i = 0; i < BENCH_EDGE_BURST / 2; i++)
+        {
+            gpio_start_event_handler((void *)GPIO_INPUT_IO_START);
+            gpio_end_event_handler((void *)GPIO_INPUT_IO_END);
+        }
+        total += bench_now_ns() - t0;
+        morse_process_input();
+    }
+    if (input_dropped)
+    {
+        printf("%u edges dropped\n", input_dropped);
+        exit(1);
+    }
+    printf("gpio handler: %.2f ns/edge\n", (double)total / ((double)BENCH_EDGE_ROUNDS * BENCH_EDGE_BURST));
+}
+
+int main(int argc, char **argv)
+{
+    long symbol_budget = argc > 1 ? atol(argv[1]) : BENCH_DEFAULT_SYMBOLS;
+
+    // what gpio_setup() does before installing the handlers
+    morse_input_init(&morse_input_gpio);
+
+    printf("keying and send (MESS_BUFFER_LENGTH %d, CHAR_BUFFER_LENGTH %d)\n", MESS_BUFFER_LENGTH, CHAR_BUFFER_LENGTH);
+    printf("message_buf: %zu bytes for %d symbols\n", sizeof(message_buf), MESS_BUFFER_LENGTH);
+    printf("%6s %7s %7s %12s %10s %10s %10s %10s\n", "size", "symbols", "chars", "chars/s", "ns/symbol", "read_ns", "send_ns", "send_worst");
+    for (uint32_t size = 8; size <= MESS_BUFFER_LENGTH; size *= 2)
+    {
+        bench_decode(size, symbol_budget);
+    }
+
+    bench_lookup();
+    bench_edges();
+    return 0;
+}
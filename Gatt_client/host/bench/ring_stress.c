@@ -0,0 +1,81 @@
+/*
+ * Two thread stress run of morse_ring. The producer pushes a running counter in both fields of the edge, the
+ * consumer checks every edge arrives once, in order and whole. Exits non-zero on a lost, duplicated or torn entry.
+ *
+ * usage: ring_stress [entries]
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "morse_ring.h"
+
+#define STRESS_DEFAULT_ENTRIES 100000000L
+
+static morse_ring ring;
+static long stress_entries;
+static long producer_full; // pushes refused because the ring was full
+static long consumer_empty; // pops refused because the ring was empty
+
+static void *stress_producer(void *arg)
+{
+    for (long i = 0; i < stress_entries; i++)
+    {
+        morse_edge edge = { .time = i, .type = (uint8_t)i };
+
+        while (!morse_ring_push(&ring, &edge))
+        {
+            producer_full++;
+            sched_yield(); // let the consumer run on single core hosts
+        }
+    }
+    return NULL;
+}
+
+static void *stress_consumer(void *arg)
+{
+    morse_edge value;
+
+    for (long i = 0; i < stress_entries; i++)
+    {
+        while (!morse_ring_pop(&ring, &value))
+        {
+            consumer_empty++;
+            sched_yield();
+        }
+        if (value.time != i || value.type != (uint8_t)i)
+        {
+            printf("entry %ld: got %lld/%u, expected %ld/%u\n", i, (long long)value.time, value.type, i, (uint8_t)i);
+            exit(1);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t producer, consumer;
+    struct timespec t0, t1;
+
+    stress_entries = argc > 1 ? atol(argv[1]) : STRESS_DEFAULT_ENTRIES;
+    morse_ring_init(&ring);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pthread_create(&consumer, NULL, stress_consumer, NULL);
+    pthread_create(&producer, NULL, stress_producer, NULL);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (morse_ring_count(&ring) != 0)
+    {
+        printf("%u entries left in the ring\n", morse_ring_count(&ring));
+        return 1;
+    }
+
+    double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("%ld entries in order, none lost or duplicated\n", stress_entries);
+    printf("%.0f entries/s, producer saw full %ld times, consumer saw empty %ld times\n", stress_entries / seconds, producer_full, consumer_empty);
+    return 0;
+}
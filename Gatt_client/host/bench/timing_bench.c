@@ -0,0 +1,422 @@
+/*
+ * Host benchmark for the adaptive timing. Keys random words through the gpio handlers on the virtual clock the
+ * way an operator would, standard proportions with random jitter on every element, and measures the character
+ * error rate of what comes out: over a range of speeds from a cold start, across a speed change mid message and
+ * with the contacts bouncing on every press and release or glitching in between.
+ *
+ * usage: timing_bench [-c] [messages per speed]
+ *
+ * -c runs only the speed changes, over BENCH_CHECK_MESSAGES by default, and fails if the error rate of a word after
+ * a change is over its bound. The host build runs it that way.
+ */
+#include <stdlib.h>
+
+#include "morse_functions.h"
+#include "morse_timing.h"
+
+#define BENCH_DEFAULT_MESSAGES 20
+#define BENCH_WORDS_PER_MESSAGE 16
+#define BENCH_SEND_GAP BUTTON_LOCKOUT_US
+#define BENCH_CHECK_MESSAGES 1000
+#define BENCH_CHANGE_WORDS 4 // words keyed after a speed change, errors are counted per word
+#define BENCH_CHANGE_CER_MAX 2 // percent, for every word after a speed change but the one below
+// the first word after a slowdown. Dots at the new speed are keyed just like dashes at the old one, so letters of
+// dots only are read wrong until the first slow dash gives the change away.
+#define BENCH_SLOWDOWN_CER_MAX 30
+#define BENCH_BOUNCE_REVERSALS 4 // most extra edge pairs in one bounce
+#define BENCH_GLITCH_ONE_IN 4 // elements with a glitch in the middle
+#define BENCH_GLITCH_MAX 1000 // longest glitch, microseconds
+
+static const char *bench_words[] = {
+    "the", "of", "and", "to", "in", "is", "you", "that", "it", "he", "was", "for", "on", "are", "as", "with",
+    "his", "they", "at", "be", "this", "have", "from", "or", "one", "had", "by", "word", "but", "not", "what",
+    "all", "were", "we", "when", "your", "can", "said", "there", "use", "each", "which", "she", "do", "how",
+    "their", "if", "will", "up", "other", "about", "out", "many", "then", "them", "these", "so", "some", "her",
+    "would", "make", "like", "him", "into", "time", "has", "look", "two", "more", "write", "go", "see", "number",
+    "cq", "de", "rst", "599", "73", "qth", "name", "wx", "tnx", "fb", "om", "k", "ar", "sk", "qsl", "5nn", "k2abc",
+};
+#define BENCH_WORDS_LENGTH (sizeof(bench_words) / sizeof(bench_words[0]))
+
+static const struct
+{
+    char letter;
+    const char *code;
+} bench_alphabet[] = {
+    {'a', ".-"}, {'b', "-..."}, {'c', "-.-."}, {'d', "-.."}, {'e', "."}, {'f', "..-."},
+    {'g', "--."}, {'h', "...."}, {'i', ".."}, {'j', ".---"}, {'k', "-.-"}, {'l', ".-.."},
+    {'m', "--"}, {'n', "-."}, {'o', "---"}, {'p', ".--."}, {'q', "--.-"}, {'r', ".-."},
+    {'s', "..."}, {'t', "-"}, {'u', "..-"}, {'v', "...-"}, {'w', ".--"}, {'x', "-..-"},
+    {'y', "-.--"}, {'z', "--.."}, {'0', "-----"}, {'1', ".----"}, {'2', "..---"}, {'3', "...--"},
+    {'4', "....-"}, {'5', "....."}, {'6', "-...."}, {'7', "--..."}, {'8', "---.."}, {'9', "----."},
+};
+#define BENCH_ALPHABET_LENGTH (sizeof(bench_alphabet) / sizeof(bench_alphabet[0]))
+
+static uint32_t bench_seed = 0x1234567;
+
+static uint32_t bench_rand()
+{
+    // xorshift32, fixed seed so every run keys the same traces
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 17;
+    bench_seed ^= bench_seed << 5;
+    return bench_seed;
+}
+
+/**
+ * An element of units dot lengths, stretched or shrunk by up to jitter_pct percent. The sum of three uniform
+ * draws keeps most elements near the nominal length, like a human hand.
+ */
+static int64_t bench_element(int64_t unit, int units, int jitter_pct)
+{
+    int64_t spread = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        spread += (int64_t)(bench_rand() % 2001) - 1000;
+    }
+    return unit * units + unit * units * jitter_pct * spread / (3 * 1000 * 100);
+}
+
+static const char *bench_code(char letter)
+{
+    for (uint32_t i = 0; i < BENCH_ALPHABET_LENGTH; i++)
+    {
+        if (bench_alphabet[i].letter == letter)
+        {
+            return bench_alphabet[i].code;
+        }
+    }
+    return "";
+}
+
+/**
+ * Moves the key to pressed or released. With bounce_us, the contacts then open and close again up to
+ * BENCH_BOUNCE_REVERSALS times within that time, at random, before they settle.
+ * @return the time the bounce took, the caller takes it off the element.
+ */
+static int64_t bench_transition(bool pressed, int bounce_us)
+{
+    int reversals = bounce_us ? bench_rand() % (BENCH_BOUNCE_REVERSALS + 1) : 0;
+    int64_t used = 0;
+
+    pressed ? gpio_start_event_handler(NULL) : gpio_end_event_handler(NULL);
+    for (int r = 0; r < 2 * reversals; r++)
+    {
+        // the contacts stay apart or together a little longer each time
+        int64_t step = 1 + bench_rand() % (bounce_us / (2 * reversals));
+        host_timer_advance(step);
+        used += step;
+        ((r % 2 == 0) != pressed) ? gpio_start_event_handler(NULL) : gpio_end_event_handler(NULL);
+    }
+    return used;
+}
+
+/**
+ * Holds the key where it is for duration, with a short pulse the other way in the middle now and then if glitches
+ * is set, like a worn contact or interference on the line.
+ */
+static void bench_hold(int64_t duration, bool pressed, bool glitches)
+{
+    if (glitches && bench_rand() % BENCH_GLITCH_ONE_IN == 0)
+    {
+        int64_t glitch = 1 + bench_rand() % BENCH_GLITCH_MAX;
+
+        host_timer_advance(duration / 2);
+        pressed ? gpio_end_event_handler(NULL) : gpio_start_event_handler(NULL);
+        host_timer_advance(glitch);
+        pressed ? gpio_start_event_handler(NULL) : gpio_end_event_handler(NULL);
+        host_timer_advance(duration - duration / 2 - glitch);
+        return;
+    }
+    host_timer_advance(duration);
+}
+
+/**
+ * Keys text at the given speed, with contact bounce of up to bounce_us on every edge and glitches if set.
+ * Spaces are word gaps.
+ */
+static void bench_key_text(const char *text, int length, int wpm, int jitter_pct, int bounce_us, bool glitches)
+{
+    int64_t unit = 1200000 / wpm;
+    int gap_units = 1;
+    int64_t used = 0; // by the bounce of the last release
+
+    for (int i = 0; i < length; i++)
+    {
+        if (text[i] == ' ')
+        {
+            gap_units = 7;
+            continue;
+        }
+        for (const char *c = bench_code(text[i]); *c; c++)
+        {
+            bench_hold(bench_element(unit, gap_units, jitter_pct) - used, false, glitches);
+            used = bench_transition(true, bounce_us);
+            bench_hold(bench_element(unit, *c == '-' ? 3 : 1, jitter_pct) - used, true, glitches);
+            used = bench_transition(false, bounce_us);
+            morse_process_input();
+            gap_units = 1;
+        }
+        gap_units = 3;
+    }
+}
+
+static int bench_append_words(char *text, int length, int words)
+{
+    for (int w = 0; w < words; w++)
+    {
+        const char *word = bench_words[bench_rand() % BENCH_WORDS_LENGTH];
+        if (length > 0)
+        {
+            text[length++] = ' ';
+        }
+        memcpy(&text[length], word, strlen(word));
+        length += strlen(word);
+    }
+    return length;
+}
+
+/**
+ * Edit distance between what was keyed and what was decoded. If errors_at is given, every error is also counted
+ * against the keyed character it belongs to, extra decoded characters against the keyed one that follows.
+ */
+static int bench_distance(const char *a, int a_len, const char *b, int b_len, int *errors_at)
+{
+    static int d[CHAR_BUFFER_LENGTH + 1][CHAR_BUFFER_LENGTH + 1];
+
+    for (int i = 0; i <= a_len; i++)
+    {
+        d[i][0] = i;
+    }
+    for (int j = 0; j <= b_len; j++)
+    {
+        d[0][j] = j;
+    }
+    for (int i = 1; i <= a_len; i++)
+    {
+        for (int j = 1; j <= b_len; j++)
+        {
+            int best = d[i - 1][j - 1] + (a[i - 1] != b[j - 1]);
+            if (d[i - 1][j] + 1 < best)
+            {
+                best = d[i - 1][j] + 1;
+            }
+            if (d[i][j - 1] + 1 < best)
+            {
+                best = d[i][j - 1] + 1;
+            }
+            d[i][j] = best;
+        }
+    }
+
+    if (errors_at)
+    {
+        // walk the cheapest path back
+        int i = a_len;
+        int j = b_len;
+        memset(errors_at, 0, sizeof(int) * (a_len + 1));
+        while (i > 0 || j > 0)
+        {
+            if (i > 0 && j > 0 && d[i][j] == d[i - 1][j - 1] + (a[i - 1] != b[j - 1]))
+            {
+                errors_at[i - 1] += a[i - 1] != b[j - 1];
+                i--;
+                j--;
+            }
+            else if (i > 0 && d[i][j] == d[i - 1][j] + 1)
+            {
+                errors_at[--i]++;
+            }
+            else
+            {
+                errors_at[i]++;
+                j--;
+            }
+        }
+    }
+    return d[a_len][b_len];
+}
+
+/**
+ * Sends what was keyed and compares it against text.
+ * @return the edit distance.
+ */
+static int bench_send_and_check(const char *text, int length)
+{
+    host_gpio_send(BENCH_SEND_GAP);
+    morse_process_input();
+    int errors = bench_distance(text, length, char_message_buf, char_mess_buf_end, NULL);
+    char_mess_buf_end = 0;
+    mess_buf_end = 0;
+    return errors;
+}
+
+static void bench_speeds(int messages, int jitter_pct)
+{
+    static const int speeds[] = {5, 8, 10, 13, 15, 20, 25, 30, 35, 40, 50, 60};
+
+    printf("cold start per speed, %d%% jitter\n", jitter_pct);
+    printf("%6s %10s %10s %10s %12s\n", "wpm", "chars", "errors", "cer", "estimate");
+    for (uint32_t s = 0; s < sizeof(speeds) / sizeof(speeds[0]); s++)
+    {
+        long chars = 0;
+        long errors = 0;
+
+        morse_input_init(&morse_input_gpio);
+        for (int m = 0; m < messages; m++)
+        {
+            char text[CHAR_BUFFER_LENGTH];
+            int length = bench_append_words(text, 0, BENCH_WORDS_PER_MESSAGE);
+
+            bench_key_text(text, length, speeds[s], jitter_pct, 0, false);
+            errors += bench_send_and_check(text, length);
+            chars += length;
+        }
+        printf("%6d %10ld %10ld %9.2f%% %8u wpm\n", speeds[s], chars, errors, 100.0 * errors / chars, morse_input_wpm());
+    }
+}
+
+/**
+ * Keys messages that change speed after a few words, and counts the errors per word from the change on.
+ * @return false if a word is over its bound.
+ */
+static bool bench_speed_change(int from_wpm, int to_wpm, int messages, int jitter_pct)
+{
+    static int errors_at[CHAR_BUFFER_LENGTH + 1];
+    long before_chars = 0;
+    long before_errors = 0;
+    long after_chars[BENCH_CHANGE_WORDS] = {0};
+    long after_errors[BENCH_CHANGE_WORDS] = {0};
+
+    for (int m = 0; m < messages; m++)
+    {
+        char text[CHAR_BUFFER_LENGTH];
+        int word_start[BENCH_CHANGE_WORDS + 1];
+        int half;
+        int length;
+
+        // settle at the first speed with a whole message, then change speed partway into the next one
+        morse_input_init(&morse_input_gpio);
+        length = bench_append_words(text, 0, BENCH_WORDS_PER_MESSAGE);
+        bench_key_text(text, length, from_wpm, jitter_pct, 0, false);
+        bench_send_and_check(text, length);
+
+        half = bench_append_words(text, 0, BENCH_WORDS_PER_MESSAGE / 2);
+        length = half;
+        for (int w = 0; w < BENCH_CHANGE_WORDS; w++)
+        {
+            word_start[w] = length;
+            length = bench_append_words(text, length, 1);
+        }
+        word_start[BENCH_CHANGE_WORDS] = length;
+        bench_key_text(text, half, from_wpm, jitter_pct, 0, false);
+        bench_key_text(text + half, length - half, to_wpm, jitter_pct, 0, false);
+        host_gpio_send(BENCH_SEND_GAP);
+        morse_process_input();
+
+        bench_distance(text, length, char_message_buf, char_mess_buf_end, errors_at);
+        for (int i = 0; i < half; i++)
+        {
+            before_errors += errors_at[i];
+        }
+        before_chars += half;
+        // the word gap in front of a word counts towards it
+        for (int w = 0; w < BENCH_CHANGE_WORDS; w++)
+        {
+            for (int i = word_start[w]; i < word_start[w + 1]; i++)
+            {
+                after_errors[w] += errors_at[i];
+            }
+            after_chars[w] += word_start[w + 1] - word_start[w];
+        }
+        after_errors[BENCH_CHANGE_WORDS - 1] += errors_at[length];
+        char_mess_buf_end = 0;
+        mess_buf_end = 0;
+    }
+
+    bool ok = true;
+    printf("%3d -> %3d wpm %7.2f%%", from_wpm, to_wpm, 100.0 * before_errors / before_chars);
+    for (int w = 0; w < BENCH_CHANGE_WORDS; w++)
+    {
+        printf(" %7.2f%%", 100.0 * after_errors[w] / after_chars[w]);
+        int cer_max = (w == 0 && to_wpm < from_wpm) ? BENCH_SLOWDOWN_CER_MAX : BENCH_CHANGE_CER_MAX;
+        ok &= after_errors[w] * 100 <= cer_max * after_chars[w];
+    }
+    printf("%s\n", ok ? "" : " FAIL");
+    return ok;
+}
+
+/**
+ * Character error rate with noisy contacts, per kind of noise and speed.
+ */
+static void bench_bounce(int messages, int jitter_pct)
+{
+    static const struct
+    {
+        const char *name;
+        int bounce_us;
+        bool glitches;
+    } noises[] = {
+        {"clean", 0, false}, {"bounce 1 ms", 1000, false}, {"bounce 3 ms", 3000, false},
+        {"bounce 4 ms", 4000, false}, {"glitches", 0, true}, {"both", 3000, true},
+    };
+    static const int speeds[] = {10, 20, 30, 40, 50};
+    const int speed_count = sizeof(speeds) / sizeof(speeds[0]);
+
+    printf("noisy contacts, %d%% jitter, cer per speed\n", jitter_pct);
+    printf("%12s", "");
+    for (int s = 0; s < speed_count; s++)
+    {
+        printf(" %6d wpm", speeds[s]);
+    }
+    printf("\n");
+    for (uint32_t b = 0; b < sizeof(noises) / sizeof(noises[0]); b++)
+    {
+        printf("%12s", noises[b].name);
+        for (int s = 0; s < speed_count; s++)
+        {
+            long chars = 0;
+            long errors = 0;
+
+            morse_input_init(&morse_input_gpio);
+            for (int m = 0; m < messages; m++)
+            {
+                char text[CHAR_BUFFER_LENGTH];
+                int length = bench_append_words(text, 0, BENCH_WORDS_PER_MESSAGE);
+
+                bench_key_text(text, length, speeds[s], jitter_pct, noises[b].bounce_us, noises[b].glitches);
+                errors += bench_send_and_check(text, length);
+                chars += length;
+            }
+            printf(" %9.2f%%", 100.0 * errors / chars);
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bool changes_only = argc > 1 && strcmp(argv[1], "-c") == 0;
+    int first = changes_only ? 2 : 1;
+    int messages = argc > first ? atoi(argv[first]) : (changes_only ? BENCH_CHECK_MESSAGES : BENCH_DEFAULT_MESSAGES);
+    bool ok = true;
+
+    if (!changes_only)
+    {
+        bench_speeds(messages, 10);
+        printf("\n");
+        bench_speeds(messages, 20);
+        printf("\n");
+    }
+    printf("speed change, 10%% jitter, cer before and per word after\n");
+    printf("%14s %8s %8s %8s %8s %8s\n", "", "before", "word 1", "word 2", "word 3", "word 4");
+    ok &= bench_speed_change(10, 25, messages, 10);
+    ok &= bench_speed_change(25, 10, messages, 10);
+    ok &= bench_speed_change(15, 40, messages, 10);
+    ok &= bench_speed_change(40, 15, messages, 10);
+    if (!changes_only)
+    {
+        printf("\n");
+        bench_bounce(messages, 10);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,587 @@
+/*
+ * Replays keying traces through the gpio handlers and the decoder on the virtual clock, exactly as the board saw
+ * them. A trace is a monitor log with the MTRACE lines printed by a client built with CONFIG_MORSE_TRACE, or the
+ * raw binary trace. MEXPECT lines in the file are the messages it has to decode to, one per send, which makes a
+ * directory of logs a regression corpus. Each file is replayed repeatedly to measure the decode throughput.
+ *
+ * usage: trace_replay [-r repeats] [-p] [-i idle_ms] file...
+ *        trace_replay -k [-b bounce_us] [-g] wpm jitter_pct text [wpm jitter_pct text]... > file
+ *
+ * -k keys each text at the given speed with random jitter, followed by a send press, and prints the trace and the
+ * MEXPECT lines. -b makes the contacts bounce for up to bounce_us on every edge and -g adds short glitches in the
+ * middle of some elements. That is how the synthetic part of the corpus in host/traces was made.
+ *
+ * -p delivers the key edges the way a pulse capturing input source like the RMT receiver does: in trains, once the
+ * key has been still for the idle threshold, with the send and read presses held back by its latency. -i sets the
+ * idle threshold, as CONFIG_MORSE_INPUT_RMT_IDLE_MS does on the board.
+ */
+#include <stdlib.h>
+#include <time.h>
+
+#include "morse_functions.h"
+#include "morse_trace.h"
+
+#define REPLAY_FILE_MAX (1 << 20)
+#define REPLAY_MESSAGES_MAX 64
+#define REPLAY_MIN_NS 100000000LL // repeat each trace for at least this long unless -r is given
+#define REPLAY_KEY_START 1000000  // first press of a keyed trace, after boot
+#define REPLAY_KEY_SEND_UNITS 7   // gap before the send press, in dots
+#define REPLAY_BOUNCE_REVERSALS 4 // most extra edge pairs in one bounce
+#define REPLAY_GLITCH_ONE_IN 4    // elements with a glitch in the middle, with -g
+#define REPLAY_GLITCH_MAX 1000    // longest glitch, microseconds
+#define REPLAY_PULSE_IDLE_US 100000 // -p without -i, the default CONFIG_MORSE_INPUT_RMT_IDLE_MS
+#define REPLAY_PULSE_MARGIN_US 10000
+#define REPLAY_PULSE_MAX 128        // -p, pulses in one train, what fits in the RMT memory block
+
+typedef struct replay_result
+{
+    char messages[REPLAY_MESSAGES_MAX][CHAR_BUFFER_LENGTH + 1];
+    int message_count;
+    uint32_t edges;
+    uint32_t interrupts; // handler calls, or receiver interrupts and button handler calls with -p
+    uint32_t lost; // edges the recorder had no room for, the replay can't be exact
+    int64_t duration; // from the first to the last edge, microseconds
+} replay_result;
+
+static const struct
+{
+    char letter;
+    const char *code;
+} replay_alphabet[] = {
+    {'a', ".-"}, {'b', "-..."}, {'c', "-.-."}, {'d', "-.."}, {'e', "."}, {'f', "..-."},
+    {'g', "--."}, {'h', "...."}, {'i', ".."}, {'j', ".---"}, {'k', "-.-"}, {'l', ".-.."},
+    {'m', "--"}, {'n', "-."}, {'o', "---"}, {'p', ".--."}, {'q', "--.-"}, {'r', ".-."},
+    {'s', "..."}, {'t', "-"}, {'u', "..-"}, {'v', "...-"}, {'w', ".--"}, {'x', "-..-"},
+    {'y', "-.--"}, {'z', "--.."}, {'0', "-----"}, {'1', ".----"}, {'2', "..---"}, {'3', "...--"},
+    {'4', "....-"}, {'5', "....."}, {'6', "-...."}, {'7', "--..."}, {'8', "---.."}, {'9', "----."},
+    {'.', ".-.-.-"}, {',', "--..--"}, {'?', "..--.."}, {'/', "-..-."}, {'=', "-...-"},
+};
+#define REPLAY_ALPHABET_LENGTH (sizeof(replay_alphabet) / sizeof(replay_alphabet[0]))
+
+static uint32_t replay_seed = 0x2545F491;
+
+static int64_t replay_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint32_t replay_rand()
+{
+    // xorshift32, fixed seed so -k always writes the same trace
+    replay_seed ^= replay_seed << 13;
+    replay_seed ^= replay_seed >> 17;
+    replay_seed ^= replay_seed << 5;
+    return replay_seed;
+}
+
+static int replay_pulse_start(void)
+{
+    return 0;
+}
+
+static int64_t replay_pulse_idle_us = REPLAY_PULSE_IDLE_US;
+
+// -p, the trains are handed to morse_input_key_pulses() by replay_trace() itself. -i sets its latency.
+static morse_input_source replay_pulse_source = {
+    .name = "replay pulses",
+    .start = replay_pulse_start,
+    .latency_us = REPLAY_PULSE_IDLE_US + REPLAY_PULSE_MARGIN_US,
+};
+
+/**
+ * The key edges of the train being captured with -p.
+ */
+typedef struct replay_train
+{
+    morse_pulse pulses[REPLAY_PULSE_MAX];
+    int count;
+    int64_t last; // time of the last edge
+} replay_train;
+
+/**
+ * The poll event task: decodes what was queued and collects the message of a send press.
+ */
+static void replay_poll(replay_result *result)
+{
+    while (morse_process_input())
+    {
+        if (host_send_requested)
+        {
+            if (result->message_count < REPLAY_MESSAGES_MAX)
+            {
+                memcpy(result->messages[result->message_count], char_message_buf, char_mess_buf_end);
+                result->messages[result->message_count++][char_mess_buf_end] = '\0';
+            }
+            char_mess_buf_end = 0;
+            mess_buf_end = 0;
+            host_send_requested = false;
+        }
+        host_read_requested = false;
+    }
+    host_read_requested = false;
+}
+
+/**
+ * Hands the train to the decoder the way the receiver interrupt does.
+ */
+static void replay_deliver(replay_train *train, replay_result *result)
+{
+    result->interrupts++;
+    morse_input_key_pulses(train->pulses, train->count, train->last);
+    train->count = 0;
+}
+
+/**
+ * Runs the capture and the poll event task up to time: trains end after replay_pulse_idle_us of quiet, and held
+ * back presses are decoded when the task's timeout runs out.
+ */
+static void replay_pulses_until(replay_train *train, int64_t time, replay_result *result)
+{
+    while (1)
+    {
+        int64_t due = train->count ? train->last + replay_pulse_idle_us : INT64_MAX;
+        uint32_t hold = morse_input_hold_us();
+        int64_t wake = hold ? esp_timer_get_time() + hold : INT64_MAX;
+        int64_t next = (due < wake) ? due : wake;
+
+        if (next > time || next == INT64_MAX)
+        {
+            return;
+        }
+        host_timer_set_time(next);
+        if (next == due)
+        {
+            replay_deliver(train, result);
+        }
+        replay_poll(result);
+    }
+}
+
+/**
+ * Feeds a trace through the gpio handlers, or the key edges as pulse trains with pulses set, and collects what
+ * every send press decoded to.
+ * @return 0 on success, -1 if the trace is malformed.
+ */
+static int replay_trace(const uint8_t *trace, uint32_t length, bool pulses, replay_result *result)
+{
+    static replay_train train;
+    uint32_t pos = MORSE_TRACE_HEADER_LENGTH;
+    int64_t time = 0;
+    int64_t first = -1;
+    uint64_t delta;
+    uint8_t type;
+    int rc;
+
+    // what gpio_setup() and a fresh boot do
+    morse_input_init(pulses ? &replay_pulse_source : &morse_input_gpio);
+    host_timer_set_time(0);
+    char_mess_buf_end = 0;
+    mess_buf_end = 0;
+    host_send_requested = false;
+    train.count = 0;
+    result->message_count = 0;
+    result->edges = 0;
+    result->interrupts = 0;
+    result->lost = 0;
+
+    while ((rc = morse_trace_get(trace, length, &pos, &delta, &type)) == 1)
+    {
+        if (type == MORSE_TRACE_LOST)
+        {
+            result->lost += delta;
+            continue;
+        }
+        time += delta;
+        if (first < 0)
+        {
+            first = time;
+        }
+        if (pulses)
+        {
+            replay_pulses_until(&train, time, result);
+        }
+        host_timer_set_time(time);
+        switch (type)
+        {
+        case MORSE_EDGE_START:
+        case MORSE_EDGE_END:
+            if (!pulses)
+            {
+                if (type == MORSE_EDGE_START)
+                {
+                    gpio_start_event_handler((void *)GPIO_INPUT_IO_START);
+                }
+                else
+                {
+                    gpio_end_event_handler((void *)GPIO_INPUT_IO_END);
+                }
+                break;
+            }
+            if (train.count)
+            {
+                train.pulses[train.count - 1].duration_us = time - train.last;
+            }
+            train.pulses[train.count].pressed = type == MORSE_EDGE_START;
+            train.pulses[train.count++].duration_us = 0;
+            train.last = time;
+            result->edges++;
+            // a full memory block ends the capture early
+            if (train.count == REPLAY_PULSE_MAX)
+            {
+                replay_deliver(&train, result);
+                replay_poll(result);
+            }
+            continue;
+        case MORSE_EDGE_SEND:
+            gpio_send_event_handler((void *)GPIO_INPUT_IO_SEND);
+            break;
+        case MORSE_EDGE_READ:
+            gpio_read_event_handler(NULL);
+            break;
+        default:
+            return -1;
+        }
+        result->edges++;
+        result->interrupts++;
+        // the poll event task, woken by every edge
+        replay_poll(result);
+    }
+    if (pulses)
+    {
+        replay_pulses_until(&train, INT64_MAX, result);
+    }
+    result->duration = (first < 0) ? 0 : time - first;
+    return rc;
+}
+
+static int replay_hex(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/**
+ * Pulls the trace and the expected messages out of a monitor log, or takes a binary trace as it is.
+ * @return the trace length, -1 if there is no trace in the file.
+ */
+static int replay_load(char *file, uint32_t file_length, uint8_t *trace, char expected[][CHAR_BUFFER_LENGTH + 1], int *expected_count)
+{
+    uint32_t length = 0;
+
+    *expected_count = 0;
+    if (morse_trace_is_header((uint8_t *)file, file_length))
+    {
+        memcpy(trace, file, file_length);
+        return file_length;
+    }
+
+    for (char *line = strtok(file, "\n"); line; line = strtok(NULL, "\n"))
+    {
+        char *hex = strstr(line, MORSE_TRACE_LINE);
+        char *expect = strstr(line, "MEXPECT ");
+
+        line[strcspn(line, "\r")] = '\0';
+        if (hex)
+        {
+            hex += strlen(MORSE_TRACE_LINE);
+            for (; replay_hex(hex[0]) >= 0 && replay_hex(hex[1]) >= 0; hex += 2)
+            {
+                trace[length++] = (replay_hex(hex[0]) << 4) | replay_hex(hex[1]);
+            }
+        }
+        else if (expect && *expected_count < REPLAY_MESSAGES_MAX)
+        {
+            snprintf(expected[(*expected_count)++], CHAR_BUFFER_LENGTH + 1, "%s", expect + strlen("MEXPECT "));
+        }
+    }
+    return morse_trace_is_header(trace, length) ? (int)length : -1;
+}
+
+/**
+ * Replays one file, checks it against its MEXPECT lines and prints the throughput.
+ * @return 0 if it decoded as expected.
+ */
+static int replay_file(const char *path, long repeats, bool pulses)
+{
+    static char file[REPLAY_FILE_MAX + 1];
+    static uint8_t trace[REPLAY_FILE_MAX];
+    static char expected[REPLAY_MESSAGES_MAX][CHAR_BUFFER_LENGTH + 1];
+    static replay_result result;
+    int expected_count;
+    FILE *f = fopen(path, "rb");
+
+    if (!f)
+    {
+        printf("%s: can't open\n", path);
+        return -1;
+    }
+    uint32_t file_length = fread(file, 1, REPLAY_FILE_MAX, f);
+    fclose(f);
+    file[file_length] = '\0';
+
+    int length = replay_load(file, file_length, trace, expected, &expected_count);
+    if (length < 0 || replay_trace(trace, length, pulses, &result) != 0)
+    {
+        printf("%s: no trace or a malformed one\n", path);
+        return -1;
+    }
+
+    int failed = 0;
+    for (int i = 0; i < result.message_count; i++)
+    {
+        printf("  message %d: \"%s\"\n", i, result.messages[i]);
+        if (i < expected_count && strcmp(result.messages[i], expected[i]) != 0)
+        {
+            printf("    expected \"%s\"\n", expected[i]);
+            failed = 1;
+        }
+    }
+    if (expected_count && expected_count != result.message_count)
+    {
+        printf("  %d messages, expected %d\n", result.message_count, expected_count);
+        failed = 1;
+    }
+    if (result.lost)
+    {
+        printf("  %u edges were lost while recording, the decode may differ from the board\n", result.lost);
+    }
+
+    // throughput, with the results of every run checked against the first
+    long runs = 0;
+    int64_t t0 = replay_now_ns();
+    int64_t elapsed = 0;
+    do
+    {
+        static replay_result again;
+        int same = replay_trace(trace, length, pulses, &again) == 0 && again.message_count == result.message_count;
+        for (int i = 0; same && i < result.message_count; i++)
+        {
+            same = strcmp(again.messages[i], result.messages[i]) == 0;
+        }
+        if (!same)
+        {
+            printf("  replay %ld decoded differently, state leaks between runs\n", runs);
+            failed = 1;
+            break;
+        }
+        runs++;
+        elapsed = replay_now_ns() - t0;
+    } while (repeats ? runs < repeats : elapsed < REPLAY_MIN_NS);
+
+    double seconds = elapsed / 1e9;
+    printf("%s: %s, %u edges, %u interrupts, %.1f s keyed, %.0f edges/s, %.0fx real time\n", path,
+           failed ? "FAIL" : (expected_count ? "ok" : "no MEXPECT lines"), result.edges, result.interrupts, result.duration / 1e6,
+           result.edges * runs / seconds, result.duration / 1e6 * runs / seconds);
+    return failed ? -1 : 0;
+}
+
+static const char *replay_code(char letter)
+{
+    for (uint32_t i = 0; i < REPLAY_ALPHABET_LENGTH; i++)
+    {
+        if (replay_alphabet[i].letter == letter)
+        {
+            return replay_alphabet[i].code;
+        }
+    }
+    return "";
+}
+
+/**
+ * An element of units dot lengths, stretched or shrunk by up to jitter_pct percent, as in timing_bench.
+ */
+static int64_t replay_element(int64_t unit, int units, int jitter_pct)
+{
+    int64_t spread = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        spread += (int64_t)(replay_rand() % 2001) - 1000;
+    }
+    return unit * units + unit * units * jitter_pct * spread / (3 * 1000 * 100);
+}
+
+/**
+ * Where -k is in the trace it writes, and how noisy the key is.
+ */
+typedef struct replay_keyer
+{
+    uint8_t trace[REPLAY_FILE_MAX];
+    uint32_t length;
+    int64_t time;
+    int64_t prev; // time of the last edge written
+    int bounce_us;
+    bool glitches;
+} replay_keyer;
+
+static void replay_put(replay_keyer *keyer, uint8_t type)
+{
+    keyer->length += morse_trace_put(&keyer->trace[keyer->length], sizeof(keyer->trace) - keyer->length,
+                                     keyer->time - keyer->prev, type);
+    keyer->prev = keyer->time;
+}
+
+/**
+ * Presses or releases the key, bouncing up to REPLAY_BOUNCE_REVERSALS times within bounce_us, as in timing_bench.
+ * @return the time the bounce took.
+ */
+static int64_t replay_transition(replay_keyer *keyer, bool pressed)
+{
+    int reversals = keyer->bounce_us ? replay_rand() % (REPLAY_BOUNCE_REVERSALS + 1) : 0;
+    int64_t used = 0;
+
+    replay_put(keyer, pressed ? MORSE_EDGE_START : MORSE_EDGE_END);
+    for (int r = 0; r < 2 * reversals; r++)
+    {
+        int64_t step = 1 + replay_rand() % (keyer->bounce_us / (2 * reversals));
+        keyer->time += step;
+        used += step;
+        replay_put(keyer, ((r % 2 == 0) != pressed) ? MORSE_EDGE_START : MORSE_EDGE_END);
+    }
+    return used;
+}
+
+/**
+ * Leaves the key where it is for duration, with a glitch in the middle of one in REPLAY_GLITCH_ONE_IN if set.
+ */
+static void replay_hold(replay_keyer *keyer, int64_t duration, bool pressed)
+{
+    if (keyer->glitches && replay_rand() % REPLAY_GLITCH_ONE_IN == 0)
+    {
+        int64_t glitch = 1 + replay_rand() % REPLAY_GLITCH_MAX;
+
+        keyer->time += duration / 2;
+        replay_put(keyer, pressed ? MORSE_EDGE_END : MORSE_EDGE_START);
+        keyer->time += glitch;
+        replay_put(keyer, pressed ? MORSE_EDGE_START : MORSE_EDGE_END);
+        keyer->time += duration - duration / 2 - glitch;
+        return;
+    }
+    keyer->time += duration;
+}
+
+/**
+ * Keys the texts into a trace and prints it the way the firmware would, with MEXPECT lines in front.
+ */
+static int replay_key(int argc, char **argv)
+{
+    static replay_keyer keyer;
+
+    keyer.time = REPLAY_KEY_START;
+    for (; argc > 0 && argv[0][0] == '-'; argc--, argv++)
+    {
+        if (strcmp(argv[0], "-g") == 0)
+        {
+            keyer.glitches = true;
+        }
+        else if (strcmp(argv[0], "-b") == 0 && argc > 1)
+        {
+            keyer.bounce_us = atoi(argv[1]);
+            argc--, argv++;
+        }
+    }
+    if (argc == 0 || argc % 3 != 0)
+    {
+        printf("usage: trace_replay -k [-b bounce_us] [-g] wpm jitter_pct text [wpm jitter_pct text]...\n");
+        return 1;
+    }
+    morse_trace_header(keyer.trace);
+    keyer.length = MORSE_TRACE_HEADER_LENGTH;
+
+    for (int m = 0; m < argc; m += 3)
+    {
+        int64_t unit = 1200000 / atoi(argv[m]);
+        int jitter_pct = atoi(argv[m + 1]);
+        const char *text = argv[m + 2];
+        int gap_units = 0;
+        int64_t used = 0; // by the bounce of the last release
+
+        printf("MEXPECT %s\n", text);
+        for (const char *t = text; *t; t++)
+        {
+            if (*t == ' ')
+            {
+                gap_units = 7;
+                continue;
+            }
+            for (const char *c = replay_code(*t); *c; c++)
+            {
+                if (gap_units)
+                {
+                    replay_hold(&keyer, replay_element(unit, gap_units, jitter_pct) - used, false);
+                }
+                used = replay_transition(&keyer, true);
+                replay_hold(&keyer, replay_element(unit, *c == '-' ? 3 : 1, jitter_pct) - used, true);
+                used = replay_transition(&keyer, false);
+                gap_units = 1;
+            }
+            gap_units = 3;
+        }
+        keyer.time += REPLAY_KEY_SEND_UNITS * unit;
+        replay_put(&keyer, MORSE_EDGE_SEND);
+        // the operator reads the reply before keying on
+        keyer.time += 2000000;
+    }
+
+    for (uint32_t start = 0; start < keyer.length; start += MORSE_TRACE_LINE_BYTES)
+    {
+        printf(MORSE_TRACE_LINE);
+        for (uint32_t i = start; i < keyer.length && i < start + MORSE_TRACE_LINE_BYTES; i++)
+        {
+            printf("%02x", keyer.trace[i]);
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    long repeats = 0;
+    bool pulses = false;
+    int failed = 0;
+    int first = 1;
+
+    if (argc > 1 && strcmp(argv[1], "-k") == 0)
+    {
+        return replay_key(argc - 2, argv + 2);
+    }
+    for (; first < argc && argv[first][0] == '-'; first++)
+    {
+        if (strcmp(argv[first], "-p") == 0)
+        {
+            pulses = true;
+        }
+        else if (strcmp(argv[first], "-r") == 0 && first + 1 < argc)
+        {
+            repeats = atol(argv[++first]);
+        }
+        else if (strcmp(argv[first], "-i") == 0 && first + 1 < argc)
+        {
+            replay_pulse_idle_us = atol(argv[++first]) * 1000LL;
+            replay_pulse_source.latency_us = replay_pulse_idle_us + REPLAY_PULSE_MARGIN_US;
+        }
+    }
+    if (first >= argc)
+    {
+        printf("usage: trace_replay [-r repeats] [-p] [-i idle_ms] file...\n");
+        return 1;
+    }
+    for (int i = first; i < argc; i++)
+    {
+        failed |= replay_file(argv[i], repeats, pulses) != 0;
+    }
+    return failed;
+}
@@ -0,0 +1,226 @@
+/*
+ * Host benchmark for the morse_wire frame format. Encodes a text corpus as ascii (what the client sent before),
+ * six bit codes and morse bit strings, checks every frame decodes back to its message, and counts the bytes each
+ * takes on air per write, headers included, at the default and at the negotiated MTU and link layer payload. It
+ * also checks that the densest frame of the longest length fits MORSE_WIRE_TEXT_MAX_LENGTH.
+ *
+ * usage: wire_bench [rounds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "morse_proto.h"
+#include "morse_wire.h"
+
+#define BENCH_DEFAULT_ROUNDS 20000 // encode and decode passes over the corpus, for the timings
+#define BENCH_MESSAGE_MAX 256 // CHAR_BUFFER_LENGTH on the client
+
+// on air per link layer packet on the 1M PHY: preamble, access address, header, CRC
+#define BENCH_LL_OVERHEAD (1 + 4 + 2 + 3)
+#define BENCH_L2CAP_HEADER 4
+
+// everyday messages and operator traffic, lowercase as the client decodes them
+static const char *bench_corpus[] = {
+    "cq cq cq de w1aw w1aw k",
+    "w1aw de k2abc ur rst 599 599 name bob qth boston hw?",
+    "tnx fer call. wx here is sunny and warm, temp 25c. rig is 100w into a dipole",
+    "qsl? 73 es gud dx",
+    "meet at the north gate at 6",
+    "running late, start without me",
+    "the quick brown fox jumps over the lazy dog",
+    "battery at 40 percent, heading back to base now",
+    "can you hear me? reply with your position",
+    "sos",
+    "all stations, net begins in five minutes on the usual frequency",
+    "i will be out of range until tomorrow morning. leave messages with the relay",
+    "received your message, will call back after lunch",
+    "lat 42.36 lon -71.06",
+    "ok",
+    "the weather service reports a storm moving in from the west tonight, secure all equipment before dark",
+    "please send the list of parts we need for the antenna repair",
+    "hello world!",
+};
+#define BENCH_CORPUS_LENGTH (sizeof(bench_corpus) / sizeof(bench_corpus[0]))
+
+static const struct
+{
+    const char *name;
+    int format; // -2 for plain ascii
+} bench_formats[] = {
+    {"ascii", -2},
+    {"sixbit", MORSE_WIRE_FORMAT_SIXBIT},
+    {"morse", MORSE_WIRE_FORMAT_MORSE},
+    {"auto", MORSE_WIRE_FORMAT_AUTO},
+};
+#define BENCH_FORMATS_LENGTH (sizeof(bench_formats) / sizeof(bench_formats[0]))
+
+static int64_t bench_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Bytes on air for one message written the way send_message() does: one write when it fits the MTU, otherwise
+ * chunks with a one byte header. Every ATT PDU is split into link layer packets of at most tx_octets.
+ */
+static long bench_air_bytes(int payload, int mtu, int tx_octets)
+{
+    int room = mtu - MORSE_ATT_WRITE_OVERHEAD;
+    long air = 0;
+
+    if (payload > room)
+    {
+        // chunked, every chunk but the last is a full ATT payload
+        int chunk = room - MORSE_CHUNK_HEADER_LENGTH;
+        while (payload > 0)
+        {
+            int piece = payload < chunk ? payload : chunk;
+            air += bench_air_bytes(piece + MORSE_CHUNK_HEADER_LENGTH, mtu, tx_octets);
+            payload -= piece;
+        }
+        return air;
+    }
+
+    int l2cap = BENCH_L2CAP_HEADER + MORSE_ATT_WRITE_OVERHEAD + payload;
+    int packets = (l2cap + tx_octets - 1) / tx_octets;
+    return l2cap + (long)packets * BENCH_LL_OVERHEAD;
+}
+
+/**
+ * Copies a corpus line, dropping spaces when keyed is set. The client has no word gap, so keyed messages have none.
+ */
+static int bench_message(const char *line, bool keyed, char *out)
+{
+    int length = 0;
+
+    for (const char *c = line; *c && length < BENCH_MESSAGE_MAX; c++)
+    {
+        if (!keyed || *c != ' ')
+        {
+            out[length++] = *c;
+        }
+    }
+    return length;
+}
+
+static void bench_sizes(bool keyed)
+{
+    long chars = 0;
+    long payload[BENCH_FORMATS_LENGTH] = {0};
+    long air_default[BENCH_FORMATS_LENGTH] = {0};
+    long air_negotiated[BENCH_FORMATS_LENGTH] = {0};
+
+    for (uint32_t m = 0; m < BENCH_CORPUS_LENGTH; m++)
+    {
+        char text[BENCH_MESSAGE_MAX];
+        int length = bench_message(bench_corpus[m], keyed, text);
+        chars += length;
+
+        for (uint32_t f = 0; f < BENCH_FORMATS_LENGTH; f++)
+        {
+            uint8_t frame[MORSE_WIRE_MAX_LENGTH(BENCH_MESSAGE_MAX)];
+            char decoded[BENCH_MESSAGE_MAX];
+            int size = length;
+
+            if (bench_formats[f].format != -2)
+            {
+                uint8_t seq;
+                size = morse_wire_encode(text, length, (uint8_t)m, bench_formats[f].format, frame, sizeof(frame));
+                int decoded_length = morse_wire_decode(frame, size, decoded, sizeof(decoded), &seq);
+                if (size != morse_wire_length(text, length, bench_formats[f].format) || decoded_length != length ||
+                    memcmp(decoded, text, length) != 0 || seq != (uint8_t)m)
+                {
+                    printf("%s round trip failed on \"%.*s\"\n", bench_formats[f].name, length, text);
+                    exit(1);
+                }
+            }
+            payload[f] += size;
+            air_default[f] += bench_air_bytes(size, 23, 27);
+            air_negotiated[f] += bench_air_bytes(size, 247, 251);
+        }
+    }
+
+    printf("%s corpus, %zu messages, %ld characters\n", keyed ? "keyed (no spaces)" : "text", BENCH_CORPUS_LENGTH, chars);
+    printf("%8s %10s %12s %16s %12s %16s %12s\n", "format", "payload", "bits/char", "air mtu 23", "vs ascii", "air mtu 247", "vs ascii");
+    for (uint32_t f = 0; f < BENCH_FORMATS_LENGTH; f++)
+    {
+        printf("%8s %10ld %12.2f %16ld %11.1f%% %16ld %11.1f%%\n", bench_formats[f].name, payload[f], payload[f] * 8.0 / chars,
+               air_default[f], 100.0 * (air_default[f] - air_default[0]) / air_default[0],
+               air_negotiated[f], 100.0 * (air_negotiated[f] - air_negotiated[0]) / air_negotiated[0]);
+    }
+}
+
+/**
+ * Checks that the densest frame of the longest message decodes into MORSE_WIRE_TEXT_MAX_LENGTH characters, the
+ * size the client and server give the decoded text.
+ */
+static void bench_text_max(void)
+{
+    static char text[MORSE_WIRE_TEXT_MAX_LENGTH(MORSE_MESSAGE_MAX_LENGTH)];
+    static char decoded[sizeof(text)];
+    static uint8_t frame[MORSE_MESSAGE_MAX_LENGTH];
+    int size;
+
+    memset(text, 'e', sizeof(text));
+    size = morse_wire_encode(text, sizeof(text), 0, MORSE_WIRE_FORMAT_MORSE, frame, sizeof(frame));
+    if (size != MORSE_MESSAGE_MAX_LENGTH ||
+        morse_wire_decode(frame, size, decoded, sizeof(decoded), NULL) != (int)sizeof(text) ||
+        morse_wire_decode(frame, size, decoded, sizeof(decoded) - 1, NULL) != -1)
+    {
+        printf("a %d byte frame doesn't unpack to exactly %zu characters\n", MORSE_MESSAGE_MAX_LENGTH, sizeof(text));
+        exit(1);
+    }
+}
+
+static void bench_speed(long rounds)
+{
+    static uint8_t frames[BENCH_CORPUS_LENGTH][MORSE_WIRE_MAX_LENGTH(BENCH_MESSAGE_MAX)];
+    static int frame_lengths[BENCH_CORPUS_LENGTH];
+    char decoded[BENCH_MESSAGE_MAX];
+    long chars = 0;
+    volatile int sink = 0;
+
+    for (uint32_t m = 0; m < BENCH_CORPUS_LENGTH; m++)
+    {
+        chars += strlen(bench_corpus[m]);
+    }
+
+    int64_t t0 = bench_now_ns();
+    for (long r = 0; r < rounds; r++)
+    {
+        for (uint32_t m = 0; m < BENCH_CORPUS_LENGTH; m++)
+        {
+            frame_lengths[m] = morse_wire_encode(bench_corpus[m], strlen(bench_corpus[m]), (uint8_t)r, MORSE_WIRE_FORMAT_AUTO,
+                                                 frames[m], sizeof(frames[m]));
+        }
+    }
+    int64_t t1 = bench_now_ns();
+    for (long r = 0; r < rounds; r++)
+    {
+        for (uint32_t m = 0; m < BENCH_CORPUS_LENGTH; m++)
+        {
+            sink += morse_wire_decode(frames[m], frame_lengths[m], decoded, sizeof(decoded), NULL);
+        }
+    }
+    int64_t t2 = bench_now_ns();
+    (void)sink;
+
+    printf("auto encode: %.2f ns/char, decode: %.2f ns/char\n", (double)(t1 - t0) / (chars * rounds), (double)(t2 - t1) / (chars * rounds));
+}
+
+int main(int argc, char **argv)
+{
+    long rounds = argc > 1 ? atol(argv[1]) : BENCH_DEFAULT_ROUNDS;
+
+    bench_text_max();
+    bench_sizes(true);
+    printf("\n");
+    bench_sizes(false);
+    printf("\n");
+    bench_speed(rounds);
+    return 0;
+}
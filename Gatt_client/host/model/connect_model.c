@@ -0,0 +1,137 @@
+/*
+ * Host model of the time from boot to a usable link, for picking the scan and advertising parameters in
+ * Kconfig. The server advertises on channels 37, 38 and 39 one after the other every advertising interval plus
+ * the 0 to 10 ms random delay the spec adds. The client listens on one channel per scan interval, the next one
+ * the interval after, for a window at the start of each. The server is seen at the first packet that lands in a
+ * window on the channel being scanned. Both start at a random phase, the table is over many such starts. Nothing
+ * here is measured, the client logs the times a board takes.
+ *
+ * After that the link is on the interactive profile and every ATT request is answered an interval later: the MTU
+ * exchange, then either the cache check or discovery (service, characteristics, descriptors, each with the request
+ * that finds nothing more), then the CCCD write. The server has no Database Hash, so the check discovers the service
+ * and its characteristics, and discovery starts with the hash read that finds none. The boot to sync time is not
+ * modelled, the client and server logs have it.
+ *
+ * usage: connect_model [scan_itvl_ms scan_window_ms adv_itvl_ms]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define MODEL_RUNS 10000
+#define MODEL_LIMIT_US 60000000LL // give up on a start after a minute
+#define MODEL_ADV_DELAY_US 10000 // advDelay, drawn 0 to 10 ms per advertising event
+#define MODEL_ADV_PACKET_US 376 // ADV_IND with the name, and the switch to the next channel
+#define MODEL_CONN_INTERVAL_US 7500 // MORSE_LINK_INTERACTIVE, the client connects on it
+#define MODEL_CONNECT_US (1250 + MODEL_CONN_INTERVAL_US) // transmit window delay and offset, up to the first event
+
+// ATT round trips after the connection is up, each one interval
+#define MODEL_RT_MTU 1
+#define MODEL_RT_CACHED 4 // service 2, characteristics 2. With a Database Hash, 2: the read and the one that finds no more
+#define MODEL_RT_DISCOVER 8 // hash 1, service 2, characteristics 3, descriptors 2
+#define MODEL_RT_SUBSCRIBE 1
+
+static const struct
+{
+    int scan_itvl_ms;
+    int scan_window_ms;
+    int adv_itvl_ms;
+    const char *name;
+} model_configs[] = {
+    {30, 30, 160, "defaults"},
+    {30, 30, 20, "defaults, boot burst"},
+    {100, 30, 160, "duty cycled scan"},
+    {100, 30, 20, "duty cycled scan, boot burst"},
+    {30, 30, 1000, "slow advertising"},
+};
+#define MODEL_CONFIGS_LENGTH (sizeof(model_configs) / sizeof(model_configs[0]))
+
+static uint32_t model_seed = 0x1234567;
+
+static uint32_t model_rand()
+{
+    // xorshift32, fixed seed so every run draws the same phases
+    model_seed ^= model_seed << 13;
+    model_seed ^= model_seed >> 17;
+    model_seed ^= model_seed << 5;
+    return model_seed;
+}
+
+/**
+ * @return us from both sides starting to the scanner seeing the first packet, or MODEL_LIMIT_US.
+ */
+static long long model_seen_us(long long scan_itvl, long long scan_window, long long adv_itvl)
+{
+    long long scan_phase = model_rand() % scan_itvl;
+    int scan_channel = model_rand() % 3;
+    long long adv = model_rand() % adv_itvl;
+
+    while (adv < MODEL_LIMIT_US)
+    {
+        for (int channel = 0; channel < 3; channel++)
+        {
+            long long packet = adv + channel * MODEL_ADV_PACKET_US;
+            long long scan = packet + scan_phase; // time since the first scan interval started
+            long long index = scan / scan_itvl;
+
+            if ((index + scan_channel) % 3 == channel && scan - index * scan_itvl + MODEL_ADV_PACKET_US <= scan_window)
+            {
+                return packet + MODEL_ADV_PACKET_US;
+            }
+        }
+        adv += adv_itvl + model_rand() % MODEL_ADV_DELAY_US;
+    }
+    return MODEL_LIMIT_US;
+}
+
+static int model_compare(const void *a, const void *b)
+{
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static void model_run(int scan_itvl_ms, int scan_window_ms, int adv_itvl_ms, const char *name)
+{
+    static long long seen[MODEL_RUNS];
+    long long connect = MODEL_CONNECT_US + MODEL_RT_MTU * MODEL_CONN_INTERVAL_US;
+    long long cached = connect + (MODEL_RT_CACHED + MODEL_RT_SUBSCRIBE) * MODEL_CONN_INTERVAL_US;
+    long long discover = connect + (MODEL_RT_DISCOVER + MODEL_RT_SUBSCRIBE) * MODEL_CONN_INTERVAL_US;
+
+    for (int i = 0; i < MODEL_RUNS; i++)
+    {
+        seen[i] = model_seen_us(scan_itvl_ms * 1000LL, scan_window_ms * 1000LL, adv_itvl_ms * 1000LL);
+    }
+    qsort(seen, MODEL_RUNS, sizeof(seen[0]), model_compare);
+
+    printf("%-30s %4d/%-4d %5d %8lld %8lld %8lld %10lld %10lld\n", name, scan_itvl_ms, scan_window_ms, adv_itvl_ms,
+           seen[MODEL_RUNS / 2] / 1000, seen[MODEL_RUNS * 9 / 10] / 1000, seen[MODEL_RUNS * 99 / 100] / 1000,
+           (seen[MODEL_RUNS / 2] + cached) / 1000, (seen[MODEL_RUNS / 2] + discover) / 1000);
+}
+
+int main(int argc, char **argv)
+{
+    printf("%-30s %9s %5s %8s %8s %8s %10s %10s\n", "", "scan", "adv", "seen ms", "", "", "ready ms", "");
+    printf("%-30s %9s %5s %8s %8s %8s %10s %10s\n", "config", "itvl/win", "itvl", "median", "p90", "p99", "cached", "discover");
+
+    if (argc > 3)
+    {
+        int scan_itvl = atoi(argv[1]);
+        int scan_window = atoi(argv[2]);
+        int adv_itvl = atoi(argv[3]);
+
+        if (scan_itvl <= 0 || scan_window <= 0 || scan_window > scan_itvl || adv_itvl < 20)
+        {
+            printf("usage: %s [scan_itvl_ms scan_window_ms adv_itvl_ms], window at most the interval, adv at least 20\n", argv[0]);
+            return 1;
+        }
+        model_run(scan_itvl, scan_window, adv_itvl, "command line");
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < MODEL_CONFIGS_LENGTH; i++)
+    {
+        model_run(model_configs[i].scan_itvl_ms, model_configs[i].scan_window_ms, model_configs[i].adv_itvl_ms, model_configs[i].name);
+    }
+    return 0;
+}
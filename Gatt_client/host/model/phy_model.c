@@ -0,0 +1,146 @@
+/*
+ * Host model of the long message path per PHY. A message is written the way send_message() does with chunked
+ * writes at the negotiated MTU: every chunk but the last as a write command, the last as a write request, each ATT
+ * PDU split into link layer packets of up to 251 bytes, as many as data length extension allows in the PHY's air time.
+ * Every packet the client sends is answered by an empty one from the server in the same connection event, and the
+ * write response comes in the event after the last chunk. Events are taken to run the whole interval, so this is the
+ * best the link can do, the goodput the client logs on a board should come out below it.
+ *
+ * usage: phy_model [interval_us]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "morse_proto.h"
+
+#define MODEL_MTU 527 // BLE_ATT_MTU_MAX, what both boards negotiate
+#define MODEL_TX_OCTETS 251 // LINK_TX_OCTETS_MAX
+#define MODEL_L2CAP_HEADER 4
+#define MODEL_LL_HEADER 2
+#define MODEL_LL_CRC 3
+#define MODEL_T_IFS 150 // us between packets
+#define MODEL_ATT_RSP_LENGTH 1 // write response, opcode only
+
+static const int model_lengths[] = {64, 256, 512, MORSE_MESSAGE_MAX_LENGTH};
+#define MODEL_LENGTHS_LENGTH (sizeof(model_lengths) / sizeof(model_lengths[0]))
+
+// the interactive profile's interval range in morse_link.c
+static const int model_intervals[] = {7500, 15000};
+#define MODEL_INTERVALS_LENGTH (sizeof(model_intervals) / sizeof(model_intervals[0]))
+
+static const struct
+{
+    const char *name;
+    int fixed_us;    // preamble and access address, on coded also the coding indicator and TERM1
+    int byte_us;     // per byte of header, payload and CRC
+    int term_us;     // TERM2 on coded
+    int tx_time_max; // air time data length extension allows, MORSE_LINK_TX_TIME_MAX
+} model_phys[] = {
+    {"1M", 40, 8, 0, 2120},
+    {"2M", 24, 4, 0, 2120},
+    {"coded S2", 376, 16, 6, 17040},
+    {"coded S8", 376, 64, 24, 17040},
+    // what coded got before the tx time followed the PHY
+    {"coded S8, 1M tx time", 376, 64, 24, 2120},
+};
+#define MODEL_PHYS_LENGTH (sizeof(model_phys) / sizeof(model_phys[0]))
+
+static int model_packet_us(int phy, int payload)
+{
+    return model_phys[phy].fixed_us + (MODEL_LL_HEADER + payload + MODEL_LL_CRC) * model_phys[phy].byte_us + model_phys[phy].term_us;
+}
+
+/**
+ * @return the largest link layer payload that fits the PHY's allowed air time, and with its empty answer in the
+ * connection interval.
+ */
+static int model_tx_octets(int phy, int interval)
+{
+    int tx_time = interval - 2 * MODEL_T_IFS - model_packet_us(phy, 0);
+    int octets;
+
+    if (tx_time > model_phys[phy].tx_time_max)
+    {
+        tx_time = model_phys[phy].tx_time_max;
+    }
+    octets = (tx_time - model_phys[phy].fixed_us - model_phys[phy].term_us) / model_phys[phy].byte_us - MODEL_LL_HEADER - MODEL_LL_CRC;
+
+    if (octets > MODEL_TX_OCTETS)
+    {
+        return MODEL_TX_OCTETS;
+    }
+    return (octets < 27) ? 27 : octets; // every controller takes 27
+}
+
+/**
+ * Time from the first chunk to the write response for one message, packets counted in *packets.
+ */
+static long model_message_us(int phy, int length, int interval, int *packets)
+{
+    int chunk = MODEL_MTU - MORSE_ATT_WRITE_OVERHEAD - MORSE_CHUNK_HEADER_LENGTH;
+    int tx_octets = model_tx_octets(phy, interval);
+    long event_used = 0; // us taken in the current connection event
+    long events = 1;
+
+    *packets = 0;
+    for (int offset = 0; offset < length; offset += chunk)
+    {
+        int piece = (length - offset < chunk) ? length - offset : chunk;
+        int l2cap = MODEL_L2CAP_HEADER + MORSE_ATT_WRITE_OVERHEAD + MORSE_CHUNK_HEADER_LENGTH + piece;
+
+        for (int sent = 0; sent < l2cap; sent += tx_octets)
+        {
+            int payload = (l2cap - sent < tx_octets) ? l2cap - sent : tx_octets;
+            long exchange = model_packet_us(phy, payload) + MODEL_T_IFS + model_packet_us(phy, 0) + MODEL_T_IFS;
+
+            if (event_used > 0 && event_used + exchange > interval)
+            {
+                events++;
+                event_used = 0;
+            }
+            event_used += exchange;
+            (*packets)++;
+        }
+    }
+    // the response goes out at the start of the next event
+    return events * interval + model_packet_us(phy, MODEL_L2CAP_HEADER + MODEL_ATT_RSP_LENGTH);
+}
+
+int main(int argc, char **argv)
+{
+    int intervals[MODEL_INTERVALS_LENGTH];
+    int interval_count = MODEL_INTERVALS_LENGTH;
+
+    for (uint32_t i = 0; i < MODEL_INTERVALS_LENGTH; i++)
+    {
+        intervals[i] = model_intervals[i];
+    }
+    if (argc > 1)
+    {
+        intervals[0] = atoi(argv[1]);
+        interval_count = 1;
+    }
+    if (intervals[0] < 7500)
+    {
+        printf("usage: %s [interval_us], at least 7500\n", argv[0]);
+        return 1;
+    }
+
+    for (int i = 0; i < interval_count; i++)
+    {
+        printf("connection interval %d us, MTU %d\n", intervals[i], MODEL_MTU);
+        printf("%-22s %6s %8s %8s %10s %12s\n", "PHY", "bytes", "octets", "packets", "us", "bytes/s");
+        for (uint32_t p = 0; p < MODEL_PHYS_LENGTH; p++)
+        {
+            for (uint32_t l = 0; l < MODEL_LENGTHS_LENGTH; l++)
+            {
+                int packets;
+                long us = model_message_us(p, model_lengths[l], intervals[i], &packets);
+                printf("%-22s %6d %8d %8d %10ld %12ld\n", model_phys[p].name, model_lengths[l], model_tx_octets(p, intervals[i]), packets, us,
+                       (long)model_lengths[l] * 1000000 / us);
+            }
+        }
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include "morse_functions.h"
+#include "poll_event_task_functions.h"
+
+static int64_t host_time_us = 0;
+
+bool host_read_requested = false;
+bool host_send_requested = false;
+uint32_t host_notify_count = 0;
+int64_t send_press_time = 0;
+
+// defined in morse_common.c on the target
+struct ble_profile *ble_profiles[MORSE_PEER_MAX];
+
+bool ble_profile_ready(const struct ble_profile *profile)
+{
+    return profile != NULL; // no server on the host, ble_profiles stays empty
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return host_time_us;
+}
+
+void host_timer_set_time(int64_t time_us)
+{
+    host_time_us = time_us;
+}
+
+void host_timer_advance(int64_t delta_us)
+{
+    host_time_us += delta_us;
+}
+
+esp_err_t gpio_isr_handler_add(int gpio_num, gpio_isr_t isr_handler, void *args)
+{
+    return ESP_OK;
+}
+
+void host_gpio_press(int64_t gap_us, int64_t hold_us)
+{
+    host_time_us += gap_us;
+    gpio_start_event_handler((void *)GPIO_INPUT_IO_START);
+    host_time_us += hold_us;
+    gpio_end_event_handler((void *)GPIO_INPUT_IO_END);
+}
+
+void host_gpio_send(int64_t gap_us)
+{
+    host_time_us += gap_us;
+    gpio_send_event_handler((void *)GPIO_INPUT_IO_SEND);
+}
+
+// poll_event_task_functions.c needs the nimble host, so only the flag setters are replaced here.
+void poll_event_set_all_flags(bool val)
+{
+    host_read_requested = val;
+    host_send_requested = val;
+}
+
+void poll_event_notify_from_isr()
+{
+    host_notify_count++;
+}
+
+int poll_event_set_flag(uint8_t flag, bool val)
+{
+    switch (flag)
+    {
+    case POLL_EVENT_READ_FLAG:
+        host_read_requested = val;
+        break;
+    case POLL_EVENT_SEND_FLAG:
+        host_send_requested = val;
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
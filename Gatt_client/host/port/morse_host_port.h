@@ -0,0 +1,122 @@
+#ifndef MORSE_HOST_PORT_H
+#define MORSE_HOST_PORT_H
+
+/*
+ * Host (linux) stand-ins for the parts of esp-idf and NimBLE that morse_src touches.
+ * Only included when MORSE_HOST_BUILD is defined, see morse_common.h.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// sdkconfig stand-ins, the Kconfig defaults
+#define CONFIG_MORSE_DEBOUNCE_US 5000
+#define CONFIG_MORSE_SERVER_COUNT 1
+
+// code placement attributes are meaningless on the host
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+// esp_log stand-ins. Logging is compiled out so the benchmark measures the decode path, not stdio.
+#define ESP_LOGE(tag, fmt, ...) do { } while (0)
+#define ESP_LOGW(tag, fmt, ...) do { } while (0)
+#define ESP_LOGI(tag, fmt, ...) do { } while (0)
+#define ESP_LOGD(tag, fmt, ...) do { } while (0)
+#define ESP_DRAM_LOGE(tag, fmt, ...) do { } while (0)
+#define ESP_DRAM_LOGW(tag, fmt, ...) do { } while (0)
+#define ESP_DRAM_LOGI(tag, fmt, ...) do { } while (0)
+#define ESP_DRAM_LOGD(tag, fmt, ...) do { } while (0)
+
+// nimble types referenced by morse_common.h
+typedef struct
+{
+    uint8_t type;
+    uint8_t val[6];
+} ble_addr_t;
+
+struct ble_gap_conn_desc
+{
+    uint16_t conn_handle;
+};
+
+struct ble_gatt_svc
+{
+    uint16_t start_handle;
+    uint16_t end_handle;
+};
+
+// driver/gpio.h stand-ins for morse_input_gpio
+typedef int esp_err_t;
+#define ESP_OK 0
+typedef void (*gpio_isr_t)(void *);
+
+/**
+ * Does nothing, host code calls the handlers itself, see host_gpio_press().
+ * @return ESP_OK.
+ */
+esp_err_t gpio_isr_handler_add(int gpio_num, gpio_isr_t isr_handler, void *args);
+
+// freertos task handle, only stored on the host
+typedef void *TaskHandle_t;
+
+struct ble_gatt_chr
+{
+    uint16_t def_handle;
+    uint16_t val_handle;
+};
+
+/**
+ * Virtual clock used in place of the esp_timer. Time only moves when the host code sets it.
+ * @return the current virtual time in microseconds.
+ */
+int64_t esp_timer_get_time(void);
+
+/**
+ * Cycle counter stand-in for the interrupt metrics, always 0. On the target it is one instruction, a time stamp
+ * counter read here costs more than the handlers morse_bench times.
+ */
+static inline uint32_t esp_cpu_get_cycle_count(void)
+{
+    return 0;
+}
+
+/**
+ * Sets the virtual clock returned by esp_timer_get_time().
+ * @param time_us the new time in microseconds.
+ */
+void host_timer_set_time(int64_t time_us);
+
+/**
+ * Advances the virtual clock returned by esp_timer_get_time().
+ * @param delta_us microseconds to move forward.
+ */
+void host_timer_advance(int64_t delta_us);
+
+/**
+ * GPIO stand-in. Simulates one full press of the fill buffer button, firing the start (neg-edge)
+ * and end (pos-edge) handlers with the virtual clock moved in between.
+ * @param gap_us time between the previous release and this press in microseconds.
+ * @param hold_us how long the button is held in microseconds.
+ */
+void host_gpio_press(int64_t gap_us, int64_t hold_us);
+
+/**
+ * GPIO stand-in. Simulates a press of the send button.
+ * @param gap_us time between the previous event and this press in microseconds.
+ */
+void host_gpio_send(int64_t gap_us);
+
+/**
+ * Flags that the firmware would hand to the poll event task. Recorded here so host code can
+ * check what the handlers asked for.
+ */
+extern bool host_read_requested;
+extern bool host_send_requested;
+
+/**
+ * Number of times the handlers woke the poll event task.
+ */
+extern uint32_t host_notify_count;
+
+#endif
@@ -1,35 +1,57 @@
 ﻿/*modified 10/30/2024*/
 #include "morse_common.h"
 #include "morse_functions.h"
+#include "morse_input_rmt.h"
 #include "poll_event_task_functions.h"
 #include "callback_functions.h"
+#include "notify_functions.h"
+#include "send_functions.h"
+#include "cache_functions.h"
+#include "morse_proto.h" // for the service uuid
+#include "morse_link.h" // for the connection profiles
+#include "morse_log.h" // for the log task
+
+#if CONFIG_MORSE_SCAN_WINDOW_MS > CONFIG_MORSE_SCAN_ITVL_MS
+#error "MORSE_SCAN_WINDOW_MS can't be longer than MORSE_SCAN_ITVL_MS"
+#endif
 
 // DISCOVERY PARAMETERS FOR GAP SEARCH
+// scanning only runs while a server is missing, so the window can cover the whole interval
 static struct ble_gap_disc_params disc_params = {
     .filter_duplicates = 1,
     .passive = 0,
-    .itvl = 0,
-    .window = 0,
+    .itvl = BLE_GAP_SCAN_ITVL_MS(CONFIG_MORSE_SCAN_ITVL_MS),
+    .window = BLE_GAP_SCAN_WIN_MS(CONFIG_MORSE_SCAN_WINDOW_MS),
     .filter_policy = BLE_HCI_SCAN_FILT_USE_WL,
     //.filter_policy = BLE_HCI_SCAN_FILT_NO_WL, // find all things no whitelist used.
     .limited = 0
 };
 
-/**
- * Find the service, return the handle of the connection (service? attribute?), setup callbacks for services & get ball running
- */
+// esp_timer time the host synced with the controller, for the time to connect log
+static int64_t sync_time;
+
 void gatt_conn_init(struct ble_profile *profile)
 {
-    uint8_t err;
-    ESP_LOGI(DEBUG_TAG, "before disc all srv");
-
     if (!profile)
     {
         ESP_LOGI(ERROR_TAG, "Null pointer on line %d", __LINE__);
         return;
     }
 
-    err = ble_gattc_disc_all_svcs(profile->conn_desc->conn_handle, ble_gatt_disc_svc_cb, profile); // discover all primary services
+    // a server seen before has its cached handles checked instead of discovered
+    if (cache_check(profile) != 0)
+    {
+        gatt_conn_discover(profile);
+    }
+}
+
+void gatt_conn_discover(struct ble_profile *profile)
+{
+    uint8_t err;
+    ESP_LOGI(DEBUG_TAG, "before disc svc by uuid");
+
+    // only the morse service, the generic ones in front of it are never used
+    err = ble_gattc_disc_svc_by_uuid(profile->conn_desc->conn_handle, BLE_UUID128_DECLARE(MORSE_SVC_UUID128), ble_gatt_disc_svc_cb, profile);
     switch (err)
     {
     case 0:
@@ -39,9 +61,102 @@ void gatt_conn_init(struct ble_profile *profile)
         ESP_LOGI(MORSE_TAG, "gattc service discovery failed, err = %u", err);
         break;
     }
-    // save the global version of the profile pointer
-    ble_profile1 = profile;
-    //poll_event_set_profile_ptr(ble_profile1); // outdated since it is now universal.
+}
+
+void gatt_conn_ready(struct ble_profile *profile)
+{
+    int64_t now = esp_timer_get_time();
+
+    if (profile->disconnect_time)
+    {
+        ESP_LOGI(MORSE_TAG, "server %u ready %lld us after connecting, %lld us after the disconnect", profile->index,
+                 now - profile->connect_time, now - profile->disconnect_time);
+    }
+    else
+    {
+        // the first connection since boot, which is also what a disconnect cost when it restarted the client.
+        // boot is when the esp_timer started, early in the startup code.
+        ESP_LOGI(MORSE_TAG, "server %u ready %lld us after boot: sync at %lld, seen +%lld, connected +%lld, discovery done +%lld us",
+                 profile->index, now, sync_time, profile->seen_time - sync_time, profile->connect_time - profile->seen_time,
+                 now - profile->connect_time);
+    }
+    notify_subscribe(profile);
+    // the catch up is use of the link, the idle timer starts over from here
+    poll_event_notify();
+}
+
+static int ble_gap_event(struct ble_gap_event *event, void *arg);
+static int ble_gap_disc_event(struct ble_gap_event *event, void *arg);
+
+/**
+ * @return the profile of the server at addr, NULL if it isn't one of the servers we send to.
+ */
+static struct ble_profile *ble_profile_by_addr(const ble_addr_t *addr)
+{
+    const ble_addr_t *first = ble_server_addr_return();
+    uint8_t index = addr->val[0] - first->val[0];
+
+    if (memcmp(&addr->val[1], &first->val[1], sizeof(addr->val) - 1) != 0 || index >= MORSE_PEER_MAX)
+    {
+        return NULL;
+    }
+    return ble_profiles[index];
+}
+
+/**
+ * Starts gap discovery again if a server isn't connected yet. Only one connection is set up at a time, discovery
+ * stops for it and picks up again here once it is done.
+ */
+static void ble_client_scan_if_missing()
+{
+    uint8_t err;
+
+    if (ble_gap_disc_active() || ble_gap_conn_active())
+    {
+        return;
+    }
+    for (int i = 0; i < MORSE_PEER_MAX; i++)
+    {
+        if (ble_profiles[i] && !ble_profiles[i]->connected)
+        {
+            err = ble_gap_disc(BLE_OWN_ADDR_RANDOM, BLE_HS_FOREVER, &disc_params, ble_gap_disc_event, NULL);
+            if (err != 0)
+            {
+                ESP_LOGI(MORSE_TAG, "BLE GAP Discovery Failed: %u", err);
+            }
+            return;
+        }
+    }
+    ESP_LOGI(MORSE_TAG, "all %d servers connected", MORSE_PEER_MAX);
+}
+
+/**
+ * Puts the profile back to how it is before its server connects: nothing discovered, the stack's default link.
+ * Its index and connection times stay.
+ */
+static void ble_profile_reset(struct ble_profile *profile)
+{
+    // the write response isn't coming, a fan out waiting for it would never finish. send_delivered() checks under
+    // its lock whether anything is pending.
+    send_delivered(profile, false);
+    profile->connected = false;
+    profile->subscribed = false;
+    profile->cccd_handle = 0;
+    profile->mtu = BLE_ATT_MTU_DFLT;
+    profile->tx_octets = LINK_TX_OCTETS_DFLT;
+    profile->link_profile = MORSE_LINK_NONE;
+    profile->phy = BLE_GAP_LE_PHY_1M;
+    memset(profile->characteristic, 0, CHARACTERISTIC_ARR_MAX * sizeof(struct ble_gatt_chr));
+}
+
+/**
+ * Forgets the connection to the profile's server and looks for it again. Nothing on the other servers is touched.
+ */
+static void ble_profile_disconnected(struct ble_profile *profile)
+{
+    ble_profile_reset(profile);
+    profile->disconnect_time = esp_timer_get_time();
+    ble_client_scan_if_missing();
 }
 
 /**
@@ -108,52 +223,157 @@ int ble_gap_connect_event_helper(struct ble_gap_event *event, void *arg, struct
     }
     ESP_LOGI(MORSE_TAG, "BLE Connection Find by Address successful");
 
+    // ask for longer link layer packets. The result arrives as a gap event, nothing waits on it.
+    err = ble_gap_set_data_len(event->connect.conn_handle, LINK_TX_OCTETS_MAX, MORSE_LINK_TX_TIME_MAX);
+    if (err != 0)
+    {
+        ESP_LOGI(MORSE_TAG, "BLE set data length failed, err = %d", err);
+    }
+    // and for CONFIG_MORSE_PHY, every connection starts on 1M. Also reported as a gap event.
+    err = morse_link_phy_set(event->connect.conn_handle);
+    if (err != 0)
+    {
+        ESP_LOGI(MORSE_TAG, "BLE PHY update failed to start, err = %d", err);
+    }
+
     // debugPrintserver_desc();
-    gatt_conn_init(profile_ptr);
+    // negotiate the MTU first, ble_gatt_mtu_cb starts discovery with gatt_conn_init
+    err = ble_gattc_exchange_mtu(event->connect.conn_handle, ble_gatt_mtu_cb, profile_ptr);
+    if (err != 0)
+    {
+        ESP_LOGI(MORSE_TAG, "BLE MTU exchange failed to start, err = %d", err);
+        gatt_conn_init(profile_ptr);
+    }
     return 0;
 }
 
 /**
- * Callback function for gap events.
+ * Callback function for gap discovery events. Connects to whichever of our servers turns up first.
  */
-static int ble_gap_event(struct ble_gap_event *event, void *arg)
+static int ble_gap_disc_event(struct ble_gap_event *event, void *arg)
 {
-    struct ble_profile *profile_ptr = (struct ble_profile *)arg;
-    if (!profile_ptr)
-    {
-        ESP_LOGI(ERROR_TAG, "Null pointer on line %d", __LINE__);
-        return -1;
-    }
-
+    struct ble_profile *profile_ptr;
     uint8_t err;
+
     switch (event->type)
     {
     case BLE_GAP_EVENT_DISC:
         // Handle device discovery
         ESP_LOGI(MORSE_TAG, "Device found: %x%x%x%x%x%x", event->disc.addr.val[0], event->disc.addr.val[1],
                     event->disc.addr.val[2], event->disc.addr.val[3], event->disc.addr.val[4], event->disc.addr.val[5]);
-        // Connect to the device if it matches your criteria
-        // Replace `event->disc.addr` with the address of the device you want to connect to
+        // the whitelist only lets our servers through, skip the ones we have
+        profile_ptr = ble_profile_by_addr(&event->disc.addr);
+        if (!profile_ptr || profile_ptr->connected || ble_gap_conn_active())
+        {
+            break;
+        }
         ble_gap_disc_cancel(); // cancel discovery to allow for connection
+        profile_ptr->seen_time = esp_timer_get_time();
 
-        // err = ble_gap_connect(BLE_OWN_ADDR_RANDOM, server_ptr, 10000, NULL, NULL, NULL);
-        err = ble_gap_connect(BLE_OWN_ADDR_RANDOM, &event->disc.addr, 10000, NULL, ble_gap_event, profile_ptr); // works just fine.
-        // err = ble_gap_connect(BLE_OWN_ADDR_RANDOM, NULL, 10000, NULL, NULL, NULL);
-
+        // discovery and the history catch up come first, start on the interactive profile
+        struct ble_gap_conn_params conn_params;
+        morse_link_conn_params(MORSE_LINK_INTERACTIVE, &conn_params);
+        err = ble_gap_connect(BLE_OWN_ADDR_RANDOM, &event->disc.addr, 10000, &conn_params, ble_gap_event, profile_ptr); // works just fine.
         ble_gap_disc_event_helper(err);
+        if (err != 0)
+        {
+            ble_client_scan_if_missing();
+        }
         break;
     case BLE_GAP_EVENT_DISC_COMPLETE:
         ESP_LOGI(MORSE_TAG, "Discover event complete");
         break;
+    default:
+        ESP_LOGI(MORSE_TAG, "Called Event without handler: %u", event->type);
+        break;
+    }
+    return 0;
+}
+
+/**
+ * Callback function for gap events on the connection to one server, arg is its profile.
+ */
+static int ble_gap_event(struct ble_gap_event *event, void *arg)
+{
+    struct ble_profile *profile_ptr = (struct ble_profile *)arg;
+    if (!profile_ptr)
+    {
+        ESP_LOGI(ERROR_TAG, "Null pointer on line %d", __LINE__);
+        return -1;
+    }
+
+    uint8_t err;
+    switch (event->type)
+    {
     case BLE_GAP_EVENT_CONNECT:
+        if (event->connect.status != 0)
+        {
+            ESP_LOGI(MORSE_TAG, "BLE connection to server %u failed, status = %d", profile_ptr->index, event->connect.status);
+            ble_client_scan_if_missing();
+            break;
+        }
+        profile_ptr->connect_time = esp_timer_get_time();
         err = ble_gap_connect_event_helper(event, arg, profile_ptr);
-        if(err != 0) {
-            return err;
+        if (err == 0)
+        {
+            profile_ptr->connected = true;
+            profile_ptr->link_profile = morse_link_log(MORSE_TAG, event->connect.conn_handle);
+            profile_ptr->phy = morse_link_phy_log(MORSE_TAG, event->connect.conn_handle);
+            ESP_LOGI(MORSE_TAG, "connected to server %u", profile_ptr->index);
         }
+        else
+        {
+            // a link we can't use would hold the server's slot, the disconnect event resets the profile
+            ESP_LOGI(ERROR_TAG, "BLE connection to server %u unusable, terminating", profile_ptr->index);
+            if (ble_gap_terminate(event->connect.conn_handle, BLE_ERR_REM_USER_CONN_TERM) != 0)
+            {
+                ble_profile_disconnected(profile_ptr);
+            }
+            break;
+        }
+        // look for the next server while this one is set up
+        ble_client_scan_if_missing();
+        break;
+    case BLE_GAP_EVENT_CONN_UPDATE:
+        if (event->conn_update.status != 0)
+        {
+            // ask again the next time the profile should change
+            ESP_LOGI(MORSE_TAG, "BLE connection parameter update failed, status %d", event->conn_update.status);
+            profile_ptr->link_profile = MORSE_LINK_NONE;
+            break;
+        }
+        morse_link_log(MORSE_TAG, event->conn_update.conn_handle);
+        break;
+#if CONFIG_BT_NIMBLE_50_FEATURE_SUPPORT
+    case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
+        if (event->phy_updated.status != 0)
+        {
+            ESP_LOGI(MORSE_TAG, "BLE PHY update failed, status %d", event->phy_updated.status);
+            break;
+        }
+        profile_ptr->phy = event->phy_updated.tx_phy;
+        ESP_LOGI(MORSE_TAG, "BLE PHY updated with server %u: tx %s, rx %s", profile_ptr->index,
+                 morse_link_phy_name(event->phy_updated.tx_phy), morse_link_phy_name(event->phy_updated.rx_phy));
+        break;
+#endif
+    case BLE_GAP_EVENT_MTU:
+        // also raised when the server starts the exchange
+        profile_ptr->mtu = event->mtu.value;
+        ESP_LOGI(MORSE_TAG, "BLE MTU updated: %u", event->mtu.value);
+        break;
+#ifdef BLE_GAP_EVENT_DATA_LEN_CHG
+    case BLE_GAP_EVENT_DATA_LEN_CHG:
+        profile_ptr->tx_octets = event->data_len_chg.max_tx_octets;
+        ESP_LOGI(MORSE_TAG, "BLE data length updated: tx %u bytes, rx %u bytes", event->data_len_chg.max_tx_octets, event->data_len_chg.max_rx_octets);
+        break;
+#endif
+    case BLE_GAP_EVENT_NOTIFY_RX:
+        // the server pushed a stored message, our own writes included
+        notify_rx(event, profile_ptr);
         break;
     case BLE_GAP_EVENT_DISCONNECT:
-        ESP_LOGI(MORSE_TAG, "ble_gap_event_disconnect successful, restarting to establish new connection.");
-        esp_restart();
+        ESP_LOGI(MORSE_TAG, "ble_gap_event_disconnect from server %u, reason %d, reconnecting.", profile_ptr->index, event->disconnect.reason);
+        ble_profile_disconnected(profile_ptr);
         break;
     default:
         ESP_LOGI(MORSE_TAG, "Called Event without handler: %u", event->type);
@@ -189,15 +409,26 @@ void gpio_setup()
     io_conf.pull_up_en = 1;
     gpio_config(&io_conf);
 
+    // the input source and the handlers queue their input here for the poll event task
+#if CONFIG_MORSE_INPUT_RMT
+    morse_input_init(&morse_input_rmt);
+#else
+    morse_input_init(&morse_input_gpio);
+#endif
+
     // install gpio isr service
     gpio_install_isr_service(ESP_INTR_FLAG_DEFAULT);
 
-    // takes start time of button1 press
-    gpio_isr_handler_add(GPIO_INPUT_IO_START, gpio_start_event_handler, (void *)GPIO_INPUT_IO_START);
-    // takes end time of button1 pess
-    gpio_isr_handler_add(GPIO_INPUT_IO_END, gpio_end_event_handler, (void *)GPIO_INPUT_IO_END);
-
     gpio_isr_handler_add(GPIO_INPUT_IO_SEND, gpio_send_event_handler, (void *)GPIO_INPUT_IO_SEND);
+
+    // the key, on the start and end pins
+    int rc = morse_input_start();
+    if (rc != 0)
+    {
+        ESP_LOGI(ERROR_TAG, "key input failed to start rc = %d, using gpio interrupts", rc);
+        morse_input_init(&morse_input_gpio);
+        morse_input_start();
+    }
     // gpio_isr_handler_add(GPIO_INPUT_IO_SEND, gpio_read_event_handler, (void *)GPIO_INPUT_IO_SEND);
 }
 
@@ -208,32 +439,55 @@ void ble_task(void *param)
     return;
 }
 
-void ble_app_on_sync(void)
+/**
+ * Creates the profile structures, one per server, once before the host and poll tasks start. A server whose
+ * profile can't be allocated is left NULL and never connected.
+ */
+static void ble_profiles_create()
 {
-    // *********create the profile structure, allocate memory, and pass it the characteristic data*********
-    ble_profile *profile;
-    profile = malloc(sizeof(struct ble_profile));
-
-    profile->conn_desc = malloc(sizeof(struct ble_gap_conn_desc));
-    profile->service = malloc(sizeof(struct ble_gatt_svc));
-    // create a pointer to ble_gatt_chr pointers, to be used as array.
-    profile->characteristic = malloc(sizeof(struct ble_gatt_chr) * CHARACTERISTIC_ARR_MAX);
-    if (!profile->conn_desc)
+    for (int i = 0; i < MORSE_PEER_MAX; i++)
     {
-        ESP_LOGI(ERROR_TAG, "BLE conn_desc is NULL on line %d", __LINE__);
-        free(profile->conn_desc);
-    }
-    if (!profile->service)
-    {
-        ESP_LOGI(ERROR_TAG, "BLE service is NULL on line %d", __LINE__);
-        free(profile->service);
+        ble_profile *profile;
+        profile = calloc(1, sizeof(struct ble_profile)); // zeroed, not connected or subscribed
+        if (!profile)
+        {
+            ESP_LOGI(ERROR_TAG, "BLE profile %d is NULL on line %d", i, __LINE__);
+            continue;
+        }
+
+        profile->conn_desc = malloc(sizeof(struct ble_gap_conn_desc));
+        profile->service = malloc(sizeof(struct ble_gatt_svc));
+        // create a pointer to ble_gatt_chr pointers, to be used as array.
+        profile->characteristic = calloc(CHARACTERISTIC_ARR_MAX, sizeof(struct ble_gatt_chr)); // zeroed, val_handle 0 means not found
+        if (!profile->conn_desc || !profile->service || !profile->characteristic)
+        {
+            ESP_LOGI(ERROR_TAG, "BLE profile %d conn_desc, service or characteristic is NULL on line %d", i, __LINE__);
+            free(profile->conn_desc);
+            free(profile->service);
+            free(profile->characteristic);
+            free(profile);
+            continue;
+        }
+        profile->index = i;
+        ble_profile_reset(profile);
+        ble_profiles[i] = profile;
     }
-    if (!profile->characteristic)
+}
+
+void ble_app_on_sync(void)
+{
+    sync_time = esp_timer_get_time();
+    ESP_LOGI(MORSE_TAG, "host synced %lld us after boot", sync_time);
+
+    // also after a host reset, which dropped every connection. The profiles stay, only their links are forgotten.
+    for (int i = 0; i < MORSE_PEER_MAX; i++)
     {
-        ESP_LOGI(ERROR_TAG, "BLE Characteristic is NULL on line %d", __LINE__);
-        free(profile->characteristic);
+        if (ble_profiles[i])
+        {
+            ble_profile_reset(ble_profiles[i]);
+        }
     }
-    
+
     uint8_t err;
     err = ble_hs_id_set_rnd(ble_client_addr_return()->val);
     if (err != 0)
@@ -241,20 +495,27 @@ void ble_app_on_sync(void)
         ESP_LOGI(MORSE_TAG, "BLE gap set random address failed %d", err);
     }
 
-    uint8_t white_list_count = 1;
-    err = ble_gap_wl_set(ble_server_addr_return(), white_list_count); // sets white list for connection to other device
+    err = morse_link_phy_init();
     if (err != 0)
     {
-        ESP_LOGI(MORSE_TAG, "BLE gap set whitelist failed");
+        ESP_LOGI(MORSE_TAG, "BLE set preferred PHY failed %d", err);
     }
 
-
-    // begin gap discovery
-    err = ble_gap_disc(BLE_OWN_ADDR_RANDOM, BLE_HS_FOREVER, &disc_params, ble_gap_event, profile);
+    // every server we send to, numbered in the first byte of the address
+    ble_addr_t white_list[MORSE_PEER_MAX];
+    for (int i = 0; i < MORSE_PEER_MAX; i++)
+    {
+        white_list[i] = *ble_server_addr_return();
+        white_list[i].val[0] += i;
+    }
+    err = ble_gap_wl_set(white_list, MORSE_PEER_MAX); // sets white list for connection to other devices
     if (err != 0)
     {
-        ESP_LOGI(MORSE_TAG, "BLE GAP Discovery Failed: %u", err);
+        ESP_LOGI(MORSE_TAG, "BLE gap set whitelist failed");
     }
+
+    // begin gap discovery, it stops for each connection and picks up again until every server is connected
+    ble_client_scan_if_missing();
 }
 
 void ble_client_setup()
@@ -275,9 +536,19 @@ void ble_client_setup()
     ble_svc_gap_init(); // initialize gap
     ble_gattc_init();   // initialize gatt
 
+    // offer the largest MTU in the exchange on connect
+    err = ble_att_set_preferred_mtu(BLE_ATT_MTU_MAX);
+    if (err != 0)
+    {
+        ESP_LOGI(MORSE_TAG, "BLE set preferred MTU failed, err = %d", err);
+    }
+
     ble_hs_cfg.sync_cb = ble_app_on_sync;
 
-    xTaskCreate(poll_event_task, "Poll Event Task", 2048, NULL, 5, NULL);
+    // before the tasks that use them
+    ble_profiles_create();
+
+    xTaskCreate(poll_event_task, "Poll Event Task", CONFIG_MORSE_POLL_TASK_STACK, NULL, 5, &poll_event_task_handle);
 
     // starts first task
     nimble_port_freertos_init(ble_task);
@@ -285,6 +556,11 @@ void ble_client_setup()
 
 void app_main(void)
 {
+    // before the interrupts and tasks that log
+    if (morse_log_start() != 0)
+    {
+        ESP_LOGI(ERROR_TAG, "log task failed to start");
+    }
     gpio_setup();
     ble_client_setup();
 }
@@ -0,0 +1,308 @@
+#include "cache_functions.h"
+#include "morse_proto.h" // for the uuids
+
+// one NVS blob per server, under "server<index>"
+struct cache_entry
+{
+    uint8_t version;
+    uint8_t addr[6]; // the server it came from, an entry for another address is a miss
+    uint16_t service_start;
+    uint16_t service_end;
+    uint16_t def_handle[CHARACTERISTIC_ARR_MAX];
+    uint16_t val_handle[CHARACTERISTIC_ARR_MAX];
+    uint8_t properties[CHARACTERISTIC_ARR_MAX];
+    uint16_t cccd_handle; // 0 if the server has none
+    bool has_hash; // the server had a Database Hash characteristic, db_hash is its value
+    uint8_t db_hash[CACHE_DB_HASH_LENGTH];
+};
+
+static const ble_uuid128_t cache_chr_uuid[CHARACTERISTIC_ARR_MAX] = {
+    BLE_UUID128_INIT(MORSE_CHR_UUID128),
+    BLE_UUID128_INIT(MORSE_HISTORY_UUID128),
+    BLE_UUID128_INIT(MORSE_STATS_UUID128),
+};
+
+// loaded by cache_check(), put in the profile once the server confirmed it
+static struct cache_entry cache_entries[MORSE_PEER_MAX];
+static bool cache_loaded[MORSE_PEER_MAX];
+static bool cache_match[MORSE_PEER_MAX];
+static uint8_t cache_found[MORSE_PEER_MAX]; // bit i for each cached characteristic the server still has
+// the server's Database Hash, read by cache_check() for cache_store()
+static bool cache_has_hash[MORSE_PEER_MAX];
+static uint8_t cache_hash[MORSE_PEER_MAX][CACHE_DB_HASH_LENGTH];
+
+static void cache_key(const struct ble_profile *profile, char *key, size_t size)
+{
+    snprintf(key, size, "server%u", profile->index);
+}
+
+/**
+ * @return 0 if entry holds what was cached for the profile's server, BLE_HS_ENOENT otherwise.
+ */
+static int cache_load(const struct ble_profile *profile, struct cache_entry *entry)
+{
+    nvs_handle_t handle;
+    size_t size = sizeof(*entry);
+    char key[16];
+    esp_err_t err;
+
+    cache_key(profile, key, sizeof(key));
+    err = nvs_open(CACHE_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK)
+    {
+        return BLE_HS_ENOENT; // nothing was ever stored
+    }
+    err = nvs_get_blob(handle, key, entry, &size);
+    nvs_close(handle);
+
+    if (err != ESP_OK || size != sizeof(*entry) || entry->version != CACHE_VERSION ||
+        memcmp(entry->addr, profile->conn_desc->peer_id_addr.val, sizeof(entry->addr)) != 0)
+    {
+        return BLE_HS_ENOENT;
+    }
+    return 0;
+}
+
+/**
+ * Fills in the profile as discovery would have.
+ */
+static void cache_apply(struct ble_profile *profile, const struct cache_entry *entry)
+{
+    static const ble_uuid128_t svc_uuid = BLE_UUID128_INIT(MORSE_SVC_UUID128);
+    struct ble_gatt_svc *service = (struct ble_gatt_svc *)profile->service;
+
+    service->start_handle = entry->service_start;
+    service->end_handle = entry->service_end;
+    service->uuid.u128 = svc_uuid;
+    for (int i = 0; i < CHARACTERISTIC_ARR_MAX; i++)
+    {
+        profile->characteristic[i].def_handle = entry->def_handle[i];
+        profile->characteristic[i].val_handle = entry->val_handle[i];
+        profile->characteristic[i].properties = entry->properties[i];
+        profile->characteristic[i].uuid.u128 = cache_chr_uuid[i];
+    }
+    profile->cccd_handle = entry->cccd_handle;
+}
+
+/**
+ * Ends the check, with the cached handles or with discovery.
+ */
+static void cache_result(struct ble_profile *profile, bool valid, int status)
+{
+    if (valid)
+    {
+        ESP_LOGI(MORSE_TAG, "cache: server %u handles still valid, skipping discovery", profile->index);
+        cache_apply(profile, &cache_entries[profile->index]);
+        gatt_conn_ready(profile);
+        return;
+    }
+    ESP_LOGI(MORSE_TAG, "cache: server %u handles moved (status %d), discovering again", profile->index, status);
+    cache_drop(profile);
+    gatt_conn_discover(profile);
+}
+
+static int cache_chr_cb(uint16_t conn_handle, const struct ble_gatt_error *error, const struct ble_gatt_chr *chr, void *arg)
+{
+    struct ble_profile *profile = (struct ble_profile *)arg;
+    const struct cache_entry *entry = &cache_entries[profile->index];
+    uint8_t cached = 0;
+
+    switch (error->status)
+    {
+    case 0:
+        for (int i = 0; i < CHARACTERISTIC_ARR_MAX; i++)
+        {
+            if (ble_uuid_cmp(&chr->uuid.u, &cache_chr_uuid[i].u) != 0)
+            {
+                continue;
+            }
+            if (chr->def_handle == entry->def_handle[i] && chr->val_handle == entry->val_handle[i] &&
+                chr->properties == entry->properties[i])
+            {
+                cache_found[profile->index] |= 1 << i;
+            }
+            else
+            {
+                cache_match[profile->index] = false; // moved, or new since the entry was stored
+            }
+        }
+        return 0;
+    case BLE_HS_ENOTCONN:
+        return 0; // the link dropped, that says nothing about the handles
+    case BLE_HS_EDONE:
+        for (int i = 0; i < CHARACTERISTIC_ARR_MAX; i++)
+        {
+            cached |= (entry->val_handle[i] != 0) << i;
+        }
+        cache_result(profile, cache_match[profile->index] && cache_found[profile->index] == cached, error->status);
+        return 0;
+    default:
+        cache_result(profile, false, error->status);
+        return 0;
+    }
+}
+
+static int cache_svc_cb(uint16_t conn_handle, const struct ble_gatt_error *error, const struct ble_gatt_svc *service, void *arg)
+{
+    struct ble_profile *profile = (struct ble_profile *)arg;
+    const struct cache_entry *entry = &cache_entries[profile->index];
+    int rc;
+
+    switch (error->status)
+    {
+    case 0:
+        cache_match[profile->index] = (service->start_handle == entry->service_start && service->end_handle == entry->service_end);
+        return 0;
+    case BLE_HS_ENOTCONN:
+        return 0;
+    case BLE_HS_EDONE:
+        if (!cache_match[profile->index])
+        {
+            break;
+        }
+        // the same range, now the declarations in it
+        cache_found[profile->index] = 0;
+        rc = ble_gattc_disc_all_chrs(conn_handle, entry->service_start, entry->service_end, cache_chr_cb, profile);
+        if (rc != 0)
+        {
+            ESP_LOGI(ERROR_TAG, "cache: characteristic check failed to start, rc = %d", rc);
+            gatt_conn_discover(profile);
+        }
+        return 0;
+    default:
+        break;
+    }
+    cache_result(profile, false, error->status);
+    return 0;
+}
+
+/**
+ * Checks the service range and then each characteristic, for a server without a Database Hash.
+ */
+static int cache_check_handles(struct ble_profile *profile)
+{
+    int rc;
+
+    cache_match[profile->index] = false;
+    rc = ble_gattc_disc_svc_by_uuid(profile->conn_desc->conn_handle, BLE_UUID128_DECLARE(MORSE_SVC_UUID128), cache_svc_cb, profile);
+    if (rc != 0)
+    {
+        ESP_LOGI(ERROR_TAG, "cache: service check failed to start, rc = %d", rc);
+    }
+    return rc;
+}
+
+static int cache_hash_cb(uint16_t conn_handle, const struct ble_gatt_error *error, struct ble_gatt_attr *attr, void *arg)
+{
+    struct ble_profile *profile = (struct ble_profile *)arg;
+    const struct cache_entry *entry = &cache_entries[profile->index];
+
+    if (error->status == 0)
+    {
+        if (OS_MBUF_PKTLEN(attr->om) == CACHE_DB_HASH_LENGTH)
+        {
+            os_mbuf_copydata(attr->om, 0, CACHE_DB_HASH_LENGTH, cache_hash[profile->index]);
+            cache_has_hash[profile->index] = true;
+        }
+        return 0;
+    }
+    if (error->status == BLE_HS_ENOTCONN)
+    {
+        return 0;
+    }
+
+    // done, or the error that says the server has no hash
+    if (!cache_loaded[profile->index])
+    {
+        gatt_conn_discover(profile);
+        return 0;
+    }
+    cache_result(profile, cache_has_hash[profile->index] && entry->has_hash &&
+                          memcmp(cache_hash[profile->index], entry->db_hash, CACHE_DB_HASH_LENGTH) == 0, error->status);
+    return 0;
+}
+
+int cache_check(struct ble_profile *profile)
+{
+    struct cache_entry *entry = &cache_entries[profile->index];
+    int rc;
+
+    cache_loaded[profile->index] = (cache_load(profile, entry) == 0);
+    cache_has_hash[profile->index] = false;
+    if (!cache_loaded[profile->index])
+    {
+        ESP_LOGI(MORSE_TAG, "cache: nothing cached for server %u", profile->index);
+    }
+    else if (!entry->has_hash)
+    {
+        return cache_check_handles(profile);
+    }
+
+    // the hash covers every attribute on the server, one read answers for all of them
+    rc = ble_gattc_read_by_uuid(profile->conn_desc->conn_handle, 1, 0xFFFF, BLE_UUID16_DECLARE(CACHE_DB_HASH_UUID16),
+                                cache_hash_cb, profile);
+    if (rc != 0)
+    {
+        ESP_LOGI(ERROR_TAG, "cache: hash read failed to start, rc = %d", rc);
+    }
+    return rc;
+}
+
+void cache_store(const struct ble_profile *profile)
+{
+    struct cache_entry entry = {0};
+    nvs_handle_t handle;
+    char key[16];
+    esp_err_t err;
+
+    entry.version = CACHE_VERSION;
+    memcpy(entry.addr, profile->conn_desc->peer_id_addr.val, sizeof(entry.addr));
+    entry.service_start = profile->service->start_handle;
+    entry.service_end = profile->service->end_handle;
+    for (int i = 0; i < CHARACTERISTIC_ARR_MAX; i++)
+    {
+        entry.def_handle[i] = profile->characteristic[i].def_handle;
+        entry.val_handle[i] = profile->characteristic[i].val_handle;
+        entry.properties[i] = profile->characteristic[i].properties;
+    }
+    entry.cccd_handle = profile->cccd_handle;
+    entry.has_hash = cache_has_hash[profile->index];
+    memcpy(entry.db_hash, cache_hash[profile->index], sizeof(entry.db_hash));
+
+    cache_key(profile, key, sizeof(key));
+    err = nvs_open(CACHE_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGI(ERROR_TAG, "cache: nvs_open failed, err = %d", err);
+        return;
+    }
+    err = nvs_set_blob(handle, key, &entry, sizeof(entry));
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGI(ERROR_TAG, "cache: storing server %u failed, err = %d", profile->index, err);
+        return;
+    }
+    ESP_LOGI(MORSE_TAG, "cache: stored the handles of server %u", profile->index);
+}
+
+void cache_drop(const struct ble_profile *profile)
+{
+    nvs_handle_t handle;
+    char key[16];
+
+    cache_key(profile, key, sizeof(key));
+    if (nvs_open(CACHE_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+    {
+        return;
+    }
+    if (nvs_erase_key(handle, key) == ESP_OK)
+    {
+        nvs_commit(handle);
+    }
+    nvs_close(handle);
+}
@@ -0,0 +1,40 @@
+#ifndef CACHE_FUNCTIONS_H
+#define CACHE_FUNCTIONS_H
+
+#include "morse_common.h"
+
+/*
+The handles discovery found on each server, kept in NVS so a reconnect can skip discovery.
+
+Before the cached handles are used every one of them is checked. A server with a Database Hash characteristic
+(GATT caching) has a hash over its whole attribute table, a single read of it compared with the cached hash
+answers for all the handles. Without one, the morse service is discovered by its UUID and its range compared with
+the cached one, then the characteristics in that range with their cached declaration and value handles. The CCCD
+lies between the morse value and the next declaration, so it can't move while those stay. Anything else drops
+the entry and the client discovers again.
+*/
+#define CACHE_NAMESPACE "morse_cache"
+#define CACHE_VERSION 3 // bump when struct cache_entry changes, older entries then miss
+#define CACHE_DB_HASH_UUID16 0x2B2A // Database Hash, in the GATT service
+#define CACHE_DB_HASH_LENGTH 16
+
+/**
+ * Checks the cached handles of the profile's server and, if they are still right, puts them in the profile.
+ * Call once the connection is up, conn_desc has the server's address.
+ * With nothing cached it only reads the server's hash for cache_store(), and goes on to discovery.
+ * @return 0 if the check was started, the result then comes through gatt_conn_ready() or gatt_conn_discover().
+ * A BLE_HS_E* error if the check didn't start.
+ */
+int cache_check(struct ble_profile *profile);
+
+/**
+ * Saves the profile's service, characteristics and CCCD handle for the next connection to its server.
+ */
+void cache_store(const struct ble_profile *profile);
+
+/**
+ * Forgets what is cached for the profile's server.
+ */
+void cache_drop(const struct ble_profile *profile);
+
+#endif
@@ -1,4 +1,8 @@
 #include "callback_functions.h"
+#include "send_functions.h" // for send_delivered
+#include "morse_proto.h" // for MORSE_MESSAGE_MAX_LENGTH and the uuids
+#include "morse_wire.h" // for unpacking framed messages
+#include "morse_metrics.h" // for counting write errors
 
 int ble_gatt_disc_svc_cb(uint16_t conn_handle, const struct ble_gatt_error *error, const struct ble_gatt_svc *service, void *arg)
 {
@@ -52,7 +56,8 @@ int ble_gatt_disc_svc_cb(uint16_t conn_handle, const struct ble_gatt_error *erro
         service->uuid.u128.value[14], service->uuid.u128.value[15]
     );
 
-    profile_ptr->service = service;
+    // service only lives for this call, keep a copy in the profile's own memory
+    memcpy((struct ble_gatt_svc *)profile_ptr->service, service, sizeof(*service));
 
     //  ESP_LOGI(DEBUG_TAG, "", rc);
 
@@ -69,6 +74,32 @@ int ble_gatt_disc_svc_cb(uint16_t conn_handle, const struct ble_gatt_error *erro
     return 0;
 }
 
+int ble_gatt_mtu_cb(uint16_t conn_handle, const struct ble_gatt_error *error, uint16_t mtu, void *arg)
+{
+    struct ble_profile *profile_ptr = (struct ble_profile *)arg;
+
+    if (!profile_ptr)
+    {
+        ESP_LOGI(ERROR_TAG, "Null pointer on line %d", __LINE__);
+        return -1;
+    }
+
+    if (error->status == 0)
+    {
+        profile_ptr->mtu = mtu;
+        ESP_LOGI(MORSE_TAG, "ble_gatt_mtu_cb: mtu = %u, %u bytes per write", mtu, mtu - 3);
+    }
+    else
+    {
+        // the default MTU stays in place, everything still works with smaller writes
+        ESP_LOGI(ERROR_TAG, "ble_gatt_mtu_cb: mtu exchange failed, status %u", error->status);
+    }
+
+    // discovery waits for the exchange so the two ATT requests don't overlap
+    gatt_conn_init(profile_ptr);
+    return 0;
+}
+
 int ble_gatt_chr_cb(uint16_t conn_handle, const struct ble_gatt_error *error, const struct ble_gatt_chr *chr, void *arg)
 {
 
@@ -87,6 +118,8 @@ int ble_gatt_chr_cb(uint16_t conn_handle, const struct ble_gatt_error *error, co
         }
         case BLE_HS_EDONE: {
             ESP_LOGI(DEBUG_TAG, "ble_gatt_chr_cb: all done, status %u", error->status);
+            // connection is ready, subscribe to pushed messages then pick up anything stored since we last saw it
+            gatt_conn_ready(profile_ptr);
             return 0;
         }
         default: {
@@ -103,18 +136,22 @@ int ble_gatt_chr_cb(uint16_t conn_handle, const struct ble_gatt_error *error, co
         chr->uuid.u128.value[12], chr->uuid.u128.value[13], chr->uuid.u128.value[14], chr->uuid.u128.value[15]
     );
 
-    static uint8_t characteristic_count = 0; // characteristic_count as static, persists between function calls.
-    profile_ptr->characteristic[characteristic_count] = *chr; // save the latest characteristic data to this local profile_ptr
-
-    // increment the count until we are at max.
-    if (characteristic_count < CHARACTERISTIC_ARR_MAX)
+    // save the characteristic data to its slot in this local profile_ptr, by uuid since the discovery order isn't ours to pick
+    if (ble_uuid_cmp(&chr->uuid.u, BLE_UUID128_DECLARE(MORSE_CHR_UUID128)) == 0)
+    {
+        profile_ptr->characteristic[CHR_MORSE] = *chr;
+    }
+    else if (ble_uuid_cmp(&chr->uuid.u, BLE_UUID128_DECLARE(MORSE_HISTORY_UUID128)) == 0)
     {
-        characteristic_count++;
+        profile_ptr->characteristic[CHR_HISTORY] = *chr;
+    }
+    else if (ble_uuid_cmp(&chr->uuid.u, BLE_UUID128_DECLARE(MORSE_STATS_UUID128)) == 0)
+    {
+        profile_ptr->characteristic[CHR_STATS] = *chr;
     }
     else
     {
-        ESP_LOGI(ERROR_TAG, "ble_gatt_chr_cb: characteristic count exceeded maximum for handle %u", conn_handle);
-        return 0x69; // our own error code for if the characteristic count has exceeded
+        ESP_LOGI(DEBUG_TAG, "ble_gatt_chr_cb: unknown characteristic at handle %u, ignored", chr->val_handle);
     }
 
     return 0;
@@ -122,20 +159,61 @@ int ble_gatt_chr_cb(uint16_t conn_handle, const struct ble_gatt_error *error, co
 
 int ble_gatt_write_chr_cb(uint16_t conn_handle, const struct ble_gatt_error *error, struct ble_gatt_attr *attr, void *arg) {
     // WRITE EVENTS
+    // arg is from send_functions, the profile and the fan out the write belongs to
     if(error->status != 0) {
         ESP_LOGI(DEBUG_TAG, "ble_gatt_write_chr_cb error = [handle, status] = [%d, %d]", error->att_handle, error->status);
-        return -1;
+        morse_metrics_count_shared(MORSE_COUNTER_WRITE_ERRORS);
+        morse_metrics_error_code(error->status);
     }
-    return 0;
+    send_answered(arg, error->status == 0);
+    return error->status == 0 ? 0 : -1;
 }
 
 int ble_gatt_read_chr_cb(uint16_t conn_handle, const struct ble_gatt_error *error, struct ble_gatt_attr *attr, void *arg) {
     // READ EVENTS
+    // a long read calls back once per piece at increasing offsets, then once more with BLE_HS_EDONE
+    // reads from several servers can be in flight at once, each gets its own buffer
+    static char read_buf[MORSE_PEER_MAX][MORSE_MESSAGE_MAX_LENGTH];
+    static uint16_t read_len[MORSE_PEER_MAX];
+    struct ble_profile *profile = (struct ble_profile *)arg;
+    char *buf = read_buf[profile->index];
+
+    if(error->status == BLE_HS_EDONE) {
+        // grab the data and print it.
+        print_message(profile, "read", (uint8_t *)buf, read_len[profile->index]);
+        read_len[profile->index] = 0;
+        return 0;
+    }
     if(error->status != 0) {
         ESP_LOGI(DEBUG_TAG, "ble_gatt_read_chr_cb error = [handle, status] = [%d, %d]", error->att_handle, error->status);
+        read_len[profile->index] = 0;
         return -1;
     }
-    // grab the data and print it.
-    ESP_LOGI(MORSE_TAG, "Data read from the server: %.*s\n", attr->om->om_len, attr->om->om_data);
+
+    // copy the whole chain, the piece can span several mbufs
+    uint16_t len = OS_MBUF_PKTLEN(attr->om);
+    if(attr->offset + len > MORSE_MESSAGE_MAX_LENGTH) {
+        len = (attr->offset < MORSE_MESSAGE_MAX_LENGTH) ? MORSE_MESSAGE_MAX_LENGTH - attr->offset : 0;
+    }
+    os_mbuf_copydata(attr->om, 0, len, &buf[attr->offset]);
+    read_len[profile->index] = attr->offset + len;
     return 0;
 }
+
+void print_message(const struct ble_profile *profile, const char *source, const uint8_t *data, uint16_t length) {
+    // the longest message a frame of the longest length unpacks to
+    static char text[MORSE_WIRE_TEXT_MAX_LENGTH(MORSE_MESSAGE_MAX_LENGTH)];
+    uint8_t seq;
+    int text_len;
+
+    if(length == 0 || !MORSE_IS_WIRE(data[0])) {
+        ESP_LOGI(MORSE_TAG, "Data %s from server %u (%u bytes): %.*s", source, profile->index, length, length, (const char *)data);
+        return;
+    }
+    text_len = morse_wire_decode(data, length, text, sizeof(text), &seq);
+    if(text_len < 0) {
+        ESP_LOGI(ERROR_TAG, "Data %s from server %u: malformed frame of %u bytes", source, profile->index, length);
+        return;
+    }
+    ESP_LOGI(MORSE_TAG, "Data %s from server %u (%u bytes, message %u): %.*s", source, profile->index, length, seq, text_len, text);
+}
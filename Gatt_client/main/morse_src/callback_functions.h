@@ -9,19 +9,35 @@
  */
 int ble_gatt_disc_svc_cb(uint16_t conn_handle, const struct ble_gatt_error *error, const struct ble_gatt_svc *service, void *arg);
 
+/**
+ * Callback function for the ATT MTU exchange. Starts service discovery once the MTU is settled.
+ */
+int ble_gatt_mtu_cb(uint16_t conn_handle, const struct ble_gatt_error *error, uint16_t mtu, void *arg);
+
 /**
  * Callback function for gatt characteristic discovery.
  */
 int ble_gatt_chr_cb(uint16_t conn_handle, const struct ble_gatt_error *error, const struct ble_gatt_chr *chr, void *arg);
 
 /**
- * Callback function for gatt write events.
+ * Callback function for gatt write events. arg is what send_functions started the write with, see send_answered().
  */
 int ble_gatt_write_chr_cb(uint16_t conn_handle, const struct ble_gatt_error *error, struct ble_gatt_attr *attr, void *arg);
 
 /**
- * Callback function for gatt read events.
+ * Callback function for gatt read events. Collects the pieces of a long read and prints the message once it is complete.
+ * arg is the profile read from.
  */
 int ble_gatt_read_chr_cb(uint16_t conn_handle, const struct ble_gatt_error *error, struct ble_gatt_attr *attr, void *arg);
 
+/**
+ * Logs a message from a server, unpacking it first if it is a morse_wire frame. Older servers and the server's
+ * greeting store plain ascii, which is logged as it is.
+ * @param profile the server it came from.
+ * @param source how it came, for the log.
+ * @param data the message as stored on the server.
+ * @param length length of data in bytes.
+ */
+void print_message(const struct ble_profile *profile, const char *source, const uint8_t *data, uint16_t length);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,330 @@
+#include "history_functions.h"
+#include "morse_proto.h"
+#include "esp_attr.h" // for RTC_NOINIT_ATTR
+#include "callback_functions.h" // for print_message
+
+#define HISTORY_MAGIC 0x4D4F5232 // "MOR2", marks history_cursors as set rather than power-on garbage
+
+// where the client is in one server's history
+struct history_cursor
+{
+    uint8_t addr[6];   // the server, all 0 for an unused cursor
+    uint32_t epoch;    // the server's boot the sequence number is from, 0 before its first history read
+    uint32_t last_seq; // the newest message seen
+};
+
+// kept across esp_restart() as well as reconnects. Each server numbers its messages itself, from 1 on every boot.
+static RTC_NOINIT_ATTR struct history_cursor history_cursors[MORSE_PEER_MAX];
+static RTC_NOINIT_ATTR uint32_t history_magic;
+static uint8_t history_cursor_next; // taken over when a new server finds every cursor in use
+
+// catch ups with several servers run at the same time
+static uint8_t history_buf[MORSE_PEER_MAX][BLE_ATT_ATTR_MAX_LEN];
+static uint16_t history_len[MORSE_PEER_MAX];
+// a message too long for one read, put together from the pieces the reads return. 0 length when there is none.
+static uint8_t history_part[MORSE_PEER_MAX][MORSE_MESSAGE_MAX_LENGTH];
+static uint16_t history_part_len[MORSE_PEER_MAX];
+static uint32_t history_part_seq[MORSE_PEER_MAX];
+static bool history_part_pushed[MORSE_PEER_MAX]; // started by a notification, see history_rest()
+// a catch up is running, and it has to go another round before it stops
+static bool history_busy[MORSE_PEER_MAX];
+static bool history_again[MORSE_PEER_MAX];
+
+/**
+ * Starts from 0 when RTC memory holds no sequence numbers, after power on.
+ */
+static void history_init()
+{
+    if (history_magic != HISTORY_MAGIC)
+    {
+        history_magic = HISTORY_MAGIC;
+        memset(history_cursors, 0, sizeof(history_cursors));
+    }
+}
+
+/**
+ * @return the cursor of the profile's server, by its address rather than the profile index, which can go to
+ * another server after a restart. A server not seen before gets an unused cursor, or the next one in turn.
+ */
+static struct history_cursor *history_cursor_find(const struct ble_profile *profile)
+{
+    static const uint8_t unused[6] = {0};
+    const uint8_t *addr = profile->conn_desc->peer_id_addr.val;
+    struct history_cursor *cursor = NULL;
+
+    history_init();
+    for (int i = 0; i < MORSE_PEER_MAX; i++)
+    {
+        if (memcmp(history_cursors[i].addr, addr, sizeof(history_cursors[i].addr)) == 0)
+        {
+            return &history_cursors[i];
+        }
+        if (!cursor && memcmp(history_cursors[i].addr, unused, sizeof(unused)) == 0)
+        {
+            cursor = &history_cursors[i];
+        }
+    }
+    if (!cursor)
+    {
+        cursor = &history_cursors[history_cursor_next];
+        history_cursor_next = (history_cursor_next + 1) % MORSE_PEER_MAX;
+    }
+    memcpy(cursor->addr, addr, sizeof(cursor->addr));
+    history_part_len[profile->index] = 0; // from the server the profile was connected to before
+    cursor->epoch = 0;
+    cursor->last_seq = 0;
+    return cursor;
+}
+
+/**
+ * Checks the epoch at the start of the profile's history_buf against the one its cursor's sequence number is from.
+ * A server that restarted numbers from 1 again, so the cursor goes back to 0.
+ * @return true if the cursor was reset and the history has to be asked for again.
+ */
+static bool history_epoch_changed(const struct ble_profile *profile, struct history_cursor *cursor)
+{
+    uint32_t epoch;
+
+    if (history_len[profile->index] < MORSE_HISTORY_EPOCH_LENGTH)
+    {
+        return false;
+    }
+    epoch = MORSE_GET_LE32(history_buf[profile->index]);
+    if (epoch == cursor->epoch)
+    {
+        return false;
+    }
+    cursor->epoch = epoch;
+    history_part_len[profile->index] = 0;
+    if (cursor->last_seq == 0)
+    {
+        return false; // nothing seen yet, what was read is from 0 anyway
+    }
+    ESP_LOGI(MORSE_TAG, "history: server %u restarted, reading its history from the start", profile->index);
+    cursor->last_seq = 0;
+    return true;
+}
+
+/**
+ * Adds a piece of a message too long for one read to the profile's history_part.
+ * @return false if the message doesn't fit, the part is dropped then.
+ */
+static bool history_part_add(const struct ble_profile *profile, uint32_t seq, const uint8_t *piece, uint16_t length)
+{
+    uint8_t index = profile->index;
+
+    if (history_part_len[index] + length > sizeof(history_part[0]))
+    {
+        ESP_LOGI(ERROR_TAG, "history: message %lu is longer than %d bytes, skipped", (unsigned long)seq, MORSE_MESSAGE_MAX_LENGTH);
+        history_part_len[index] = 0;
+        return false;
+    }
+    if (history_part_len[index] == 0)
+    {
+        history_part_pushed[index] = false;
+    }
+    memcpy(&history_part[index][history_part_len[index]], piece, length);
+    history_part_len[index] += length;
+    history_part_seq[index] = seq;
+    return true;
+}
+
+/**
+ * Prints the messages in the profile's history_buf and moves its cursor past them. A piece of a longer message goes
+ * to history_part, and the message is printed with its last piece. Messages the cursor is already past were pushed
+ * while the catch up ran, and are skipped.
+ * @return the number of messages and pieces found.
+ */
+static int history_parse(const struct ble_profile *profile, struct history_cursor *cursor)
+{
+    const uint8_t *buf = history_buf[profile->index];
+    uint8_t index = profile->index;
+    uint16_t offset = MORSE_HISTORY_EPOCH_LENGTH;
+    int count = 0;
+
+    while (offset + MORSE_HISTORY_HEADER_LENGTH <= history_len[index])
+    {
+        uint32_t seq = MORSE_GET_LE32(&buf[offset]);
+        uint16_t length = MORSE_GET_LE16(&buf[offset + 4]) & MORSE_HISTORY_LENGTH_MASK;
+        bool more = MORSE_GET_LE16(&buf[offset + 4]) & MORSE_HISTORY_MORE;
+        offset += MORSE_HISTORY_HEADER_LENGTH;
+
+        if (offset + length > history_len[index])
+        {
+            ESP_LOGI(ERROR_TAG, "history: message %lu truncated", (unsigned long)seq);
+            break;
+        }
+        count++;
+        // the server evicted the message before its last piece was read, the read starts with the next one
+        if (history_part_len[index] != 0 && history_part_seq[index] != seq)
+        {
+            ESP_LOGI(ERROR_TAG, "history: message %lu was dropped by the server part way through", (unsigned long)history_part_seq[index]);
+            history_part_len[index] = 0;
+        }
+        if (more || history_part_len[index] != 0)
+        {
+            if (!history_part_add(profile, seq, &buf[offset], length))
+            {
+                cursor->last_seq = (seq > cursor->last_seq) ? seq : cursor->last_seq;
+                break;
+            }
+            if (more)
+            {
+                break; // the rest comes with the next read
+            }
+            ESP_LOGI(MORSE_TAG, "history [%lu]", (unsigned long)seq);
+            print_message(profile, history_part_pushed[index] ? "pushed" : "stored", history_part[index], history_part_len[index]);
+            history_part_len[index] = 0;
+        }
+        else if (seq > cursor->last_seq)
+        {
+            ESP_LOGI(MORSE_TAG, "history [%lu]", (unsigned long)seq);
+            print_message(profile, "stored", &buf[offset], length);
+        }
+        cursor->last_seq = (seq > cursor->last_seq) ? seq : cursor->last_seq;
+        offset += length;
+    }
+    return count;
+}
+
+/**
+ * The profile's catch up stopped, it starts over if a truncated push came in while it ran.
+ */
+static void history_done(struct ble_profile *profile)
+{
+    history_busy[profile->index] = false;
+    if (history_again[profile->index])
+    {
+        history_again[profile->index] = false;
+        history_catch_up(profile);
+    }
+}
+
+static int history_read_cb(uint16_t conn_handle, const struct ble_gatt_error *error, struct ble_gatt_attr *attr, void *arg)
+{
+    struct ble_profile *profile = (struct ble_profile *)arg;
+
+    if (error->status == BLE_HS_EDONE)
+    {
+        struct history_cursor *cursor = history_cursor_find(profile);
+
+        // the server returns whole messages up to an attribute's worth, ask again until nothing new comes back
+        if (history_epoch_changed(profile, cursor) || history_parse(profile, cursor) > 0)
+        {
+            if (history_catch_up(profile) != 0)
+            {
+                history_done(profile);
+            }
+        }
+        else
+        {
+            ESP_LOGI(MORSE_TAG, "history: server %u caught up at %lu", profile->index, (unsigned long)cursor->last_seq);
+            history_done(profile);
+        }
+        return 0;
+    }
+    if (error->status != 0)
+    {
+        ESP_LOGI(ERROR_TAG, "history read error = [handle, status] = [%d, %d]", error->att_handle, error->status);
+        history_done(profile);
+        return -1;
+    }
+
+    uint16_t len = OS_MBUF_PKTLEN(attr->om);
+    if (attr->offset + len > sizeof(history_buf[0]))
+    {
+        len = (attr->offset < sizeof(history_buf[0])) ? sizeof(history_buf[0]) - attr->offset : 0;
+    }
+    os_mbuf_copydata(attr->om, 0, len, &history_buf[profile->index][attr->offset]);
+    history_len[profile->index] = attr->offset + len;
+    return 0;
+}
+
+static int history_write_cb(uint16_t conn_handle, const struct ble_gatt_error *error, struct ble_gatt_attr *attr, void *arg)
+{
+    struct ble_profile *profile = (struct ble_profile *)arg;
+    int rc;
+
+    if (error->status != 0)
+    {
+        ESP_LOGI(ERROR_TAG, "history write error = [handle, status] = [%d, %d]", error->att_handle, error->status);
+        history_done(profile);
+        return -1;
+    }
+
+    history_len[profile->index] = 0;
+    rc = ble_gattc_read_long(conn_handle, profile->characteristic[CHR_HISTORY].val_handle, 0, history_read_cb, profile);
+    if (rc != 0)
+    {
+        ESP_LOGI(ERROR_TAG, "history read failed to start, rc = %d", rc);
+        history_done(profile);
+    }
+    return rc;
+}
+
+int history_catch_up(struct ble_profile *profile)
+{
+    uint8_t since[MORSE_HISTORY_SINCE_LENGTH + MORSE_HISTORY_OFFSET_LENGTH];
+    uint16_t part_len;
+    uint32_t last_seq;
+    int rc;
+
+    if (profile->characteristic[CHR_HISTORY].val_handle == 0)
+    {
+        ESP_LOGI(MORSE_TAG, "history: server has no history characteristic");
+        return BLE_HS_ENOENT;
+    }
+
+    last_seq = history_cursor_find(profile)->last_seq;
+    // part way through a long message, its next piece. It is the one after last_seq unless the one before was evicted.
+    part_len = history_part_len[profile->index];
+    if (part_len)
+    {
+        last_seq = history_part_seq[profile->index] - 1;
+    }
+    since[0] = last_seq;
+    since[1] = last_seq >> 8;
+    since[2] = last_seq >> 16;
+    since[3] = last_seq >> 24;
+    since[4] = part_len;
+    since[5] = part_len >> 8;
+    rc = ble_gattc_write_flat(profile->conn_desc->conn_handle, profile->characteristic[CHR_HISTORY].val_handle,
+                              since, part_len ? sizeof(since) : MORSE_HISTORY_SINCE_LENGTH, history_write_cb, profile);
+    history_busy[profile->index] = rc == 0;
+    return rc;
+}
+
+void history_rest(struct ble_profile *profile, uint32_t seq, const uint8_t *piece, uint16_t length)
+{
+    uint8_t index = profile->index;
+
+    if (history_busy[index])
+    {
+        // the catch up reads the whole message, one more round in case it was about to stop
+        history_again[index] = true;
+        return;
+    }
+    history_cursor_find(profile); // a new server's cursor drops what the profile had from the last one first
+    history_part_len[index] = 0;
+    if (!history_part_add(profile, seq, piece, length))
+    {
+        return;
+    }
+    history_part_pushed[index] = true;
+    if (history_catch_up(profile) != 0)
+    {
+        ESP_LOGI(ERROR_TAG, "history: the rest of message %lu can't be read", (unsigned long)seq);
+        history_part_len[index] = 0;
+    }
+}
+
+void history_seen(const struct ble_profile *profile, uint32_t seq)
+{
+    struct history_cursor *cursor = history_cursor_find(profile);
+
+    // a push from before the catch up read the epoch may be from a restarted server, the catch up sorts that out
+    if (seq > cursor->last_seq)
+    {
+        cursor->last_seq = seq;
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef HISTORY_FUNCTIONS_H
+#define HISTORY_FUNCTIONS_H
+
+#include "morse_common.h"
+
+/**
+ * Reads every message the server stored since the last one this client saw, and prints them.
+ * The last sequence number seen from each server, by its address, survives reconnects and esp_restart(), so a
+ * reconnect only fetches what was missed. It goes back to 0 when the server's epoch shows it restarted.
+ * Runs as a chain of gatt callbacks: write the sequence number, long read the history, repeat while messages come back.
+ * A message longer than one read comes in pieces over several rounds and is printed once whole.
+ * @param profile the server connection, discovery must be done.
+ * @return 0 if the first write was started, a BLE_HS_E* error otherwise.
+ */
+int history_catch_up(struct ble_profile *profile);
+
+/**
+ * Reads the rest of a pushed message too long for its notification, by its sequence number through the history,
+ * from where the notification ended. The message is printed once whole, and only then counts as seen. If a catch
+ * up is running it goes another round instead, which fetches the whole message.
+ * @param profile the server that pushed it.
+ * @param seq the sequence number in the notification.
+ * @param piece what the notification had of the message.
+ * @param length its length.
+ */
+void history_rest(struct ble_profile *profile, uint32_t seq, const uint8_t *piece, uint16_t length);
+
+/**
+ * Records a message received outside of a catch up, so the next catch up doesn't fetch it again.
+ * @param profile the server that sent it.
+ * @param seq the sequence number the server gave the message.
+ */
+void history_seen(const struct ble_profile *profile, uint32_t seq);
+
+#endif
@@ -11,19 +11,25 @@
 //     .val = {0xCA, 0xFF, 0xED, 0xBE, 0xEE, 0xEF}
 // };
 
-// declaration of memory for our profile in all inheriting files.
-struct ble_profile *ble_profile1;
+// declaration of memory for our profiles in all inheriting files.
+struct ble_profile *ble_profiles[MORSE_PEER_MAX];
 
+// the first server, server n adds n to the first byte
 const ble_addr_t server_addr = {
     .type = BLE_ADDR_RANDOM,
     .val = {0xDE, 0xCA, 0xFB, 0xEE, 0xFE, 0xD2}
 };
 
+// several clients can be connected to one server, each needs its own address. The server whitelists them all.
 const ble_addr_t client_addr = {
     .type = BLE_ADDR_RANDOM,
-    .val = {0xCA, 0xFF, 0xED, 0xBE, 0xEE, 0xEF}
+    .val = {0xCA + CONFIG_MORSE_CLIENT_ID, 0xFF, 0xED, 0xBE, 0xEE, 0xEF}
 };
 
+bool ble_profile_ready(const struct ble_profile *profile){
+    return profile && profile->connected && profile->characteristic && profile->characteristic[CHR_MORSE].val_handle != 0;
+}
+
 const ble_addr_t *ble_server_addr_return(){
     return &server_addr; 
 }
@@ -1,11 +1,16 @@
 #ifndef MORSE_COMMON_H
 #define MORSE_COMMON_H
 
+#ifdef MORSE_HOST_BUILD
+// host (linux) build, see Gatt_client/host. Stand-ins for the esp-idf and nimble pieces we use.
+#include "morse_host_port.h"
+#else
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
 
 #include "esp_timer.h"
+#include "esp_cpu.h"
 #include "esp_log.h"
 #include "esp_bt.h"
 #include "esp_event.h"
@@ -21,6 +26,7 @@
 #include "nimble/nimble_port_freertos.h"
 #include "services/gap/ble_svc_gap.h"
 #include "services/gatt/ble_svc_gatt.h"
+#endif
 
 #include <stdint.h>
 #include <string.h>
@@ -32,7 +38,20 @@
 #define DEBUG_TAG "Debugging tag"
 #define ERROR_TAG "||| ERROR |||"
 
-#define CHARACTERISTIC_ARR_MAX 1
+#define CHARACTERISTIC_ARR_MAX 3
+// where each server characteristic is kept in ble_profile.characteristic
+#define CHR_MORSE 0   // messages are written here
+#define CHR_HISTORY 1 // stored messages are read back from here
+#define CHR_STATS 2   // the server's metrics, val_handle 0 on servers without them
+
+// largest link layer payload, requested with data length extension on connect. Its air time depends on the PHY,
+// MORSE_LINK_TX_TIME_MAX in morse_link.h.
+#define LINK_TX_OCTETS_MAX 251
+// link layer payload before data length extension
+#define LINK_TX_OCTETS_DFLT 27
+
+// servers every message is sent to, each has its own profile
+#define MORSE_PEER_MAX CONFIG_MORSE_SERVER_COUNT
 
 typedef struct ble_profile
 {
@@ -40,14 +59,64 @@ typedef struct ble_profile
     const struct ble_gatt_svc *service;
     // struct ble_gatt_chr characteristic[CHARACTERISTIC_ARR_MAX]; // characteristic array holds all the characteristics.
     struct ble_gatt_chr *characteristic; // characteristic array holds all the characteristics.
+    uint16_t mtu;       // negotiated ATT MTU
+    uint16_t tx_octets; // negotiated link layer payload per packet
+    uint8_t index;      // which server, its address is the first server address plus this in the first byte
+    bool connected;     // conn_desc is valid
+    bool subscribed;    // the server pushes every stored message to us, otherwise we read after every write
+    uint16_t cccd_handle; // of the morse characteristic, 0 until found
+    // the send in flight, for send_delivered()
+    int64_t send_start_time;
+    uint16_t send_length;
+    uint16_t send_att_writes;
+    uint16_t send_ll_packets;
+    bool send_pending;  // the write response for the last message hasn't come back yet, under send_all_mux
+    uint16_t send_generation; // the fan out the last message belongs to, under send_all_mux
+    // the chunks send_pump() still has to send, none once send_offset reaches send_length
+    uint16_t send_conn_handle; // the connection they belong to
+    uint16_t send_payload;     // ATT payload per chunk
+    uint16_t send_offset;
+    uint8_t send_seq;
+    uint8_t send_retries;      // times in a row the stack had no tx buffer for the next one
+    uint8_t link_profile; // MORSE_LINK_ profile last asked for, MORSE_LINK_NONE for none
+    uint8_t phy;          // BLE_GAP_LE_PHY_ value the link transmits on
+    // for the time to ready log, 0 before the first
+    int64_t seen_time; // discovery found the server and the connection was started
+    int64_t connect_time;
+    int64_t disconnect_time;
 } ble_profile;
 
 // static struct ble_profile *ble_profile1;
-extern struct ble_profile *ble_profile1;
+// one per server, created before the host and poll tasks start, NULL if it could not be allocated
+extern struct ble_profile *ble_profiles[MORSE_PEER_MAX];
+
+/**
+ * @return true once discovery on the profile's connection found the morse characteristic, so messages can go out.
+ */
+bool ble_profile_ready(const struct ble_profile *profile);
 
+/**
+ * @return the address of the first server, the others follow in the first byte.
+ */
 const ble_addr_t *ble_server_addr_return();
 const ble_addr_t *ble_client_addr_return();
 
 void debug_print_conn_desc(struct ble_gap_conn_desc *conn_desc_ptr);
 
+/**
+ * Find the service, return the handle of the connection (service? attribute?), setup callbacks for services & get ball running
+ * Uses the handles cached from the last connection to the same server if they are still valid.
+ */
+void gatt_conn_init(struct ble_profile *profile);
+
+/**
+ * Discovers the morse service by its UUID and then its characteristics, for a server with nothing valid cached.
+ */
+void gatt_conn_discover(struct ble_profile *profile);
+
+/**
+ * Called once the profile's handles are known, from discovery or the cache. Logs how long that took and subscribes.
+ */
+void gatt_conn_ready(struct ble_profile *profile);
+
 #endif
\ No newline at end of file
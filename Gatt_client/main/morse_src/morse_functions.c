@@ -1,305 +1,533 @@
 #include "morse_functions.h"
 #include "poll_event_task_functions.h"
-
-// debounce macro
-#define DEBOUNCE_MILLIS(x) static int64_t lMillis = 0; if((esp_timer_get_time() - lMillis) < x) return; lMillis = esp_timer_get_time();
+#include "morse_ring.h"
+#include "morse_timing.h"
+#include "morse_trace.h"
+#include "morse_metrics.h"
+#include "morse_log.h"
 
 int64_t start_time;          // time of last valid start
 int64_t time_last_end_event; // time of last valid end
-int64_t lMillis = 0; // time since last send.
 bool input_in_progress;
+static bool character_open; // a symbol was keyed since the last flush or send
+static uint32_t char_decimal = 1; // leading-1 decimal value of the character being keyed
+static morse_ring key_ring;    // timestamped key edges, input source -> morse_process_input()
+static morse_ring button_ring; // timestamped send and read edges, gpio handlers -> morse_process_input()
+static const morse_input_source *input_source;
+static morse_timing input_timing; // dot/dash and gap thresholds
+static int64_t send_time; // last accepted send press
+static int64_t read_time; // last accepted read press
+static bool key_level;        // the key as the last edge left it, true for pressed
+static bool key_stable;       // the key as the decoder sees it
+static int64_t key_burst;     // first edge after the line was last quiet for CONFIG_MORSE_DEBOUNCE_US
+static int64_t key_last_edge; // last start or end edge
+static int64_t message_start;   // first press of the message being keyed, 0 before it, for the keying speed
+static uint32_t message_symbols; // dots and dashes in it
+uint32_t input_dropped = 0;
 
 // initialize the buffers
-uint8_t message_buf[MESS_BUFFER_LENGTH];
+uint8_t message_buf[MESS_BUFFER_BYTES];
 char char_message_buf[CHAR_BUFFER_LENGTH];
 uint32_t mess_buf_end = 0;
 uint32_t char_mess_buf_end = 0;
 
+void message_buf_append(uint8_t symbol)
+{
+    // symbols fill each byte from the low bits up. The old bits are masked out so resetting mess_buf_end is enough to clear the buffer.
+    uint32_t byte = mess_buf_end / MESS_SYMBOLS_PER_BYTE;
+    uint32_t shift = (mess_buf_end % MESS_SYMBOLS_PER_BYTE) * MESS_SYMBOL_BITS;
+
+    message_buf[byte] = (message_buf[byte] & ~(0x3 << shift)) | (symbol << shift);
+    mess_buf_end++;
+}
+
+uint8_t message_buf_get(uint32_t index)
+{
+    uint32_t shift = (index % MESS_SYMBOLS_PER_BYTE) * MESS_SYMBOL_BITS;
+
+    return (message_buf[index / MESS_SYMBOLS_PER_BYTE] >> shift) & 0x3;
+}
+
 void debug_print_buffer()
 {
     int i;
 
-    for (i = 0; i <= mess_buf_end; i++)
+    for (i = 0; i < mess_buf_end; i++)
     {
-        ESP_DRAM_LOGD(DEBUG_TAG, "message buffer[%d]: %d", i, message_buf[i]);
+        ESP_DRAM_LOGD(DEBUG_TAG, "message buffer[%d]: %d", i, message_buf_get(i));
     }
 
-    for (i = 0; i <= char_mess_buf_end; i++)
+    for (i = 0; i < char_mess_buf_end; i++)
     {
         ESP_DRAM_LOGD(DEBUG_TAG, "character buffer[%d]: %c", i, char_message_buf[i]);
     }
 }
 
-char get_letter_morse_code(int decimalValue)
+/*
+Direct-index decode table, indexed by the leading-1 decimal value. Unlisted entries are 0 and decode to MORSE_INVALID_CHAR.
+Kept in DRAM so the send ISR can read it while the flash cache is disabled.
+*/
+static const DRAM_ATTR char morse_letter_table[MORSE_TABLE_LENGTH] = {
+    // letters
+    [MORSE_2(DIT, DAH)] = 'a',
+    [MORSE_4(DAH, DIT, DIT, DIT)] = 'b',
+    [MORSE_4(DAH, DIT, DAH, DIT)] = 'c',
+    [MORSE_3(DAH, DIT, DIT)] = 'd',
+    [MORSE_1(DIT)] = 'e',
+    [MORSE_4(DIT, DIT, DAH, DIT)] = 'f',
+    [MORSE_3(DAH, DAH, DIT)] = 'g',
+    [MORSE_4(DIT, DIT, DIT, DIT)] = 'h',
+    [MORSE_2(DIT, DIT)] = 'i',
+    [MORSE_4(DIT, DAH, DAH, DAH)] = 'j',
+    [MORSE_3(DAH, DIT, DAH)] = 'k',
+    [MORSE_4(DIT, DAH, DIT, DIT)] = 'l',
+    [MORSE_2(DAH, DAH)] = 'm',
+    [MORSE_2(DAH, DIT)] = 'n',
+    [MORSE_3(DAH, DAH, DAH)] = 'o',
+    [MORSE_4(DIT, DAH, DAH, DIT)] = 'p',
+    [MORSE_4(DAH, DAH, DIT, DAH)] = 'q',
+    [MORSE_3(DIT, DAH, DIT)] = 'r',
+    [MORSE_3(DIT, DIT, DIT)] = 's',
+    [MORSE_1(DAH)] = 't',
+    [MORSE_3(DIT, DIT, DAH)] = 'u',
+    [MORSE_4(DIT, DIT, DIT, DAH)] = 'v',
+    [MORSE_3(DIT, DAH, DAH)] = 'w',
+    [MORSE_4(DAH, DIT, DIT, DAH)] = 'x',
+    [MORSE_4(DAH, DIT, DAH, DAH)] = 'y',
+    [MORSE_4(DAH, DAH, DIT, DIT)] = 'z',
+    // figures
+    [MORSE_5(DAH, DAH, DAH, DAH, DAH)] = '0',
+    [MORSE_5(DIT, DAH, DAH, DAH, DAH)] = '1',
+    [MORSE_5(DIT, DIT, DAH, DAH, DAH)] = '2',
+    [MORSE_5(DIT, DIT, DIT, DAH, DAH)] = '3',
+    [MORSE_5(DIT, DIT, DIT, DIT, DAH)] = '4',
+    [MORSE_5(DIT, DIT, DIT, DIT, DIT)] = '5',
+    [MORSE_5(DAH, DIT, DIT, DIT, DIT)] = '6',
+    [MORSE_5(DAH, DAH, DIT, DIT, DIT)] = '7',
+    [MORSE_5(DAH, DAH, DAH, DIT, DIT)] = '8',
+    [MORSE_5(DAH, DAH, DAH, DAH, DIT)] = '9',
+    // ITU punctuation
+    [MORSE_6(DIT, DAH, DIT, DAH, DIT, DAH)] = '.',
+    [MORSE_6(DAH, DAH, DIT, DIT, DAH, DAH)] = ',',
+    [MORSE_6(DAH, DAH, DAH, DIT, DIT, DIT)] = ':',
+    [MORSE_6(DIT, DIT, DAH, DAH, DIT, DIT)] = '?',
+    [MORSE_6(DIT, DAH, DAH, DAH, DAH, DIT)] = '\'',
+    [MORSE_6(DAH, DIT, DIT, DIT, DIT, DAH)] = '-',
+    [MORSE_5(DAH, DIT, DIT, DAH, DIT)] = '/',
+    [MORSE_5(DAH, DIT, DAH, DAH, DIT)] = '(',
+    [MORSE_6(DAH, DIT, DAH, DAH, DIT, DAH)] = ')',
+    [MORSE_6(DIT, DAH, DIT, DIT, DAH, DIT)] = '"',
+    [MORSE_5(DAH, DIT, DIT, DIT, DAH)] = '=',
+    [MORSE_5(DIT, DAH, DIT, DAH, DIT)] = '+',
+    [MORSE_6(DIT, DAH, DAH, DIT, DAH, DIT)] = '@',
+    // common non-ITU punctuation. '&' doubles as the ITU "wait" prosign (AS)
+    [MORSE_6(DAH, DIT, DAH, DIT, DAH, DAH)] = '!',
+    [MORSE_5(DIT, DAH, DIT, DIT, DIT)] = '&',
+    [MORSE_6(DAH, DIT, DAH, DIT, DAH, DIT)] = ';',
+    [MORSE_6(DIT, DIT, DAH, DAH, DIT, DAH)] = '_',
+    [MORSE_7(DIT, DIT, DIT, DAH, DIT, DIT, DAH)] = '$',
+    // ITU prosigns without a character of their own. "error" (8 dots) does not fit in MORSE_TABLE_LENGTH.
+    [MORSE_5(DAH, DIT, DAH, DIT, DAH)] = MORSE_PROSIGN_KA,
+    [MORSE_6(DIT, DIT, DIT, DAH, DIT, DAH)] = MORSE_PROSIGN_SK,
+    [MORSE_5(DIT, DIT, DIT, DAH, DIT)] = MORSE_PROSIGN_SN,
+};
+
+char IRAM_ATTR get_letter_morse_code(int decimalValue)
 {
     /*
     decimalValue has a leading 1 to determine the start of the morse input.
         for example, A: .- , would directly translate to just 01, but to remove
         issues of .- being different from ..-, we have added in a leading 1.
     Hence, A: .- = 101 = 5.
+    Out of range values are folded onto index 0, which is an empty entry. Both selects compile to
+    conditional moves, so the lookup does not branch.
     */
-    switch (decimalValue)
+    uint32_t index = (uint32_t)decimalValue < MORSE_TABLE_LENGTH ? (uint32_t)decimalValue : 0;
+    char letter = morse_letter_table[index];
+
+    return letter ? letter : MORSE_INVALID_CHAR;
+}
+
+void morse_push_symbol(uint8_t symbol)
+{
+    // shift the dot (0) or dash (1) in under the leading 1. Once the code is too long for the table it stops growing
+    // and decodes to MORSE_INVALID_CHAR, which also keeps the shift from overflowing.
+    char_decimal = (char_decimal < MORSE_TABLE_LENGTH) ? ((char_decimal << 1) | symbol) : char_decimal;
+}
+
+void morse_end_character()
+{
+    // nothing keyed since the last character
+    if (char_decimal == 1)
     {
-    case 5:
-        // Handle case for A: .-
-        return 'a';
-    case 24:
-        // Handle case for B: -..
-        return 'b';
-    case 26:
-        // Handle case for C: -.-.
-        return 'c';
-    case 12:
-        // Handle case for D: -..
-        return 'd';
-    case 2:
-        // Handle case for E: .
-        return 'e';
-    case 18:
-        // Handle case for F: ..-.
-        return 'f';
-    case 14:
-        // Handle case for G: --.
-        return 'g';
-    case 16:
-        // Handle case for H: ....
-        return 'h';
-    case 4:
-        // Handle case for I: ..
-        return 'i';
-    case 23:
-        // Handle case for J: .---
-        return 'j';
-    case 13:
-        // Handle case for K: -.-
-        return 'k';
-    case 20:
-        // Handle case for L: .-..
-        return 'l';
-    case 7:
-        // Handle case for M: --
-        return 'm';
-    case 6:
-        // Handle case for N: -.
-        return 'n';
-    case 15:
-        // Handle case for O: ---
-        return 'o';
-    case 22:
-        // Handle case for P: .--.
-        return 'p';
-    case 29:
-        // Handle case for Q: --.-
-        return 'q';
-    case 10:
-        // Handle case for R: .-.
-        return 'r';
-    case 8:
-        // Handle case for S: ...
-        return 's';
-    case 3:
-        // Handle case for T: -
-        return 't';
-    case 9:
-        // Handle case for U: ..-
-        return 'u';
-    case 17:
-        // Handle case for V: ...-
-        return 'v';
-    case 11:
-        // Handle case for W: .--
-        return 'w';
-    case 25:
-        // Handle case for X: -..-
-        return 'x';
-    case 27:
-        // Handle case for Y: -.--
-        return 'y';
-    case 28:
-        // Handle case for Z: --..
-        return 'z';
-    case 63:
-        // Handle case for 0: -----
-        return '0';
-    case 47:
-        // Handle case for 1: .----
-        return '1';
-    case 39:
-        // Handle case for 2: ..---
-        return '2';
-    case 35:
-        // Handle case for 3: ...--
-        return '3';
-    case 33:
-        // Handle case for 4: ....-
-        return '4';
-    case 64:
-        // Handle case for 5: .....
-        return '5';
-    case 48:
-        // Handle case for 6: -....
-        return '6';
-    case 56:
-        // Handle case for 7: --...
-        return '7';
-    case 60:
-        // Handle case for 8: ---..
-        return '8';
-    case 61:
-        // Handle case for 9: ----.
-        return '9';
-    default:
-        // Handle unknown cases
-        return '=';
+        return;
     }
+    if (char_mess_buf_end < CHAR_BUFFER_LENGTH)
+    {
+        char_message_buf[char_mess_buf_end] = get_letter_morse_code(char_decimal);
+        if (char_message_buf[char_mess_buf_end] == MORSE_INVALID_CHAR)
+        {
+            morse_metrics_count(MORSE_COUNTER_INVALID_CHARS);
+        }
+        char_mess_buf_end++;
+    }
+    morse_metrics_count(MORSE_COUNTER_CHARACTERS);
+    char_decimal = 1;
 }
 
-void encode_morse_code()
+void morse_input_init(const morse_input_source *source)
 {
-    /*
-    - For each bit-letter-combo in the message_buf array,
-    - grab the bits for each letter individually, stopping when you reach the '2' at the end of the input
-    - translate that into the corresponding character using getLetterMorseCode()
-    - save that character into the character buffer
-    */
+    input_source = source;
+    morse_ring_init(&key_ring);
+    morse_ring_init(&button_ring);
+    morse_timing_init(&input_timing);
+    // everything morse_process_input() keeps between edges, so a replayed trace decodes the same every time
+    start_time = 0;
+    time_last_end_event = 0;
+    send_time = 0;
+    read_time = 0;
+    input_in_progress = 0;
+    character_open = false;
+    char_decimal = 1;
+    key_level = false;
+    key_stable = false;
+    key_burst = 0;
+    key_last_edge = 0;
+    message_start = 0;
+    message_symbols = 0;
+#if CONFIG_MORSE_TRACE
+    morse_trace_init();
+#endif
+}
 
-    int currentIndex = 0; // index to iterate over
+int morse_input_start()
+{
+    ESP_LOGI(MORSE_TAG, "key input: %s", input_source->name);
+    return input_source->start();
+}
 
-    // check for end condition, the 2nd '2' after a letter. "letter-bits ... 2 2"
-    while (message_buf[currentIndex] != 2)
-    {
-        int charDecimal = 1; // to add leading 1 to binary value
+uint32_t morse_input_wpm()
+{
+    return morse_timing_wpm(&input_timing);
+}
 
-        // decode each letter until the first 2 is reached.
-        while (message_buf[currentIndex] != 2)
+/**
+ * Adds a classified symbol to message_buf and the character being keyed.
+ * @param symbol MORSE_INPUT_DOT, MORSE_INPUT_DASH, MORSE_INPUT_CHAR_END or MORSE_INPUT_WORD_END.
+ */
+static void morse_process_symbol(uint8_t symbol)
+{
+    if (mess_buf_end < MESS_BUFFER_LENGTH)
+    {
+        message_buf_append(symbol);
+    }
+    switch (symbol)
+    {
+    case MORSE_INPUT_DOT:
+    case MORSE_INPUT_DASH:
+        morse_push_symbol(symbol);
+        morse_metrics_count(MORSE_COUNTER_SYMBOLS);
+        message_symbols++;
+        break;
+    case MORSE_INPUT_CHAR_END:
+        morse_end_character();
+        break;
+    case MORSE_INPUT_WORD_END:
+        morse_end_character();
+        if (char_mess_buf_end > 0 && char_mess_buf_end < CHAR_BUFFER_LENGTH)
         {
-            // decodes into decimal value of morse code w leading 1
-            charDecimal = (charDecimal << 1) + message_buf[currentIndex];
-            currentIndex++;
+            char_message_buf[char_mess_buf_end++] = ' ';
         }
-        // currentIndex set to position after the end of a letter, AKA just after the '2' that marks the end of the letter-bits.
-        currentIndex++;
+        break;
+    }
+}
 
-        // translate and store the corresponding character into the character buffer
-        char_message_buf[char_mess_buf_end] = get_letter_morse_code(charDecimal);
-        char_mess_buf_end++;
+/**
+ * Classifies the presses input_timing still holds back and adds them to the buffers.
+ * @param message_end true for the send press.
+ */
+static void morse_process_pending(bool message_end)
+{
+    uint8_t symbols[MORSE_TIMING_FLUSH_MAX];
+    int count = morse_timing_flush(&input_timing, symbols, message_end);
 
-        // ESP_DRAM_LOGI(MORSE_TAG, "Character decoded: %c", get_letter_morse_code(charDecimal));
-        // ESP_DRAM_LOGI(MORSE_TAG, "value at buffer start index :%d", message_buf[startIndex]); // what int is at the start of the next loop
+    for (int i = 0; i < count; i++)
+    {
+        morse_process_symbol(symbols[i]);
     }
 }
 
-void IRAM_ATTR gpio_start_event_handler(void *arg)
+/**
+ * Feeds a debounced press or release of the key to input_timing.
+ * @param pressed true for a press, false for a release.
+ * @param time when the key started moving, microseconds.
+ */
+static void morse_process_key(bool pressed, int64_t time)
 {
-    // ignore false readings. Wait long enough for at least debounce delay.
-    // and never allow for writing beyond the message buffer size, leaving room for the transmission end condition "2 2"
-    if (((esp_timer_get_time() - start_time) < DEBOUNCE_DELAY) || input_in_progress || (mess_buf_end >= MESS_BUFFER_LENGTH - 2))
+    uint8_t symbols[MORSE_TIMING_TAKE_MAX];
+    int count;
+
+    if (pressed)
     {
+        input_in_progress = 1; // holds off the send and read buttons
+        start_time = time;
+        if (message_start == 0)
+        {
+            message_start = time;
+        }
+        // a long gap ends the word, its presses can be classified now
+        if (character_open && morse_timing_gap(&input_timing, start_time - time_last_end_event) != MORSE_GAP_SYMBOL)
+        {
+            morse_process_pending(false);
+            character_open = false;
+        }
         return;
     }
-    input_in_progress = 1; // to prevent multipress
-    start_time = esp_timer_get_time(); // store time of last event
-    // // CHECK FOR DEBOUNCE
-    // DEBOUNCE_MILLIS(DEBOUNCE_DELAY);
+    time_last_end_event = time;
+    // dot or dash of the press MORSE_TIMING_WINDOW / 2 back is decided now, against thresholds that include this one
+    morse_timing_press(&input_timing, time_last_end_event - start_time);
+    count = morse_timing_take(&input_timing, symbols);
+    for (int i = 0; i < count; i++)
+    {
+        morse_process_symbol(symbols[i]);
+    }
+    character_open = true;
+    input_in_progress = 0;
+}
 
-    if ((start_time - time_last_end_event > SPACE_LENGTH) && (mess_buf_end != 0))
+/**
+ * Debounce filter for the key. The key has moved once the line has been quiet for CONFIG_MORSE_DEBOUNCE_US,
+ * and it moved at the first edge of the burst before that. Bounce therefore neither adds presses nor shortens
+ * them, and a glitch that returns to where the key was in time is dropped. Nothing times out: an edge is settled
+ * by the next edge of any button, and for the key that is at least a gap later anyway.
+ * @param time the time of the edge being processed.
+ */
+static void morse_debounce_settle(int64_t time)
+{
+    if (time - key_last_edge >= CONFIG_MORSE_DEBOUNCE_US && key_level != key_stable)
     {
-        message_buf[mess_buf_end] = 2;
-        mess_buf_end++;
-        ESP_DRAM_LOGI(MORSE_TAG, "2 placed in buffer in start event");
+        key_stable = key_level;
+        morse_process_key(key_stable, key_burst);
     }
 }
 
-void IRAM_ATTR gpio_end_event_handler(void *arg)
+/**
+ * Runs one edge through the debounce filter and feeds it to input_timing. The times are the handlers' own, so a
+ * late task doesn't stretch presses or gaps.
+ * @return true for a send press.
+ */
+static bool morse_process_edge(const morse_edge *edge)
 {
-    // ignore false readings. Wait long enough for at least debounce delay. Ensure this is called only after a valid start press.
-    if (((esp_timer_get_time() - time_last_end_event) < DEBOUNCE_DELAY) || !input_in_progress)
+    morse_debounce_settle(edge->time);
+
+    switch (edge->type)
     {
-        return;
+    case MORSE_EDGE_START:
+    case MORSE_EDGE_END:
+        if (edge->time - key_last_edge >= CONFIG_MORSE_DEBOUNCE_US)
+        {
+            key_burst = edge->time;
+        }
+        key_level = (edge->type == MORSE_EDGE_START);
+        key_last_edge = edge->time;
+        return false;
+    case MORSE_EDGE_SEND:
+        // not through the settle filter: that settles an edge at the next one, and a send has to act on its own.
+        // The buttons interrupt on the press only, so the lockout covers their bounce and a double press alike.
+        if (((edge->time - send_time) < BUTTON_LOCKOUT_US) || input_in_progress)
+        {
+            return false;
+        }
+        send_time = edge->time;
+        send_press_time = edge->time;
+        // the last character has no gap after it
+        morse_process_pending(true);
+        morse_end_character();
+        character_open = false;
+        if (message_symbols && time_last_end_event > message_start)
+        {
+            morse_metrics_record(MORSE_HIST_SYMBOLS_PER_S, (int64_t)message_symbols * 1000000 / (time_last_end_event - message_start));
+        }
+        message_start = 0;
+        message_symbols = 0;
+        poll_event_set_flag(POLL_EVENT_SEND_FLAG, true); // the server pushes the result back, poll_event_task reads only if it can't
+        return true;
+    case MORSE_EDGE_READ:
+        // the same lockout as the send button
+        if (((edge->time - read_time) < BUTTON_LOCKOUT_US) || input_in_progress)
+        {
+            return false;
+        }
+        read_time = edge->time;
+        // any server will do, poll_event_task reads from every one that is ready
+        for (int i = 0; i < MORSE_PEER_MAX; i++)
+        {
+            if (ble_profile_ready(ble_profiles[i]))
+            {
+                poll_event_set_flag(POLL_EVENT_READ_FLAG, true);
+                return false;
+            }
+        }
+        ESP_LOGI(DEBUG_TAG, "read press with no server ready");
+        return false;
+    default:
+        return false;
     }
-    time_last_end_event = esp_timer_get_time(); // store time of last event
+}
 
-    // ESP_DRAM_LOGI(MORSE_TAG, "last end time: %d", time_last_end_event);
-    // ESP_DRAM_LOGI(MORSE_TAG, "time elapsed: %d", time_last_end_event - start_time);
+/**
+ * Takes the next edge in time order from the two rings. A key edge is taken as soon as it is older than the first
+ * button edge, a button edge only once the input source can't deliver any key edge from before it anymore.
+ * @return true if edge was filled in.
+ */
+static bool morse_next_edge(morse_edge *edge)
+{
+    morse_edge key;
+    morse_edge button;
+    bool have_key = morse_ring_peek(&key_ring, &key);
 
-    if (PRESS_LENGTH < (time_last_end_event - start_time))
+    if (!morse_ring_peek(&button_ring, &button))
     {
-        // must hold button for at least press_length to get a 1
-        message_buf[mess_buf_end] = 1;
-        mess_buf_end++;
-        // ESP_DRAM_LOGI(MORSE_TAG, "2 in buffer");
+        return have_key && morse_ring_pop(&key_ring, edge);
     }
-    else
+    if (have_key && key.time <= button.time)
     {
-        // 0 if button held for less than press_length time
-        message_buf[mess_buf_end] = 0;
-        mess_buf_end++;
-        // ESP_DRAM_LOGI(MORSE_TAG, "1 in buffer");
+        return morse_ring_pop(&key_ring, edge);
     }
-
-    input_in_progress = 0;
-
-    ESP_DRAM_LOGW(MORSE_TAG, "placed in buffer: %d", message_buf[mess_buf_end - 1]);
+    if (esp_timer_get_time() - button.time < input_source->latency_us)
+    {
+        return false;
+    }
+    return morse_ring_pop(&button_ring, edge);
 }
 
-void IRAM_ATTR gpio_send_event_handler(void *arg)
+uint32_t morse_input_hold_us()
 {
-    static int64_t lMillis = 0; // time since last send.
-    uint8_t i;
-
-    // ignore false readings. Wait at least 20ms before sending again.
-    if (((esp_timer_get_time() - lMillis) < DEBOUNCE_DELAY) || input_in_progress)
-        return;
-
-    lMillis = esp_timer_get_time();
+    morse_edge button;
 
-    // end each message with 2 twos
-    if (mess_buf_end != 0)
+    if (!morse_ring_peek(&button_ring, &button))
     {
-        message_buf[mess_buf_end++] = 2;
-        message_buf[mess_buf_end] = 2;
-
-        encode_morse_code();
+        return 0;
+    }
+    int64_t due = button.time + input_source->latency_us - esp_timer_get_time();
+    return (due > 0) ? due : 0;
+}
 
-        ESP_DRAM_LOGI(MORSE_TAG, "character buffer end: %d", char_mess_buf_end);
+bool morse_process_input()
+{
+    int64_t decode_start = esp_timer_get_time();
+    morse_edge edge;
+    bool send = false;
+    int edges = 0;
 
-        for (i = 0; i < char_mess_buf_end; i++)
+    while (morse_next_edge(&edge))
+    {
+#if CONFIG_MORSE_TRACE
+        morse_trace_record(&edge);
+#endif
+        edges++;
+        // stop at a send press so edges after it stay in the ring for the next message
+        if (morse_process_edge(&edge))
         {
-            ESP_DRAM_LOGI(MORSE_TAG, "character buffer[%d]: %c", i, char_message_buf[i]);
+            send = true;
+            break;
         }
     }
-
-    poll_event_set_all_flags(true); // set write and read checks to true.
-    // char_mess_buf_end = 0;
-    // mess_buf_end = 0;
+    if (edges)
+    {
+        morse_metrics_record(MORSE_HIST_DECODE_US, esp_timer_get_time() - decode_start);
+    }
+    return send;
 }
 
 /**
- * When read button pressed, read the attribute from the server.
- * Always pass in the profile_ptr as a void argument.
+ * Queues an edge for morse_process_input(), or counts it in input_dropped if the ring is full.
  */
-void IRAM_ATTR gpio_read_event_handler(void *arg) {
-    
-    static int64_t lMillis = 0; 
-    if((esp_timer_get_time() - lMillis) < DEBOUNCE_DELAY || input_in_progress) {
-        return; 
+static void IRAM_ATTR morse_queue_edge(morse_ring *ring, uint8_t type, int64_t time)
+{
+    morse_edge edge = { .time = time, .type = type };
+
+    morse_metrics_count(MORSE_COUNTER_EDGES);
+    if (!morse_ring_push(ring, &edge))
+    {
+        input_dropped++;
+        morse_metrics_count(MORSE_COUNTER_EDGES_DROPPED);
+        MORSE_LOG(MORSE_LOG_EDGE_DROPPED, type);
     }
-    // ESP_DRAM_LOGI(DEBUG_TAG, "time = %d", esp_timer_get_time());
-    // ESP_DRAM_LOGI(DEBUG_TAG, "lmillis = %d", lMillis);
-    // ESP_DRAM_LOGI(DEBUG_TAG, "difference = %d", esp_timer_get_time() - lMillis);
-    lMillis = esp_timer_get_time();
-
-    ESP_DRAM_LOGI(DEBUG_TAG, "start of read_event");
-    if(!ble_profile1) {
-        ESP_DRAM_LOGI(DEBUG_TAG, "ble_profile is read_event is NULL");
-        return;
+}
+
+void IRAM_ATTR morse_input_key_edge(uint8_t type, int64_t time)
+{
+    morse_queue_edge(&key_ring, type, time);
+}
+
+void IRAM_ATTR morse_input_key_pulses(const morse_pulse *pulses, int count, int64_t last_edge_time)
+{
+    int64_t time = last_edge_time;
+
+    // the train is timed from its end, walk back to its first edge
+    for (int i = 0; i < count - 1; i++)
+    {
+        time -= pulses[i].duration_us;
     }
+    for (int i = 0; i < count; i++)
+    {
+        morse_queue_edge(&key_ring, pulses[i].pressed ? MORSE_EDGE_START : MORSE_EDGE_END, time);
+        time += pulses[i].duration_us;
+    }
+    poll_event_notify_from_isr();
+}
 
-    ESP_DRAM_LOGI(DEBUG_TAG, "[conn_handle, val_handle] = [%d, %d]", ble_profile1->conn_desc->conn_handle, ble_profile1->characteristic->val_handle);
-    int rc = poll_event_set_flag(POLL_EVENT_READ_FLAG, true);
-    // int rc = ble_gattc_read(ble_profile1->conn_desc->conn_handle, ble_profile1->characteristic->val_handle, ble_gatt_read_chr_cb, arg);
-    if(rc != 0) {
-        ESP_DRAM_LOGI(ERROR_TAG, "read_event error rc = %d", rc);
-        return;
+void IRAM_ATTR gpio_start_event_handler(void *arg)
+{
+    uint32_t cycles = esp_cpu_get_cycle_count();
+
+    morse_input_key_edge(MORSE_EDGE_START, esp_timer_get_time());
+    poll_event_notify_from_isr();
+    morse_metrics_record(MORSE_HIST_ISR_CYCLES, esp_cpu_get_cycle_count() - cycles);
+}
+
+void IRAM_ATTR gpio_end_event_handler(void *arg)
+{
+    uint32_t cycles = esp_cpu_get_cycle_count();
+
+    morse_input_key_edge(MORSE_EDGE_END, esp_timer_get_time());
+    poll_event_notify_from_isr();
+    morse_metrics_record(MORSE_HIST_ISR_CYCLES, esp_cpu_get_cycle_count() - cycles);
+}
+
+void IRAM_ATTR gpio_send_event_handler(void *arg)
+{
+    uint32_t cycles = esp_cpu_get_cycle_count();
+
+    morse_queue_edge(&button_ring, MORSE_EDGE_SEND, esp_timer_get_time());
+    poll_event_notify_from_isr();
+    morse_metrics_record(MORSE_HIST_ISR_CYCLES, esp_cpu_get_cycle_count() - cycles);
+}
+
+void IRAM_ATTR gpio_read_event_handler(void *arg)
+{
+    uint32_t cycles = esp_cpu_get_cycle_count();
+
+    morse_queue_edge(&button_ring, MORSE_EDGE_READ, esp_timer_get_time());
+    poll_event_notify_from_isr();
+    morse_metrics_record(MORSE_HIST_ISR_CYCLES, esp_cpu_get_cycle_count() - cycles);
+}
+
+static int morse_input_gpio_start(void)
+{
+    // takes start time of button1 press
+    int rc = gpio_isr_handler_add(GPIO_INPUT_IO_START, gpio_start_event_handler, (void *)GPIO_INPUT_IO_START);
+    if (rc != ESP_OK)
+    {
+        return rc;
     }
+    // takes end time of button1 pess
+    return gpio_isr_handler_add(GPIO_INPUT_IO_END, gpio_end_event_handler, (void *)GPIO_INPUT_IO_END);
 }
+
+const morse_input_source morse_input_gpio = {
+    .name = "gpio interrupts",
+    .start = morse_input_gpio_start,
+    .latency_us = 0,
+};
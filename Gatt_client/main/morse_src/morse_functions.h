@@ -2,25 +2,85 @@
 #define MORSE_FUNCTIONS_H
 
 #include "morse_common.h"
+#include "morse_proto.h" // for the MORSE_n code macros and the prosigns
 
-#define PRESS_LENGTH 1000000 // Hold-time required for dash '-' input. 1 second in microseconds
-#define SPACE_LENGTH 2000000 // Time required between inputs for new character start. 2 seconds in microseconds
-#define DEBOUNCE_DELAY 500000 // time required between consecutive inputs to prevent debounce issues
+// dot/dash and gap thresholds follow the operator's speed, see morse_timing.h
+#define BUTTON_LOCKOUT_US 500000 // a send or read press is ignored this soon after the last accepted one
 
 // START, END, AND SEND EVENTS
-#define GPIO_INPUT_IO_START 4 // start event sense
+#define GPIO_INPUT_IO_START 4 // start event sense, and the whole key line for the RMT input source
 #define GPIO_INPUT_IO_END 5   // end event sense
 #define GPIO_INPUT_IO_SEND 23 // send event sense
 #define ESP_INTR_FLAG_DEFAULT 0
 
 // the message and character buffers
-#define MESS_BUFFER_LENGTH 2048
+#define MESS_BUFFER_LENGTH 2048 // symbols, not bytes
+#define MESS_SYMBOL_BITS 2 // a symbol is 0 (dot), 1 (dash), 2 (character end) or 3 (word end)
+#define MESS_SYMBOLS_PER_BYTE (8 / MESS_SYMBOL_BITS)
+#define MESS_BUFFER_BYTES (MESS_BUFFER_LENGTH / MESS_SYMBOLS_PER_BYTE)
 #define CHAR_BUFFER_LENGTH 256
-extern uint8_t message_buf[MESS_BUFFER_LENGTH];
+extern uint8_t message_buf[MESS_BUFFER_BYTES]; // packed symbols, use message_buf_append() and message_buf_get()
 extern char char_message_buf[CHAR_BUFFER_LENGTH];
 extern uint32_t mess_buf_end;
 extern uint32_t char_mess_buf_end;
 
+// edges the input source and the gpio handlers timestamp and pass to the poll event task, see morse_ring.h
+#define MORSE_EDGE_START 0 // fill buffer button pressed
+#define MORSE_EDGE_END 1   // fill buffer button released
+#define MORSE_EDGE_SEND 2
+#define MORSE_EDGE_READ 3
+extern uint32_t input_dropped; // edges lost because the poll event task fell MORSE_RING_LENGTH entries behind
+
+/**
+ * Where the key edges come from. The send and read buttons always use their gpio handlers.
+ * A source delivers key edges with morse_input_key_edge() or morse_input_key_pulses(), from one context at a time.
+ */
+typedef struct morse_input_source
+{
+    const char *name;
+    /**
+     * Starts delivering key edges. The gpio isr service is installed by then.
+     * @return 0 on success, an esp_err_t otherwise.
+     */
+    int (*start)(void);
+    // longest time between a key edge and its delivery, in microseconds. Send and read presses are held back this
+    // long so the key edges before them are decoded first.
+    uint32_t latency_us;
+} morse_input_source;
+
+// a level of the key line and how long it lasted, for sources that capture whole pulse trains
+typedef struct morse_pulse
+{
+    uint32_t duration_us;
+    bool pressed;
+} morse_pulse;
+
+extern const morse_input_source morse_input_gpio; // the start and end pin interrupts, one per edge
+
+// symbols the edges are classified into, the same values as in message_buf
+#define MORSE_INPUT_DOT 0
+#define MORSE_INPUT_DASH 1
+#define MORSE_INPUT_CHAR_END 2
+#define MORSE_INPUT_WORD_END 3 // ends the character too
+
+// morse decode table
+#define MORSE_TABLE_LENGTH (1 << (MORSE_MAX_SYMBOLS + 1)) // entries in the decode table, one per leading-1 decimal value
+#define MORSE_INVALID_CHAR '#' // returned for codes that are not in the table. '#' has no morse code.
+
+/**
+ * Appends a symbol to the packed message buffer. The caller checks mess_buf_end against MESS_BUFFER_LENGTH.
+ * Only called from the task that owns message_buf, see morse_process_input().
+ * @param symbol 0 for a dot, 1 for a dash, 2 for the end of a character, 3 for the end of a word.
+ */
+void message_buf_append(uint8_t symbol);
+
+/**
+ * Reads a symbol from the packed message buffer.
+ * @param index the symbol position, less than mess_buf_end.
+ * @return 0 for a dot, 1 for a dash, 2 for the end of a character, 3 for the end of a word.
+ */
+uint8_t message_buf_get(uint32_t index);
+
 /**
  * Prints contents of message buffer and character message buffer
  */
@@ -30,34 +90,89 @@ void debug_print_buffer();
  * Converts decimal value of Morse code to char.
  * @param decimalValue the decimal interpretation of the morse input. Example 'a' = .- = 5.
  *  Note that there is a leading 1 on the binary input of decimalValue.
- * @return the character corresponding to the morse code decimalValue.
+ * @return the character corresponding to the morse code decimalValue, or MORSE_INVALID_CHAR if there is none.
+ */
+char IRAM_ATTR get_letter_morse_code(int decimalValue);
+
+/**
+ * Adds a symbol to the character currently being keyed.
+ * @param symbol 0 for a dot, 1 for a dash.
+ */
+void morse_push_symbol(uint8_t symbol);
+
+/**
+ * Decodes the character currently being keyed into char_message_buf and starts a new one.
+ * Does nothing if no symbols were pushed since the last character, or if char_message_buf is full.
+ */
+void morse_end_character();
+
+/**
+ * Sets up the rings between the input source, the gpio handlers and morse_process_input() and resets the decode
+ * state. Call before the handlers are installed.
+ * @param source where key edges come from, kept until the next call.
+ */
+void morse_input_init(const morse_input_source *source);
+
+/**
+ * Starts the input source given to morse_input_init().
+ * @return 0 on success, an esp_err_t otherwise.
+ */
+int morse_input_start();
+
+/**
+ * Queues a key edge. For input sources, and only from one context at a time.
+ * @param type MORSE_EDGE_START or MORSE_EDGE_END.
+ * @param time when the edge happened, esp_timer microseconds.
+ */
+void IRAM_ATTR morse_input_key_edge(uint8_t type, int64_t time);
+
+/**
+ * Queues a captured pulse train as key edges and wakes the poll event task once. For input sources.
+ * @param pulses the levels in order, each starting with an edge. The duration of the last one is ignored, the
+ * level was still held when the capture ended.
+ * @param last_edge_time when the last pulse started, esp_timer microseconds.
+ */
+void IRAM_ATTR morse_input_key_pulses(const morse_pulse *pulses, int count, int64_t last_edge_time);
+
+/**
+ * @return microseconds until a held back send or read press is due, 0 if there is none. The poll event task
+ * sleeps no longer than this.
+ */
+uint32_t morse_input_hold_us();
+
+/**
+ * The operator's speed as estimated by the adaptive timing, in words per minute.
  */
-char get_letter_morse_code(int decimalValue);
+uint32_t morse_input_wpm();
 
 /**
- * Converts message_buf values into corresponding characterBuffer values.
+ * Drains the edges queued by the gpio handlers: debounces them, classifies presses and gaps and decodes the
+ * result into message_buf and char_message_buf. Sets the send and read flags for the poll event task.
+ * message_buf, char_message_buf, their ends and the timing state belong to the task calling this, the handlers
+ * only timestamp edges.
+ * @return true if a send press was reached. Draining stops there so later input goes into the next message.
  */
-void encode_morse_code();
+bool morse_process_input();
 
 /**
- * Handle the initial neg-edge push of a button for the morse_code translation.
- * Marks time to later translate 1 or 0.
+ * Handle the initial neg-edge push of a button for the morse_code translation. Installed by morse_input_gpio.
+ * Only timestamps the edge, morse_process_input() marks the press start.
  */
 void IRAM_ATTR gpio_start_event_handler(void *arg);
 
 /**
- * Handle the pos-edge after-effect of a button for the morse_code translation.
- * Marks end time and takes previous time to decide if 1 or 0 and places input into buffer.
+ * Handle the pos-edge after-effect of a button for the morse_code translation. Installed by morse_input_gpio.
+ * Only timestamps the edge, morse_process_input() hands the press length to morse_timing.
  */
 void IRAM_ATTR gpio_end_event_handler(void *arg);
 
 /**
- * Handles the operation when data is sent to server.
+ * Handles the send button. Only timestamps the edge, morse_process_input() ends the message.
  */
 void IRAM_ATTR gpio_send_event_handler(void *arg);
 
 /**
- * Handles the operation where data is read from server.
+ * Handles the read button. Only timestamps the edge, morse_process_input() sets the read flag.
  */
 void IRAM_ATTR gpio_read_event_handler(void *arg);
 
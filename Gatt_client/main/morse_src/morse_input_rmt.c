@@ -0,0 +1,109 @@
+#include "morse_input_rmt.h"
+
+#if CONFIG_MORSE_INPUT_RMT
+#include "driver/rmt_rx.h"
+#include "soc/soc_caps.h"
+#include "morse_metrics.h"
+
+#define MORSE_INPUT_RMT_IDLE_US (CONFIG_MORSE_INPUT_RMT_IDLE_MS * 1000)
+
+static rmt_channel_handle_t rmt_channel;
+static rmt_symbol_word_t rmt_symbols[MORSE_INPUT_RMT_SYMBOLS];
+static DRAM_ATTR morse_pulse rmt_pulses[2 * MORSE_INPUT_RMT_SYMBOLS];
+
+static const rmt_receive_config_t rmt_receive_config = {
+    .signal_range_min_ns = MORSE_INPUT_RMT_FILTER_NS,
+    // the idle threshold, a level held this long ends the capture
+    .signal_range_max_ns = MORSE_INPUT_RMT_IDLE_US * 1000ULL,
+};
+
+/**
+ * Adds one half of an RMT symbol to rmt_pulses. The key pulls the line low.
+ * @return false once the idle level that ended the capture was added, it has no duration.
+ */
+static bool IRAM_ATTR rmt_add_pulse(int *count, uint32_t ticks, uint32_t level)
+{
+    rmt_pulses[*count].duration_us = ticks * MORSE_INPUT_RMT_TICK_US;
+    rmt_pulses[*count].pressed = !level;
+    (*count)++;
+    return ticks != 0;
+}
+
+/**
+ * The line has been still for the idle threshold, the last edge was that long ago.
+ * Runs in the RMT interrupt.
+ */
+static bool IRAM_ATTR rmt_recv_done(rmt_channel_handle_t channel, const rmt_rx_done_event_data_t *data, void *arg)
+{
+    uint32_t cycles = esp_cpu_get_cycle_count();
+    int64_t last_edge_time = esp_timer_get_time() - MORSE_INPUT_RMT_IDLE_US;
+    int count = 0;
+
+    for (size_t i = 0; i < data->num_symbols; i++)
+    {
+        if (!rmt_add_pulse(&count, data->received_symbols[i].duration0, data->received_symbols[i].level0) ||
+            !rmt_add_pulse(&count, data->received_symbols[i].duration1, data->received_symbols[i].level1))
+        {
+            break;
+        }
+    }
+    if (count > 0)
+    {
+        morse_input_key_pulses(rmt_pulses, count, last_edge_time);
+    }
+    // capture the next train, edges before this call returns are missed but the line was idle until now
+    rmt_receive(channel, rmt_symbols, sizeof(rmt_symbols), &rmt_receive_config);
+    morse_metrics_record(MORSE_HIST_ISR_CYCLES, esp_cpu_get_cycle_count() - cycles);
+    // morse_input_key_pulses() already yielded to the poll event task if it had to
+    return false;
+}
+
+static int morse_input_rmt_start(void)
+{
+    rmt_rx_channel_config_t channel_config = {
+        .gpio_num = GPIO_INPUT_IO_START,
+#if SOC_RMT_SUPPORT_REF_TICK
+        // the APB clock can only be divided down to 3.2 us ticks, too short for a 102 ms idle threshold or longer
+        .clk_src = RMT_CLK_SRC_REF_TICK,
+#else
+        .clk_src = RMT_CLK_SRC_DEFAULT,
+#endif
+        .resolution_hz = 1000000 / MORSE_INPUT_RMT_TICK_US,
+        .mem_block_symbols = MORSE_INPUT_RMT_SYMBOLS,
+    };
+    rmt_rx_event_callbacks_t callbacks = {
+        .on_recv_done = rmt_recv_done,
+    };
+    int rc;
+
+    rc = rmt_new_rx_channel(&channel_config, &rmt_channel);
+    if (rc != ESP_OK)
+    {
+        return rc;
+    }
+    // the RMT takes the pin over, keep the pull-up gpio_setup() gave it and drop its start edge interrupt
+    gpio_pullup_en(GPIO_INPUT_IO_START);
+    gpio_intr_disable(GPIO_INPUT_IO_START);
+
+    rc = rmt_rx_register_event_callbacks(rmt_channel, &callbacks, NULL);
+    if (rc == ESP_OK && (rc = rmt_enable(rmt_channel)) == ESP_OK)
+    {
+        rc = rmt_receive(rmt_channel, rmt_symbols, sizeof(rmt_symbols), &rmt_receive_config);
+        if (rc == ESP_OK)
+        {
+            return ESP_OK;
+        }
+        rmt_disable(rmt_channel);
+    }
+    // the caller falls back to morse_input_gpio, which takes the pin back
+    rmt_del_channel(rmt_channel);
+    rmt_channel = NULL;
+    return rc;
+}
+
+const morse_input_source morse_input_rmt = {
+    .name = "rmt receiver",
+    .start = morse_input_rmt_start,
+    .latency_us = MORSE_INPUT_RMT_IDLE_US + MORSE_INPUT_RMT_MARGIN_US,
+};
+#endif
@@ -0,0 +1,26 @@
+#ifndef MORSE_INPUT_RMT_H
+#define MORSE_INPUT_RMT_H
+
+#include "morse_functions.h"
+
+#if CONFIG_MORSE_INPUT_RMT
+/*
+Key input captured by the RMT receiver instead of one gpio interrupt per edge. The receiver timestamps the key line
+in hardware and only interrupts once the line has been still for CONFIG_MORSE_INPUT_RMT_IDLE_MS, with the whole
+pulse train since the last time. A held key is still too, so a capture ends at every press and gap longer than the
+threshold: at about 5 dots (6000 / wpm ms) that is every word, at the default 100 ms every dash and character gap
+under 36 wpm and every edge under 12 wpm.
+
+Durations are counted in MORSE_INPUT_RMT_TICK_US ticks, the shortest whole microseconds the 15 bit duration
+registers can count the idle threshold in. The ESP32 divides its 1 MHz REF_TICK down to them, the others their
+default clock.
+*/
+#define MORSE_INPUT_RMT_TICK_US (CONFIG_MORSE_INPUT_RMT_IDLE_MS * 1000 / 32767 + 1) // 4 us at 100 ms, 37 us at 1200
+#define MORSE_INPUT_RMT_SYMBOLS 64           // one memory block, two pulses per symbol
+#define MORSE_INPUT_RMT_FILTER_NS 3000       // pulses shorter than this are dropped, the longest the filter takes
+#define MORSE_INPUT_RMT_MARGIN_US 10000      // from the idle threshold to the edges being queued, on top of it
+
+extern const morse_input_source morse_input_rmt; // the key line on GPIO_INPUT_IO_START through the RMT receiver
+#endif
+
+#endif
@@ -0,0 +1,57 @@
+#include "morse_ring.h"
+
+void morse_ring_init(morse_ring *ring)
+{
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+}
+
+bool IRAM_ATTR morse_ring_push(morse_ring *ring, const morse_edge *value)
+{
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    // acquire pairs with the consumer's release of tail, so the slot is no longer being read
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (head - tail >= MORSE_RING_LENGTH)
+    {
+        return false;
+    }
+    ring->buf[head & MORSE_RING_MASK] = *value;
+    // release publishes the slot before the consumer can see the new head
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+bool IRAM_ATTR morse_ring_pop(morse_ring *ring, morse_edge *value)
+{
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    // acquire pairs with the producer's release of head, so the slot is fully written
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (head == tail)
+    {
+        return false;
+    }
+    *value = ring->buf[tail & MORSE_RING_MASK];
+    // release hands the slot back to the producer only after it has been read
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+bool morse_ring_peek(morse_ring *ring, morse_edge *value)
+{
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (head == tail)
+    {
+        return false;
+    }
+    *value = ring->buf[tail & MORSE_RING_MASK];
+    return true;
+}
+
+uint32_t morse_ring_count(morse_ring *ring)
+{
+    return atomic_load_explicit(&ring->head, memory_order_acquire) - atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
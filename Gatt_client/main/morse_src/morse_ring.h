@@ -0,0 +1,64 @@
+#ifndef MORSE_RING_H
+#define MORSE_RING_H
+
+#include "morse_common.h"
+#include <stdatomic.h>
+
+#define MORSE_RING_LENGTH 128 // entries, must be a power of two
+#define MORSE_RING_MASK (MORSE_RING_LENGTH - 1)
+
+/**
+ * A gpio edge as the handlers saw it. type is one of the MORSE_EDGE_ values in morse_functions.h.
+ */
+typedef struct morse_edge
+{
+    int64_t time; // esp_timer_get_time() in the handler, microseconds
+    uint8_t type;
+} morse_edge;
+
+/**
+ * Wait-free single-producer/single-consumer ring of edges.
+ * head is only written by the producer and tail only by the consumer. Both run freely and are masked on access,
+ * so the ring holds MORSE_RING_LENGTH entries with no empty slot wasted.
+ * Every ring has one producer: the gpio isr service runs its handlers one at a time, and the input source only
+ * delivers from one context.
+ */
+typedef struct morse_ring
+{
+    morse_edge buf[MORSE_RING_LENGTH];
+    atomic_uint_least32_t head; // next slot to write
+    atomic_uint_least32_t tail; // next slot to read
+} morse_ring;
+
+/**
+ * Empties the ring. Only safe while neither side is running.
+ */
+void morse_ring_init(morse_ring *ring);
+
+/**
+ * Producer side. Never blocks.
+ * @param value the edge to add, copied in.
+ * @return true on success, false if the ring is full and value was dropped.
+ */
+bool IRAM_ATTR morse_ring_push(morse_ring *ring, const morse_edge *value);
+
+/**
+ * Consumer side. Never blocks.
+ * @param value receives the oldest edge.
+ * @return true on success, false if the ring is empty.
+ */
+bool IRAM_ATTR morse_ring_pop(morse_ring *ring, morse_edge *value);
+
+/**
+ * Consumer side. Reads the oldest edge without taking it out of the ring.
+ * @param value receives the oldest edge.
+ * @return true on success, false if the ring is empty.
+ */
+bool morse_ring_peek(morse_ring *ring, morse_edge *value);
+
+/**
+ * @return the number of entries waiting. Exact for the consumer, a lower bound for the producer.
+ */
+uint32_t morse_ring_count(morse_ring *ring);
+
+#endif
@@ -0,0 +1,338 @@
+#include "morse_timing.h"
+
+void morse_timing_init(morse_timing *timing)
+{
+    memset(timing, 0, sizeof(*timing));
+    timing->dot = MORSE_TIMING_UNIT_INITIAL;
+    timing->dash = 3 * MORSE_TIMING_UNIT_INITIAL;
+    timing->symbol_gap = MORSE_TIMING_UNIT_INITIAL;
+    timing->char_gap = 3 * MORSE_TIMING_UNIT_INITIAL;
+}
+
+/**
+ * Splits a window of lengths into a short and a long cluster, 1D 2-means by exhaustive search over the sorted window.
+ * If the best split isn't at least MORSE_TIMING_CLUSTER_RATIO apart the window holds one kind of element only,
+ * and single_threshold decides which. The other center is then put at the standard 1:3 ratio.
+ * Integer only, the lengths are whole microseconds anyway.
+ */
+static void timing_cluster(const uint32_t *window, int count, uint32_t single_threshold, uint32_t *low, uint32_t *high)
+{
+    uint32_t sorted[MORSE_TIMING_WINDOW];
+    int64_t total = 0;
+    int64_t left = 0;
+    int64_t best_score = -1;
+    int64_t best_left = 0;
+    int best_split = 0;
+
+    // insertion sort, the window is tiny
+    for (int i = 0; i < count; i++)
+    {
+        int j = i;
+        while (j > 0 && sorted[j - 1] > window[i])
+        {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = window[i];
+        total += window[i];
+    }
+
+    // the split with the least squared error around the two means is the one with the largest sum of S^2/n
+    for (int k = 1; k < count; k++)
+    {
+        left += sorted[k - 1];
+        int64_t right = total - left;
+        int64_t score = left * left / k + right * right / (count - k);
+        if (score > best_score)
+        {
+            best_score = score;
+            best_split = k;
+            best_left = left;
+        }
+    }
+    if (best_split)
+    {
+        uint32_t low_mean = best_left / best_split;
+        uint32_t high_mean = (total - best_left) / (count - best_split);
+        if (high_mean >= MORSE_TIMING_CLUSTER_RATIO * low_mean)
+        {
+            *low = low_mean;
+            *high = high_mean;
+            return;
+        }
+    }
+
+    uint32_t mean = total / count;
+    if (mean < single_threshold)
+    {
+        *low = mean;
+        *high = 3 * mean;
+    }
+    else
+    {
+        *low = mean / 3;
+        *high = mean;
+    }
+}
+
+/**
+ * Gaps this long end a word. 5 units, halfway between a character gap (3) and a word gap (7), and never under
+ * 5 dots so the longer character gaps still reach the window after the operator slows down.
+ */
+static uint32_t timing_word_threshold(const morse_timing *timing)
+{
+    uint32_t threshold = timing->char_gap * 5 / 3;
+
+    return (threshold < 5 * timing->dot) ? 5 * timing->dot : threshold;
+}
+
+/**
+ * True if length lands far outside both centers, MORSE_TIMING_OUTLIER_RATIO short of the low one or past the high one.
+ */
+static bool timing_outlier(uint32_t length, uint32_t low, uint32_t high)
+{
+    return (uint64_t)length * MORSE_TIMING_OUTLIER_RATIO < low || length > (uint64_t)high * MORSE_TIMING_OUTLIER_RATIO;
+}
+
+/**
+ * The operator changed speed, most likely at a character or word boundary. What was keyed after the last gap both
+ * speeds call one is left open for the new speed, whatever is pending before it keeps the thresholds it would get
+ * now, the word threshold too. Both windows then start over, the caller puts the centers where the new speed is.
+ * @param gap the gap in front of the next pending press, the one that gave the change away or the gap that did.
+ * @param unit dot length at the new speed, as far as the element that gave it away tells.
+ */
+static void timing_reseed(morse_timing *timing, uint32_t gap, uint32_t unit)
+{
+    uint32_t press_threshold = (timing->dot + timing->dash) / 2;
+    uint32_t gap_threshold = (timing->symbol_gap + timing->char_gap) / 2;
+    // halfway between a symbol and a character gap at either speed
+    uint32_t boundary = (gap_threshold > 2 * unit) ? gap_threshold : 2 * unit;
+    int end = timing->pending_count;
+
+    if (gap < boundary)
+    {
+        end--;
+        while (end > timing->pending_taken && timing->pending_gap[end] < boundary)
+        {
+            end--;
+        }
+    }
+    // the first gap's slot is unused, it holds the threshold for the gap in front of the pending presses
+    for (int i = timing->pending_taken; i < end; i++)
+    {
+        if (!timing->pending_press_threshold[i])
+        {
+            timing->pending_press_threshold[i] = press_threshold;
+        }
+        if (!timing->pending_gap_threshold[i])
+        {
+            timing->pending_gap_threshold[i] = gap_threshold;
+        }
+    }
+    if (end > timing->pending_frozen)
+    {
+        timing->pending_frozen = end;
+        timing->frozen_word_threshold = timing_word_threshold(timing);
+    }
+
+    timing->press_count = 0;
+    timing->press_next = 0;
+    timing->gap_count = 0;
+    timing->gap_next = 0;
+}
+
+void morse_timing_press(morse_timing *timing, uint32_t duration)
+{
+    // only a press long enough to be keyed on purpose, a glitch that got through shouldn't move the speed.
+    // The clustering below then decides from the old midpoint whether it was a dot or a dash.
+    bool reseed = timing->press_count > 0 && duration >= MORSE_TIMING_UNIT_MIN &&
+                  timing_outlier(duration, timing->dot, timing->dash);
+    if (reseed)
+    {
+        // morse_timing_gap() has put the gap in front of it where it goes, unless this starts a word
+        bool gap_pending = timing->pending_count > 0 && timing->pending_count < MORSE_TIMING_PENDING_MAX;
+        timing_reseed(timing, gap_pending ? timing->pending_gap[timing->pending_count] : 0,
+                      (duration < timing->dot) ? duration : duration / 3);
+    }
+
+    timing->press[timing->press_next] = duration;
+    timing->press_next = (timing->press_next + 1) % MORSE_TIMING_WINDOW;
+    if (timing->press_count < MORSE_TIMING_WINDOW)
+    {
+        timing->press_count++;
+    }
+    timing_cluster(timing->press, timing->press_count, (timing->dot + timing->dash) / 2, &timing->dot, &timing->dash);
+    if (timing->dot < MORSE_TIMING_UNIT_MIN)
+    {
+        timing->dot = MORSE_TIMING_UNIT_MIN;
+    }
+    else if (timing->dot > MORSE_TIMING_UNIT_MAX)
+    {
+        timing->dot = MORSE_TIMING_UNIT_MAX;
+    }
+    // and the dash against the dot, so a held key or a clamped dot can't put the threshold out of reach
+    if (timing->dash < MORSE_TIMING_CLUSTER_RATIO * timing->dot)
+    {
+        timing->dash = MORSE_TIMING_CLUSTER_RATIO * timing->dot;
+    }
+    else if (timing->dash > MORSE_TIMING_DASH_RATIO_MAX * timing->dot)
+    {
+        timing->dash = MORSE_TIMING_DASH_RATIO_MAX * timing->dot;
+    }
+    if (reseed)
+    {
+        // the gaps follow the new speed until they have a window of their own
+        timing->symbol_gap = timing->dot;
+        timing->char_gap = 3 * timing->dot;
+    }
+
+    // morse_timing_gap() flushes before this fills up
+    if (timing->pending_count < MORSE_TIMING_PENDING_MAX)
+    {
+        timing->pending_press_threshold[timing->pending_count] = 0;
+        timing->pending_press[timing->pending_count++] = duration;
+    }
+    // the window is now centered on an earlier press, unless a re-seed already gave it the old speed's
+    if (timing->pending_count > MORSE_TIMING_WINDOW / 2 &&
+        !timing->pending_press_threshold[timing->pending_count - 1 - MORSE_TIMING_WINDOW / 2])
+    {
+        timing->pending_press_threshold[timing->pending_count - 1 - MORSE_TIMING_WINDOW / 2] = (timing->dot + timing->dash) / 2;
+    }
+}
+
+int morse_timing_gap(morse_timing *timing, uint32_t gap)
+{
+    // word gaps and pauses stay out of the window
+    if (gap >= timing_word_threshold(timing))
+    {
+        timing->flush_gap = gap;
+        return MORSE_GAP_WORD;
+    }
+    // a speedup shows in the symbol gaps as soon as in the presses, often sooner when it starts with dashes
+    if (timing->gap_count > 0 && gap >= MORSE_TIMING_UNIT_MIN &&
+        timing_outlier(gap, timing->symbol_gap, timing->char_gap))
+    {
+        timing_reseed(timing, gap, (gap < timing->symbol_gap) ? gap : gap / 3);
+        if (gap < timing->symbol_gap)
+        {
+            // the shortest gap there is, a symbol gap, is a dot long
+            timing->dot = gap;
+            timing->dash = 3 * gap;
+        }
+    }
+
+    timing->gap[timing->gap_next] = gap;
+    timing->gap_next = (timing->gap_next + 1) % MORSE_TIMING_WINDOW;
+    if (timing->gap_count < MORSE_TIMING_WINDOW)
+    {
+        timing->gap_count++;
+    }
+    // with one kind of gap in the window, the dot length says which: symbol gaps are a dot long
+    timing_cluster(timing->gap, timing->gap_count, 2 * timing->dot, &timing->symbol_gap, &timing->char_gap);
+
+    if (timing->pending_count >= MORSE_TIMING_PENDING_MAX)
+    {
+        timing->flush_gap = gap;
+        return MORSE_GAP_CHAR;
+    }
+    // the press this gap is in front of comes next
+    timing->pending_gap[timing->pending_count] = gap;
+    timing->pending_gap_threshold[timing->pending_count] = 0;
+    if (timing->pending_count > MORSE_TIMING_WINDOW / 2 &&
+        !timing->pending_gap_threshold[timing->pending_count - MORSE_TIMING_WINDOW / 2])
+    {
+        timing->pending_gap_threshold[timing->pending_count - MORSE_TIMING_WINDOW / 2] = (timing->symbol_gap + timing->char_gap) / 2;
+    }
+    return MORSE_GAP_SYMBOL;
+}
+
+/**
+ * Word threshold for the gap in front of pending press i, the old speed's if a re-seed froze it.
+ */
+static uint32_t timing_pending_word_threshold(const morse_timing *timing, int i)
+{
+    return (i < timing->pending_frozen) ? timing->frozen_word_threshold : timing_word_threshold(timing);
+}
+
+/**
+ * Writes the gap in front of the pending presses as a character or word end, goes before the first of them.
+ * @return the number of symbols written.
+ */
+static int timing_boundary(const morse_timing *timing, uint8_t *symbols, uint32_t gap_threshold)
+{
+    uint32_t word_threshold = timing_pending_word_threshold(timing, 0);
+
+    if (timing->pending_frozen)
+    {
+        gap_threshold = timing->pending_gap_threshold[0];
+    }
+    // a word gap by the old thresholds, or any gap when pending filled up, so it can be anything
+    if (timing->boundary_gap >= gap_threshold)
+    {
+        symbols[0] = (timing->boundary_gap >= word_threshold) ? 3 : 2;
+        return 1;
+    }
+    return 0;
+}
+
+int morse_timing_take(morse_timing *timing, uint8_t *symbols)
+{
+    uint32_t gap_threshold = (timing->symbol_gap + timing->char_gap) / 2;
+    int count = 0;
+
+    while (timing->pending_taken < timing->pending_count && timing->pending_press_threshold[timing->pending_taken] &&
+           (timing->pending_taken == 0 || timing->pending_gap_threshold[timing->pending_taken]))
+    {
+        int i = timing->pending_taken;
+        uint32_t gap = timing->pending_gap[i];
+
+        if (i == 0)
+        {
+            count += timing_boundary(timing, symbols, gap_threshold);
+        }
+        if (i > 0 && gap >= timing->pending_gap_threshold[i])
+        {
+            symbols[count++] = (gap >= timing_pending_word_threshold(timing, i)) ? 3 : 2;
+        }
+        symbols[count++] = timing->pending_press[i] >= timing->pending_press_threshold[i];
+        timing->pending_taken++;
+    }
+    return count;
+}
+
+int morse_timing_flush(morse_timing *timing, uint8_t *symbols, bool message_end)
+{
+    uint32_t press_threshold = (timing->dot + timing->dash) / 2;
+    uint32_t gap_threshold = (timing->symbol_gap + timing->char_gap) / 2;
+    int count = 0;
+
+    if (timing->pending_count > 0 && timing->pending_taken == 0)
+    {
+        count += timing_boundary(timing, symbols, gap_threshold);
+    }
+    timing->boundary_gap = message_end ? 0 : timing->flush_gap;
+    timing->flush_gap = 0;
+
+    // the last few were never in the middle of a window, the newest one is the closest
+    for (int i = timing->pending_taken; i < timing->pending_count; i++)
+    {
+        uint32_t gap = timing->pending_gap[i];
+        uint32_t press = timing->pending_press[i];
+
+        if (i > 0 && gap >= (timing->pending_gap_threshold[i] ? timing->pending_gap_threshold[i] : gap_threshold))
+        {
+            symbols[count++] = (gap >= timing_pending_word_threshold(timing, i)) ? 3 : 2;
+        }
+        symbols[count++] = press >= (timing->pending_press_threshold[i] ? timing->pending_press_threshold[i] : press_threshold);
+    }
+    timing->pending_count = 0;
+    timing->pending_taken = 0;
+    timing->pending_frozen = 0;
+    return count;
+}
+
+uint32_t morse_timing_wpm(const morse_timing *timing)
+{
+    // PARIS is 50 units, so a unit of 1.2 s is 1 wpm
+    return MORSE_TIMING_UNIT_MAX / timing->dot;
+}
@@ -0,0 +1,106 @@
+#ifndef MORSE_TIMING_H
+#define MORSE_TIMING_H
+
+#include "morse_common.h"
+
+#define MORSE_TIMING_WINDOW 4 // presses and gaps remembered for clustering, about a character's worth each
+#define MORSE_TIMING_PENDING_MAX 48 // presses held back before they are classified, a long word
+#define MORSE_TIMING_FLUSH_MAX (2 * MORSE_TIMING_PENDING_MAX) // symbols morse_timing_flush() writes at most
+#define MORSE_TIMING_TAKE_MAX 2 // symbols morse_timing_take() writes at most, a press and the gap in front of it
+#define MORSE_TIMING_UNIT_INITIAL 500000 // dot length before anything is keyed, puts the first dash threshold at the old fixed 1 s
+#define MORSE_TIMING_UNIT_MIN 15000 // 80 wpm
+#define MORSE_TIMING_UNIT_MAX 1200000 // 1 wpm
+#define MORSE_TIMING_CLUSTER_RATIO 2 // two clusters closer than this are one kind of element keyed with jitter
+#define MORSE_TIMING_DASH_RATIO_MAX 5 // dash center at most this many dots
+#define MORSE_TIMING_OUTLIER_RATIO 2 // an element this far outside both centers re-seeds the clusters
+
+// what a gap between two presses was
+#define MORSE_GAP_SYMBOL 0 // between the symbols of a character, or not decided yet
+#define MORSE_GAP_CHAR 1   // between characters
+#define MORSE_GAP_WORD 2   // between words
+
+/**
+ * Adaptive timing state. Press and gap lengths are clustered over a short window, so the dot/dash and gap
+ * thresholds follow the operator's speed instead of being fixed.
+ * Each press and the gap in front of it is classified against the window that has it in the middle, so it is
+ * judged by the elements keyed around it and not only by those before. It is therefore known MORSE_TIMING_WINDOW / 2
+ * presses later, and the last ones of a word only when it ends. Right after a speed change, or for the first word,
+ * this gets the whole word right instead of only its end.
+ * Whether a gap ends a word is decided against the thresholds when the press after it is classified.
+ * A press or gap far outside both of its centers is a speed change: both windows start over from it, and what is
+ * pending from before the change keeps the old speed's thresholds. A slowdown shows only with its first dash, the
+ * dots before it are read as dashes at the old speed.
+ * All lengths are in microseconds.
+ */
+typedef struct morse_timing
+{
+    uint32_t press[MORSE_TIMING_WINDOW];
+    uint8_t press_count;
+    uint8_t press_next;
+    uint32_t gap[MORSE_TIMING_WINDOW];
+    uint8_t gap_count;
+    uint8_t gap_next;
+    uint32_t dot;        // press cluster centers
+    uint32_t dash;
+    uint32_t symbol_gap; // gap cluster centers
+    uint32_t char_gap;
+    uint32_t pending_press[MORSE_TIMING_PENDING_MAX]; // presses of the word being keyed
+    uint32_t pending_gap[MORSE_TIMING_PENDING_MAX];   // the gap in front of each, the first is unused
+    // dot/dash and symbol/character thresholds for each, from the window that has it in the middle. 0 until then.
+    uint32_t pending_press_threshold[MORSE_TIMING_PENDING_MAX];
+    uint32_t pending_gap_threshold[MORSE_TIMING_PENDING_MAX];
+    uint8_t pending_count;
+    uint8_t pending_taken; // the first ones, already classified by morse_timing_take()
+    // the first ones, keyed before a speed change. They keep the thresholds they had, the word threshold too.
+    uint8_t pending_frozen;
+    uint32_t frozen_word_threshold;
+    // the gap that ended the last flush and the one that ends the next. Whether it was a word gap is only decided
+    // with the first press after it, when the thresholds have seen what came after it. 0 for none.
+    uint32_t boundary_gap;
+    uint32_t flush_gap;
+} morse_timing;
+
+/**
+ * Starts over at MORSE_TIMING_UNIT_INITIAL with nothing pending.
+ */
+void morse_timing_init(morse_timing *timing);
+
+/**
+ * Records a press. It is classified by morse_timing_take() once the window has it in the middle, or with the
+ * rest of its word by morse_timing_flush().
+ * @param duration how long the button was held.
+ */
+void morse_timing_press(morse_timing *timing, uint32_t duration);
+
+/**
+ * Classifies the pending presses the window has now been centered on, and the gaps in front of them.
+ * Call after each morse_timing_press(), it is what lets characters out while the word is still being keyed.
+ * @param symbols receives MORSE_TIMING_TAKE_MAX message_buf symbols at most, as for morse_timing_flush().
+ * @return the number of symbols written.
+ */
+int morse_timing_take(morse_timing *timing, uint8_t *symbols);
+
+/**
+ * Records the gap before a press and decides whether the pending presses should be flushed.
+ * @param gap time from the end of the last press to the start of this one.
+ * @return MORSE_GAP_WORD at a word gap, MORSE_GAP_CHAR if nothing more can be held back, MORSE_GAP_SYMBOL otherwise.
+ */
+int morse_timing_gap(morse_timing *timing, uint32_t gap);
+
+/**
+ * Classifies the pending presses morse_timing_take() has left and the gaps between them, and starts a new word.
+ * The gap in front of them, from the previous flush, is written first as a character or word end. The character
+ * they end with is left open, the next flush or the send press closes it.
+ * @param symbols receives MORSE_TIMING_FLUSH_MAX message_buf symbols at most: 0 dot, 1 dash, 2 character end and
+ * 3 word end.
+ * @param message_end true for the send press, nothing comes before the next message's presses.
+ * @return the number of symbols written.
+ */
+int morse_timing_flush(morse_timing *timing, uint8_t *symbols, bool message_end);
+
+/**
+ * Current speed estimate in words per minute, PARIS timing.
+ */
+uint32_t morse_timing_wpm(const morse_timing *timing);
+
+#endif
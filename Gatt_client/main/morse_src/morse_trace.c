@@ -0,0 +1,125 @@
+#include "morse_trace.h"
+
+void morse_trace_header(uint8_t *buf)
+{
+    buf[0] = MORSE_TRACE_MAGIC0;
+    buf[1] = MORSE_TRACE_MAGIC1;
+    buf[2] = MORSE_TRACE_MAGIC2;
+    buf[3] = MORSE_TRACE_VERSION;
+}
+
+bool morse_trace_is_header(const uint8_t *buf, uint32_t length)
+{
+    return length >= MORSE_TRACE_HEADER_LENGTH && buf[0] == MORSE_TRACE_MAGIC0 && buf[1] == MORSE_TRACE_MAGIC1 &&
+           buf[2] == MORSE_TRACE_MAGIC2 && buf[3] == MORSE_TRACE_VERSION;
+}
+
+int morse_trace_put(uint8_t *buf, uint32_t size, uint64_t delta, uint8_t type)
+{
+    uint64_t value = (delta << MORSE_TRACE_TYPE_BITS) | (type & MORSE_TRACE_TYPE_MASK);
+    uint32_t count = 0;
+
+    // 7 bits per byte, least significant first, the top bit set on all but the last
+    do
+    {
+        if (count >= size)
+        {
+            return 0;
+        }
+        buf[count++] = (value & 0x7F) | ((value >> 7) ? 0x80 : 0);
+        value >>= 7;
+    } while (value);
+    return count;
+}
+
+int morse_trace_get(const uint8_t *buf, uint32_t length, uint32_t *pos, uint64_t *delta, uint8_t *type)
+{
+    uint64_t value = 0;
+    uint32_t shift = 0;
+
+    if (*pos >= length)
+    {
+        return 0;
+    }
+    while (1)
+    {
+        if (*pos >= length || shift >= 64)
+        {
+            return -1;
+        }
+        uint8_t byte = buf[(*pos)++];
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        shift += 7;
+        if (!(byte & 0x80))
+        {
+            break;
+        }
+    }
+    *delta = value >> MORSE_TRACE_TYPE_BITS;
+    *type = value & MORSE_TRACE_TYPE_MASK;
+    return 1;
+}
+
+#if CONFIG_MORSE_TRACE
+static uint8_t trace_buf[CONFIG_MORSE_TRACE_BUFFER_SIZE];
+static uint32_t trace_len;
+static int64_t trace_prev_time; // time of the last recorded edge
+static uint32_t trace_lost;     // edges that didn't fit since the buffer filled up
+
+void morse_trace_init()
+{
+    morse_trace_header(trace_buf);
+    trace_len = MORSE_TRACE_HEADER_LENGTH;
+    trace_prev_time = 0;
+    trace_lost = 0;
+}
+
+void morse_trace_record(const morse_edge *edge)
+{
+    int count;
+
+    if (trace_lost)
+    {
+        count = morse_trace_put(&trace_buf[trace_len], sizeof(trace_buf) - trace_len, trace_lost, MORSE_TRACE_LOST);
+        if (count == 0)
+        {
+            trace_lost++;
+            return;
+        }
+        trace_len += count;
+        trace_lost = 0;
+    }
+    // an input source that delivered later than it said can put an edge behind the last one, record it as at the same time
+    int64_t time = (edge->time > trace_prev_time) ? edge->time : trace_prev_time;
+    count = morse_trace_put(&trace_buf[trace_len], sizeof(trace_buf) - trace_len, time - trace_prev_time, edge->type);
+    if (count == 0)
+    {
+        trace_lost++;
+        return;
+    }
+    trace_len += count;
+    trace_prev_time = time;
+}
+
+void morse_trace_dump()
+{
+    static const char hex[] = "0123456789abcdef";
+    char line[2 * MORSE_TRACE_LINE_BYTES + 1];
+
+    // printf rather than ESP_LOGI, the lines have to get through whatever the log level is
+    for (uint32_t start = 0; start < trace_len; start += MORSE_TRACE_LINE_BYTES)
+    {
+        uint32_t end = (start + MORSE_TRACE_LINE_BYTES < trace_len) ? start + MORSE_TRACE_LINE_BYTES : trace_len;
+        uint32_t n = 0;
+
+        for (uint32_t i = start; i < end; i++)
+        {
+            line[n++] = hex[trace_buf[i] >> 4];
+            line[n++] = hex[trace_buf[i] & 0xF];
+        }
+        line[n] = '\0';
+        printf(MORSE_TRACE_LINE "%s\n", line);
+    }
+    trace_len = 0;
+}
+#endif
@@ -0,0 +1,78 @@
+#ifndef MORSE_TRACE_H
+#define MORSE_TRACE_H
+
+#include "morse_common.h"
+#include "morse_ring.h" // for morse_edge
+
+/*
+Keying trace, the gpio edges exactly as morse_process_input() saw them, so a decode can be replayed on the host.
+
+    bytes 0-3   MORSE_TRACE_MAGIC0..2 and MORSE_TRACE_VERSION
+    then one record per edge, an unsigned LEB128 varint of (delta << 3) | type
+
+delta is the time since the previous record in microseconds, since boot for the first one, so the replay runs on
+the same clock as the firmware. type is a MORSE_EDGE_ value, or MORSE_TRACE_LOST when the recorder ran out of room
+and delta is then the number of edges missing. Edges arrive about every 60 ms at 20 wpm, 3 bytes each.
+
+Over the uart the bytes are printed as hex on lines starting with MORSE_TRACE_LINE, which can be cut out of a
+monitor log as is. Each dump continues the previous one, one boot is one trace.
+*/
+#define MORSE_TRACE_MAGIC0 'M'
+#define MORSE_TRACE_MAGIC1 'T'
+#define MORSE_TRACE_MAGIC2 'R'
+#define MORSE_TRACE_VERSION 1
+#define MORSE_TRACE_HEADER_LENGTH 4
+#define MORSE_TRACE_TYPE_BITS 3
+#define MORSE_TRACE_TYPE_MASK ((1 << MORSE_TRACE_TYPE_BITS) - 1)
+#define MORSE_TRACE_LOST 7
+#define MORSE_TRACE_RECORD_MAX 10 // longest varint, 64 bits
+#define MORSE_TRACE_LINE "MTRACE "
+#define MORSE_TRACE_LINE_BYTES 32 // trace bytes per uart line
+
+/**
+ * Writes the trace header.
+ * @param buf receives MORSE_TRACE_HEADER_LENGTH bytes.
+ */
+void morse_trace_header(uint8_t *buf);
+
+/**
+ * @param buf the first bytes of a trace.
+ * @return true if buf starts with a header this version can read.
+ */
+bool morse_trace_is_header(const uint8_t *buf, uint32_t length);
+
+/**
+ * Encodes one record.
+ * @param delta microseconds since the previous record, or the number of lost edges for MORSE_TRACE_LOST.
+ * @param type a MORSE_EDGE_ value or MORSE_TRACE_LOST.
+ * @return bytes written, 0 if they don't fit in size.
+ */
+int morse_trace_put(uint8_t *buf, uint32_t size, uint64_t delta, uint8_t type);
+
+/**
+ * Decodes the record at *pos and moves *pos past it.
+ * @param delta receives the delta of the record.
+ * @param type receives the type of the record.
+ * @return 1 for a record, 0 at the end of the trace, -1 if the trace is cut off in the middle of a record.
+ */
+int morse_trace_get(const uint8_t *buf, uint32_t length, uint32_t *pos, uint64_t *delta, uint8_t *type);
+
+#if CONFIG_MORSE_TRACE
+/**
+ * Starts a new trace in the recorder. Call before the gpio handlers are installed.
+ */
+void morse_trace_init();
+
+/**
+ * Records an edge. Only called from morse_process_input(), in the poll event task.
+ * When the buffer is full the edge is counted and recorded as lost once the next dump made room.
+ */
+void morse_trace_record(const morse_edge *edge);
+
+/**
+ * Prints what was recorded since the last dump to the uart and empties the buffer. Same task as the recording.
+ */
+void morse_trace_dump();
+#endif
+
+#endif
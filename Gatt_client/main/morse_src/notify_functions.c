@@ -0,0 +1,143 @@
+#include "notify_functions.h"
+#include "callback_functions.h" // for print_message
+#include "history_functions.h" // for history_catch_up, history_rest and history_seen
+#include "cache_functions.h" // for cache_store
+#include "morse_proto.h"
+
+// notifications enabled, indications not: the server sends both the same way and notifications skip the confirmation
+static const uint8_t notify_cccd_value[2] = {0x01, 0x00};
+
+static int notify_subscribe_cb(uint16_t conn_handle, const struct ble_gatt_error *error, struct ble_gatt_attr *attr, void *arg)
+{
+    struct ble_profile *profile = (struct ble_profile *)arg;
+
+    if (error->status == 0)
+    {
+        profile->subscribed = true;
+        ESP_LOGI(MORSE_TAG, "subscribed to server %u notifications", profile->index);
+    }
+    else
+    {
+        ESP_LOGI(ERROR_TAG, "subscribe error = [handle, status] = [%d, %d], reading after every write", error->att_handle, error->status);
+    }
+
+    // anything stored before the subscription is fetched once
+    history_catch_up(profile);
+    return 0;
+}
+
+static int notify_dsc_cb(uint16_t conn_handle, const struct ble_gatt_error *error, uint16_t chr_val_handle, const struct ble_gatt_dsc *dsc, void *arg)
+{
+    struct ble_profile *profile = (struct ble_profile *)arg;
+    int rc;
+
+    switch (error->status)
+    {
+    case 0:
+        if (profile->cccd_handle == 0 && ble_uuid_cmp(&dsc->uuid.u, BLE_UUID16_DECLARE(BLE_GATT_DSC_CLT_CFG_UUID16)) == 0)
+        {
+            profile->cccd_handle = dsc->handle;
+        }
+        return 0;
+    case BLE_HS_EDONE:
+        // everything discovery finds is known now, the next connection to this server can skip it
+        cache_store(profile);
+        break;
+    default:
+        ESP_LOGI(ERROR_TAG, "notify_dsc_cb error = [handle, status] = [%d, %d]", error->att_handle, error->status);
+        history_catch_up(profile);
+        return error->status;
+    }
+
+    if (profile->cccd_handle == 0)
+    {
+        ESP_LOGI(MORSE_TAG, "server has no CCCD on the morse characteristic, reading after every write");
+        history_catch_up(profile);
+        return 0;
+    }
+    rc = ble_gattc_write_flat(conn_handle, profile->cccd_handle, notify_cccd_value, sizeof(notify_cccd_value), notify_subscribe_cb, profile);
+    if (rc != 0)
+    {
+        ESP_LOGI(ERROR_TAG, "subscribe failed to start, rc = %d", rc);
+        history_catch_up(profile);
+    }
+    return 0;
+}
+
+int notify_subscribe(struct ble_profile *profile)
+{
+    const struct ble_gatt_chr *morse = &profile->characteristic[CHR_MORSE];
+    uint16_t end_handle = profile->service->end_handle;
+    int rc;
+
+    profile->subscribed = false;
+
+    // known from the cache, no need to look for it
+    if (profile->cccd_handle != 0)
+    {
+        rc = ble_gattc_write_flat(profile->conn_desc->conn_handle, profile->cccd_handle, notify_cccd_value, sizeof(notify_cccd_value),
+                                  notify_subscribe_cb, profile);
+        if (rc != 0)
+        {
+            ESP_LOGI(ERROR_TAG, "subscribe failed to start, rc = %d", rc);
+            history_catch_up(profile);
+        }
+        return rc;
+    }
+
+    // the descriptors of a characteristic end where the next characteristic starts
+    for (int i = 0; i < CHARACTERISTIC_ARR_MAX; i++)
+    {
+        uint16_t next = profile->characteristic[i].def_handle;
+        if (next > morse->val_handle && next - 1 < end_handle)
+        {
+            end_handle = next - 1;
+        }
+    }
+
+    rc = ble_gattc_disc_all_dscs(profile->conn_desc->conn_handle, morse->val_handle, end_handle, notify_dsc_cb, profile);
+    if (rc != 0)
+    {
+        ESP_LOGI(ERROR_TAG, "descriptor discovery failed to start, rc = %d", rc);
+        history_catch_up(profile);
+    }
+    return rc;
+}
+
+int notify_rx(struct ble_gap_event *event, struct ble_profile *profile)
+{
+    static uint8_t notify_buf[BLE_ATT_ATTR_MAX_LEN];
+    uint16_t notify_len;
+    uint32_t seq;
+    uint16_t length;
+    int rc;
+
+    if (event->notify_rx.attr_handle != profile->characteristic[CHR_MORSE].val_handle)
+    {
+        ESP_LOGI(DEBUG_TAG, "notification from unknown handle %u", event->notify_rx.attr_handle);
+        return 0;
+    }
+
+    // the stack frees event->notify_rx.om once we return
+    rc = ble_hs_mbuf_to_flat(event->notify_rx.om, notify_buf, sizeof(notify_buf), &notify_len);
+    if (rc != 0 || notify_len < MORSE_HISTORY_HEADER_LENGTH)
+    {
+        ESP_LOGI(ERROR_TAG, "malformed notification, %u bytes", notify_len);
+        return -1;
+    }
+    seq = MORSE_GET_LE32(notify_buf);
+    length = MORSE_GET_LE16(&notify_buf[4]);
+    notify_len -= MORSE_HISTORY_HEADER_LENGTH;
+
+    if (length > notify_len)
+    {
+        // longer than the MTU allows. The morse characteristic only has the newest message, which can be another one
+        // by now, the history has this one by its sequence number.
+        ESP_LOGI(MORSE_TAG, "Data pushed by server %u [%lu], %u of %u bytes, reading the rest", profile->index, (unsigned long)seq, notify_len, length);
+        history_rest(profile, seq, &notify_buf[MORSE_HISTORY_HEADER_LENGTH], notify_len);
+        return 0;
+    }
+    history_seen(profile, seq);
+    print_message(profile, "pushed", &notify_buf[MORSE_HISTORY_HEADER_LENGTH], length);
+    return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef NOTIFY_FUNCTIONS_H
+#define NOTIFY_FUNCTIONS_H
+
+#include "morse_common.h"
+
+/**
+ * Subscribes to notifications on the morse characteristic, then catches up on the history.
+ * Finds the CCCD with a descriptor discovery, unless the cache already had it, and writes it. Each step runs from
+ * the last one's callback. A finished discovery stores the server's handles with cache_store().
+ * @param profile the server connection, characteristic discovery must be done.
+ * @return 0 if the descriptor discovery or the CCCD write was started, a BLE_HS_E* error otherwise.
+ */
+int notify_subscribe(struct ble_profile *profile);
+
+/**
+ * Handles BLE_GAP_EVENT_NOTIFY_RX. Prints the pushed message, reading the rest of it if it didn't fit.
+ * @param event the gap event.
+ * @param profile the server connection.
+ * @return 0 on success, -1 if the notification was malformed.
+ */
+int notify_rx(struct ble_gap_event *event, struct ble_profile *profile);
+
+#endif
@@ -2,6 +2,12 @@
 #include "poll_event_task_functions.h"
 #include "callback_functions.h" // for the callbacks in poll_event_task
 #include "morse_functions.h" // for writing to mem and character buffers
+#include "send_functions.h" // for writing messages of any length
+#include "morse_wire.h" // for packing messages
+#include "morse_trace.h" // for dumping keying traces
+#include "morse_link.h" // for the connection profiles
+#include "stats_functions.h" // for the metrics dump
+#include "morse_log.h" // for the send latency
 // static struct ble_profile *ble_profile1;
 
 // read from server. True = yes, False = no.
@@ -9,6 +15,9 @@ bool read_flag = false;
 // send to server. True = yes, False = no.
 bool send_flag = false;
 
+TaskHandle_t poll_event_task_handle = NULL;
+int64_t send_press_time = 0;
+
 void poll_event_set_all_flags(bool val) {
     read_flag = val;
     send_flag = val;
@@ -29,35 +38,176 @@ int poll_event_set_flag(uint8_t flag, bool val) {
     return 0;
 }
 
+void IRAM_ATTR poll_event_notify_from_isr() {
+    BaseType_t higher_priority_task_woken = pdFALSE;
+
+    if(!poll_event_task_handle) {
+        return;
+    }
+    vTaskNotifyGiveFromISR(poll_event_task_handle, &higher_priority_task_woken);
+    // switch straight to the task on interrupt exit instead of waiting for the next tick
+    portYIELD_FROM_ISR(higher_priority_task_woken);
+}
+
+void poll_event_notify() {
+    if(poll_event_task_handle) {
+        xTaskNotifyGive(poll_event_task_handle);
+    }
+}
+
+/**
+ * Asks every ready server connection for the interactive profile if the link was just used, or for the idle one
+ * once CONFIG_MORSE_LINK_IDLE_S have passed without use. Connections already asked aren't asked again.
+ * @param active true if input or a message woke the task.
+ * @return ticks until the switch to idle is due, portMAX_DELAY if none is.
+ */
+static TickType_t poll_event_link_update(bool active) {
+#if CONFIG_MORSE_LINK_IDLE_S
+    static int64_t active_time = 0;
+    int64_t now = esp_timer_get_time();
+    int64_t idle_at;
+    uint8_t want;
+    int rc;
+
+    if(active) {
+        active_time = now;
+    }
+    idle_at = active_time + CONFIG_MORSE_LINK_IDLE_S * 1000000LL;
+    want = (now < idle_at) ? MORSE_LINK_INTERACTIVE : MORSE_LINK_IDLE;
+
+    for(int i = 0; i < MORSE_PEER_MAX; i++) {
+        struct ble_profile *profile = ble_profiles[i];
+        if(!ble_profile_ready(profile) || profile->link_profile == want) {
+            continue;
+        }
+        rc = morse_link_set(profile->conn_desc->conn_handle, want);
+        if(rc != 0) {
+            ESP_LOGI(ERROR_TAG, "link: server %u %s profile failed to start, rc = %d", profile->index, morse_link_name(want), rc);
+            continue;
+        }
+        ESP_LOGI(MORSE_TAG, "link: server %u to the %s profile", profile->index, morse_link_name(want));
+        profile->link_profile = want;
+    }
+    return (want == MORSE_LINK_INTERACTIVE) ? pdMS_TO_TICKS((idle_at - now) / 1000) + 1 : portMAX_DELAY;
+#else
+    return portMAX_DELAY;
+#endif
+}
+
+#if CONFIG_MORSE_LOAD_TEST_MS
+/**
+ * Once CONFIG_MORSE_LOAD_TEST_MS has passed since the last one, puts a generated message in char_message_buf and
+ * flags it to be sent, as a send press would. Does nothing until the morse characteristic was found on a server.
+ */
+static void poll_event_load_test() {
+    static int64_t next = 0;
+    static uint32_t count = 0;
+    int64_t now = esp_timer_get_time();
+    bool ready = false;
+
+    for(int i = 0; i < MORSE_PEER_MAX; i++) {
+        ready |= ble_profile_ready(ble_profiles[i]);
+    }
+    if(now < next || !ready) {
+        return;
+    }
+    next = now + CONFIG_MORSE_LOAD_TEST_MS * 1000LL;
+    char_mess_buf_end = snprintf(char_message_buf, CHAR_BUFFER_LENGTH, "load test client %d message %lu the quick brown fox",
+                                 CONFIG_MORSE_CLIENT_ID, (unsigned long)count++);
+    mess_buf_end = 0;
+    send_press_time = now;
+    send_flag = true;
+}
+#endif
+
 void poll_event_task(void *param) {
-    // just ticks tbh
-    int cnt = 0;
+    // messages go out packed, about 6 bits a character instead of 8
+    static uint8_t frame[MORSE_WIRE_MAX_LENGTH(CHAR_BUFFER_LENGTH)];
+    uint8_t frame_seq = 0;
+    TickType_t link_wait = portMAX_DELAY;
+    TickType_t send_wait = portMAX_DELAY;
+
     while (1)
     {
         int rc; // for error codes
-        //printf("cnt: %d\n", cnt++);
-        ESP_LOGI(MORSE_TAG,"cnt: %d", cnt++);
-        if(send_flag) {
-            send_flag = false;
-            // ESP_LOGI(DEBUG_TAG,"write_flag true");
-            rc = ble_gattc_write_flat(ble_profile1->conn_desc->conn_handle, ble_profile1->characteristic->val_handle, char_message_buf, char_mess_buf_end, ble_gatt_write_chr_cb, NULL);
-            char_mess_buf_end = 0;
-            mess_buf_end = 0;
-            if(rc != 0) {
-                ESP_LOGI(ERROR_TAG, "write_event error rc = %d", rc);
-                return;
-            }
+        bool more_input;
+        bool active;
+
+        // sleep until a gpio handler or the input source notifies us. Several notifications are taken at once since the loop below drains everything.
+        // a send or read press held back for the input source's latency wakes us when it is due.
+        uint32_t hold_us = morse_input_hold_us();
+        TickType_t wait = hold_us ? pdMS_TO_TICKS(hold_us / 1000) + 1 : portMAX_DELAY;
+#if CONFIG_MORSE_LOAD_TEST_MS
+        if(wait > pdMS_TO_TICKS(CONFIG_MORSE_LOAD_TEST_MS)) {
+            wait = pdMS_TO_TICKS(CONFIG_MORSE_LOAD_TEST_MS);
         }
-        if(read_flag) {
-            read_flag = false;
-            // ESP_LOGI(DEBUG_TAG,"read_flag true");
-            rc = ble_gattc_read(ble_profile1->conn_desc->conn_handle, ble_profile1->characteristic->val_handle, ble_gatt_read_chr_cb, NULL);
-            if(rc != 0) {
-                ESP_LOGI(ERROR_TAG, "read_event error rc = %d", rc);
-                return;
-            }
+#endif
+        if(wait > link_wait) {
+            wait = link_wait;
+        }
+        if(wait > send_wait) {
+            wait = send_wait;
         }
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
+        active = ulTaskNotifyTake(pdTRUE, wait) > 0;
+#if CONFIG_MORSE_LOAD_TEST_MS
+        poll_event_load_test();
+        active |= send_flag;
+#endif
+        // the update takes a few connection events, start it before the input is decoded and sent
+        link_wait = poll_event_link_update(active);
+
+        do {
+            // decode whatever the gpio handlers queued. Sets the flags and stops early if a send press was reached.
+            more_input = morse_process_input();
+            if(send_flag) {
+                send_flag = false;
+                // ESP_LOGI(DEBUG_TAG,"write_flag true");
+                MORSE_LOG(MORSE_LOG_SEND_PRESS, esp_timer_get_time() - send_press_time);
+                int frame_len = morse_wire_encode(char_message_buf, char_mess_buf_end, frame_seq++, MORSE_WIRE_FORMAT_AUTO, frame, sizeof(frame));
+                // every server gets it at once, the write callbacks log each one's latency and the slowest
+                rc = (frame_len < 0) ? 0 : send_message_all(frame, frame_len);
+                char_mess_buf_end = 0;
+                mess_buf_end = 0;
+                if(rc == 0) {
+                    ESP_LOGI(ERROR_TAG, "write_event error, sent to no server");
+                }
+                // a subscribed client gets the stored message as a notification, the read is only for servers that can't push
+                for(int i = 0; i < MORSE_PEER_MAX; i++) {
+                    if(ble_profile_ready(ble_profiles[i]) && !ble_profiles[i]->subscribed) {
+                        rc = ble_gattc_read_long(ble_profiles[i]->conn_desc->conn_handle, ble_profiles[i]->characteristic->val_handle, 0, ble_gatt_read_chr_cb, ble_profiles[i]);
+                        if(rc != 0) {
+                            ESP_LOGI(ERROR_TAG, "read_event error rc = %d", rc);
+                        }
+                    }
+                }
+#if CONFIG_MORSE_TRACE
+                // the edges that keyed this message, for trace_replay on the host
+                morse_trace_dump();
+#endif
+            }
+            if(read_flag) {
+                read_flag = false;
+                // ESP_LOGI(DEBUG_TAG,"read_flag true");
+                // a long read returns the whole stored message, a plain read stops at MTU - 1 bytes
+                // the read press also dumps the metrics, ours now and each server's once its snapshot is in
+                stats_dump_local();
+                for(int i = 0; i < MORSE_PEER_MAX; i++) {
+                    if(!ble_profile_ready(ble_profiles[i])) {
+                        continue;
+                    }
+                    rc = ble_gattc_read_long(ble_profiles[i]->conn_desc->conn_handle, ble_profiles[i]->characteristic->val_handle, 0, ble_gatt_read_chr_cb, ble_profiles[i]);
+                    if(rc != 0) {
+                        ESP_LOGI(ERROR_TAG, "read_event error rc = %d", rc);
+                    }
+                    rc = stats_read(ble_profiles[i]);
+                    if(rc != 0 && rc != BLE_HS_ENOENT) {
+                        ESP_LOGI(ERROR_TAG, "stats read error rc = %d", rc);
+                    }
+                }
+            }
+        } while(more_input);
+        // chunks the stack had no tx buffer for, tried again once it had time to free some instead of sleeping here
+        send_wait = send_pump();
     }
 }
 
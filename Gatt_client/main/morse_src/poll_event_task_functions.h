@@ -11,6 +11,21 @@ extern bool read_flag;
 // send to server. True = yes, False = no.
 extern bool send_flag;
 
+// handle of the running poll_event_task, for notifying it
+extern TaskHandle_t poll_event_task_handle;
+// esp_timer time of the last send press, for logging the press to write latency
+extern int64_t send_press_time;
+
+/**
+ * Wakes poll_event_task from a gpio handler. Call after queueing input or setting a flag.
+ */
+void IRAM_ATTR poll_event_notify_from_isr();
+
+/**
+ * Wakes poll_event_task from another task. Counts as use of the link, like input does.
+ */
+void poll_event_notify();
+
 /**
  * Sets all flags to the value given.
  */
@@ -25,7 +40,9 @@ void poll_event_set_all_flags(bool val);
 int poll_event_set_flag(uint8_t flag, bool val);
 
 /**
- * Checks for any event by monitoring certain flags. If any flag is true, then triggers correct task.
+ * Sleeps until notified by a gpio handler, then decodes the queued input and handles any flag that is true.
+ * Keeps the server connections on the interactive connection profile while in use and on the idle one after
+ * CONFIG_MORSE_LINK_IDLE_S quiet seconds.
  */
 void poll_event_task(void *param);
 
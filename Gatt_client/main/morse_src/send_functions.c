@@ -0,0 +1,333 @@
+#include "send_functions.h"
+#include "callback_functions.h" // for ble_gatt_write_chr_cb
+#include "morse_proto.h"
+#include "morse_metrics.h"
+#include "morse_log.h"
+
+#define SEND_RETRY_DELAY_MS 5 // wait for the stack to free tx buffers
+#define SEND_RETRY_MAX 200
+#define L2CAP_HEADER_LENGTH 4
+
+// the write callback's argument: the profile index in the low byte, the fan out generation above it
+#define SEND_CB_ARG(profile) ((void *)(uintptr_t)((profile)->index | ((uint32_t)(profile)->send_generation << 8)))
+#define SEND_CB_INDEX(arg) ((uint8_t)(uintptr_t)(arg))
+#define SEND_CB_GENERATION(arg) ((uint16_t)((uintptr_t)(arg) >> 8))
+
+// the message of the fan out, the chunks of every server are sent from here by send_pump()
+static uint8_t send_all_data[MORSE_MESSAGE_MAX_LENGTH];
+
+// the fan out in flight, for send_delivered(). The poll task starts it and the host task counts the answers, on
+// either core, so all of it and the profiles' send_pending are only touched under send_all_mux.
+static portMUX_TYPE send_all_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint16_t send_all_generation; // answers to the writes of an older fan out are ignored
+static int64_t send_all_start_time;
+static uint8_t send_all_started; // servers the message went out to
+static uint8_t send_all_done;     // of those, the ones that answered
+static uint8_t send_all_ok;       // of those, the ones that took it
+static bool send_all_queuing;     // writes are still being started, the fan out can't be complete yet
+
+/**
+ * Logs the fan out as delivered if every server it went out to has answered. Call under send_all_mux, logging
+ * only puts an entry in the log ring.
+ */
+static void send_all_check_done(int64_t now)
+{
+    if (!send_all_queuing && send_all_started > 0 && send_all_done == send_all_started)
+    {
+        // the slowest server sets the latency of the whole fan out
+        MORSE_LOG(MORSE_LOG_DELIVERED, send_all_ok, send_all_started, now - send_all_start_time);
+    }
+}
+
+/**
+ * Counts one ATT write of pdu_length bytes (ATT header included) towards the profile's goodput log.
+ */
+static void send_count_write(struct ble_profile *profile, uint16_t pdu_length)
+{
+    profile->send_att_writes++;
+    profile->send_ll_packets += (pdu_length + L2CAP_HEADER_LENGTH + profile->tx_octets - 1) / profile->tx_octets;
+}
+
+#if CONFIG_MORSE_CHUNKED_WRITES
+/**
+ * Sends the profile's next chunk of send_all_data: every chunk but the last as a write command, which needs no
+ * response, then the last one as a write request. ATT handles writes in order, so the response to the last chunk
+ * acknowledges the whole message.
+ * @return 0 if the chunk went out, BLE_HS_ENOMEM if the stack has no tx buffer for it now, another BLE_HS_E* error
+ * if the message can't go on.
+ */
+static int send_chunk(struct ble_profile *profile)
+{
+    static uint8_t frame[BLE_ATT_MTU_MAX]; // only the poll event task sends, and the stack copies each chunk
+    uint16_t conn_handle = profile->conn_desc->conn_handle;
+    uint16_t attr_handle = profile->characteristic[CHR_MORSE].val_handle;
+    uint16_t chunk_length = profile->send_payload - MORSE_CHUNK_HEADER_LENGTH;
+    uint16_t offset = profile->send_offset;
+    uint16_t len = (profile->send_length - offset < chunk_length) ? profile->send_length - offset : chunk_length;
+    bool last = (offset + len == profile->send_length);
+    int rc;
+
+    frame[0] = MORSE_CHUNK_HEADER(offset == 0, last, profile->send_seq);
+    memcpy(&frame[MORSE_CHUNK_HEADER_LENGTH], &send_all_data[offset], len);
+    if (last)
+    {
+        rc = ble_gattc_write_flat(conn_handle, attr_handle, frame, len + MORSE_CHUNK_HEADER_LENGTH, ble_gatt_write_chr_cb,
+                                  SEND_CB_ARG(profile));
+    }
+    else
+    {
+        rc = ble_gattc_write_no_rsp_flat(conn_handle, attr_handle, frame, len + MORSE_CHUNK_HEADER_LENGTH);
+    }
+    if (rc != 0)
+    {
+        return rc;
+    }
+    send_count_write(profile, len + MORSE_CHUNK_HEADER_LENGTH + MORSE_ATT_WRITE_OVERHEAD);
+    profile->send_offset += len;
+    profile->send_seq++;
+    return 0;
+}
+
+#else
+/**
+ * Standard GATT long write: prepare writes of MTU - 5 bytes each, then an execute write.
+ */
+static int send_long(struct ble_profile *profile, uint16_t attr_handle, const uint8_t *data, uint16_t length, uint16_t mtu)
+{
+    struct os_mbuf *om;
+    uint16_t prepare_payload = mtu - 5; // opcode, handle and offset
+
+    if (length > BLE_ATT_ATTR_MAX_LEN)
+    {
+        return BLE_HS_EMSGSIZE;
+    }
+    for (uint16_t offset = 0; offset < length; offset += prepare_payload)
+    {
+        uint16_t len = (length - offset < prepare_payload) ? length - offset : prepare_payload;
+        send_count_write(profile, len + 5);
+    }
+    send_count_write(profile, 2); // execute write
+    om = ble_hs_mbuf_from_flat(data, length);
+    if (!om)
+    {
+        return BLE_HS_ENOMEM;
+    }
+    // the stack takes ownership of om, even on failure
+    return ble_gattc_write_long(profile->conn_desc->conn_handle, attr_handle, 0, om, ble_gatt_write_chr_cb, SEND_CB_ARG(profile));
+}
+
+#endif
+
+/**
+ * Starts writing send_all_data to the server in the fewest ATT round trips the current MTU allows. Messages that fit
+ * in one ATT payload go out as a single write. Longer ones are split into framed chunks (see morse_proto.h) that
+ * send_pump() sends, or, with CONFIG_MORSE_CHUNKED_WRITES off, go out as a GATT long write.
+ * @return 0 on success, a BLE_HS_E* error otherwise. ble_gatt_write_chr_cb reports the final result.
+ */
+static int send_message(struct ble_profile *profile, uint16_t length)
+{
+    uint16_t conn_handle = profile->conn_desc->conn_handle;
+    uint16_t attr_handle = profile->characteristic[CHR_MORSE].val_handle;
+    uint16_t mtu = ble_att_mtu(conn_handle);
+    uint16_t payload;
+
+    if (mtu == 0)
+    {
+        return BLE_HS_ENOTCONN;
+    }
+    payload = mtu - MORSE_ATT_WRITE_OVERHEAD;
+
+    profile->send_start_time = esp_timer_get_time();
+    profile->send_length = length;
+    profile->send_offset = length; // nothing for send_pump() unless chunked
+    profile->send_att_writes = 0;
+    profile->send_ll_packets = 0;
+    morse_metrics_count(MORSE_COUNTER_WRITES);
+
+    if (length <= payload)
+    {
+        send_count_write(profile, length + MORSE_ATT_WRITE_OVERHEAD);
+        MORSE_LOG(MORSE_LOG_SEND_SINGLE, length, profile->index, mtu);
+        return ble_gattc_write_flat(conn_handle, attr_handle, send_all_data, length, ble_gatt_write_chr_cb, SEND_CB_ARG(profile));
+    }
+#if CONFIG_MORSE_CHUNKED_WRITES
+    MORSE_LOG(MORSE_LOG_SEND_CHUNKED, length, profile->index,
+              (length + payload - MORSE_CHUNK_HEADER_LENGTH - 1) / (payload - MORSE_CHUNK_HEADER_LENGTH), mtu);
+    profile->send_conn_handle = conn_handle;
+    profile->send_payload = payload;
+    profile->send_offset = 0;
+    profile->send_seq = 0;
+    profile->send_retries = 0;
+    return 0;
+#else
+    MORSE_LOG(MORSE_LOG_SEND_LONG, length, profile->index, mtu);
+    return send_long(profile, attr_handle, send_all_data, length, mtu);
+#endif
+}
+
+int send_message_all(const void *data, uint16_t length)
+{
+    int rc;
+    uint8_t started;
+
+    if (length > MORSE_MESSAGE_MAX_LENGTH)
+    {
+        ESP_LOGI(ERROR_TAG, "send: %u bytes is more than a message holds", length);
+        return 0;
+    }
+    // the chunks still out of the last fan out are dropped, the server throws away a message without its last chunk
+    memcpy(send_all_data, data, length);
+
+    portENTER_CRITICAL(&send_all_mux);
+    if (send_all_done < send_all_started)
+    {
+        MORSE_LOG(MORSE_LOG_STILL_OUT, send_all_started - send_all_done, send_all_started);
+    }
+    send_all_generation++;
+    send_all_start_time = esp_timer_get_time();
+    send_all_started = 0;
+    send_all_done = 0;
+    send_all_ok = 0;
+    send_all_queuing = true;
+    portEXIT_CRITICAL(&send_all_mux);
+
+    // every write is queued before any answer is waited for, so the servers get the message at about the same time
+    for (int i = 0; i < MORSE_PEER_MAX; i++)
+    {
+        struct ble_profile *profile = ble_profiles[i];
+
+        if (!ble_profile_ready(profile))
+        {
+            continue;
+        }
+        // counted before the write starts, its response may reach send_delivered() before send_message() returns
+        portENTER_CRITICAL(&send_all_mux);
+        profile->send_pending = true;
+        profile->send_generation = send_all_generation;
+        send_all_started++;
+        portEXIT_CRITICAL(&send_all_mux);
+
+        rc = send_message(profile, length);
+        if (rc != 0)
+        {
+            // nothing went out, no answer will come
+            portENTER_CRITICAL(&send_all_mux);
+            profile->send_pending = false;
+            send_all_started--;
+            portEXIT_CRITICAL(&send_all_mux);
+            ESP_LOGI(ERROR_TAG, "send to server %u failed, rc = %d", profile->index, rc);
+            morse_metrics_count_shared(MORSE_COUNTER_WRITE_ERRORS);
+            morse_metrics_error_code(rc);
+        }
+    }
+
+    portENTER_CRITICAL(&send_all_mux);
+    send_all_queuing = false;
+    started = send_all_started;
+    // every answer may have come while the later writes were being started
+    send_all_check_done(esp_timer_get_time());
+    portEXIT_CRITICAL(&send_all_mux);
+
+    // the first chunk of every server goes out now, not on the next wake
+    send_pump();
+    return started;
+}
+
+TickType_t send_pump()
+{
+#if CONFIG_MORSE_CHUNKED_WRITES
+    uint32_t blocked = 0; // servers the stack had no tx buffer for, tried again on the next call
+    bool progress = true;
+    int rc;
+
+    // one chunk per server per round, so a long message or a slow server doesn't hold the others back
+    while (progress)
+    {
+        progress = false;
+        for (int i = 0; i < MORSE_PEER_MAX; i++)
+        {
+            struct ble_profile *profile = ble_profiles[i];
+
+            if (!profile || profile->send_offset >= profile->send_length || (blocked & (1u << i)))
+            {
+                continue;
+            }
+            // disconnected since, ble_profile_reset() already answered for it
+            if (!ble_profile_ready(profile) || profile->conn_desc->conn_handle != profile->send_conn_handle)
+            {
+                profile->send_offset = profile->send_length;
+                continue;
+            }
+            rc = send_chunk(profile);
+            if (rc == 0)
+            {
+                profile->send_retries = 0;
+                progress = true;
+                continue;
+            }
+            if (rc == BLE_HS_ENOMEM && ++profile->send_retries < SEND_RETRY_MAX)
+            {
+                morse_metrics_count(MORSE_COUNTER_WRITE_RETRIES);
+                blocked |= 1u << i;
+                continue;
+            }
+            ESP_LOGI(ERROR_TAG, "send to server %u: chunk %u failed, rc = %d", profile->index, profile->send_seq, rc);
+            morse_metrics_count_shared(MORSE_COUNTER_WRITE_ERRORS);
+            morse_metrics_error_code(rc);
+            profile->send_offset = profile->send_length;
+            send_delivered(profile, false);
+        }
+    }
+    return blocked ? pdMS_TO_TICKS(SEND_RETRY_DELAY_MS) + 1 : portMAX_DELAY;
+#else
+    return portMAX_DELAY;
+#endif
+}
+
+/**
+ * Logs the profile's goodput and counts its answer towards the fan out, if it is an answer to this fan out.
+ */
+static void send_answer(struct ble_profile *profile, uint16_t generation, bool ok)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t elapsed = now - profile->send_start_time;
+
+    portENTER_CRITICAL(&send_all_mux);
+    // an answer from before the last fan out, send_start_time and the counts are already the new message's
+    if (generation != send_all_generation || !profile->send_pending)
+    {
+        portEXIT_CRITICAL(&send_all_mux);
+        return;
+    }
+    profile->send_pending = false;
+    send_all_done++;
+    if (ok)
+    {
+        send_all_ok++;
+    }
+    send_all_check_done(now);
+    portEXIT_CRITICAL(&send_all_mux);
+
+    if (ok && elapsed > 0)
+    {
+        morse_metrics_record(MORSE_HIST_WRITE_RTT_US, elapsed);
+        // two entries, the PHY as its BLE_GAP_LE_PHY_ value since an entry holds no strings
+        MORSE_LOG(MORSE_LOG_GOODPUT, profile->index, profile->send_length, elapsed, (int64_t)profile->send_length * 1000000 / elapsed);
+        MORSE_LOG(MORSE_LOG_GOODPUT_LINK, profile->index, profile->send_att_writes, profile->send_ll_packets, profile->tx_octets, profile->phy);
+    }
+}
+
+void send_delivered(struct ble_profile *profile, bool ok)
+{
+    send_answer(profile, profile->send_generation, ok);
+}
+
+void send_answered(void *arg, bool ok)
+{
+    uint8_t index = SEND_CB_INDEX(arg);
+
+    if (index < MORSE_PEER_MAX && ble_profiles[index])
+    {
+        send_answer(ble_profiles[index], SEND_CB_GENERATION(arg), ok);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef SEND_FUNCTIONS_H
+#define SEND_FUNCTIONS_H
+
+#include "morse_common.h"
+
+/**
+ * Writes a message to the morse characteristic of every connected server, in the fewest ATT round trips each one's
+ * MTU allows. Messages that fit in one ATT payload go out as a single write. Longer ones are split into framed
+ * chunks (see morse_proto.h) sent as write commands with only the last one acknowledged, or, with
+ * CONFIG_MORSE_CHUNKED_WRITES off, as a GATT long write.
+ * All writes are started before any is acknowledged, and chunks go out one per server in turn, so the message
+ * reaches the servers in parallel and not one after the other. The message is copied, chunks the stack has no
+ * buffer for yet are sent by send_pump().
+ * @param length the message length in bytes, at most MORSE_MESSAGE_MAX_LENGTH.
+ * @return the number of servers the message went out to.
+ */
+int send_message_all(const void *data, uint16_t length);
+
+/**
+ * Sends the chunks of the last send_message_all() the stack had no tx buffer for, one per server in turn, until
+ * it has none again. Never waits: call it from the poll event task on every wake, and wake it again when asked.
+ * A server whose stack hasn't freed a buffer after SEND_RETRY_MAX calls gets no more of the message.
+ * @return ticks until it should be called again, portMAX_DELAY if every chunk is out.
+ */
+TickType_t send_pump();
+
+/**
+ * Logs the goodput of the profile's last message: bytes, time until the final write response, ATT writes and link
+ * layer packets used. Once every server of the send_message_all() has answered, also logs how long the slowest one
+ * took. Called on a disconnect with ok false, so the fan out doesn't wait for an answer that isn't coming.
+ * A profile with no write pending does nothing.
+ * @param ok false if the server rejected the write.
+ */
+void send_delivered(struct ble_profile *profile, bool ok);
+
+/**
+ * send_delivered() for the answer to a write, from ble_gatt_write_chr_cb. An answer to the write of an older fan
+ * out, late or after a send press that didn't wait for it, is ignored.
+ * @param arg the argument the write was started with, it carries the profile and the fan out.
+ * @param ok false if the server rejected the write.
+ */
+void send_answered(void *arg, bool ok);
+
+#endif
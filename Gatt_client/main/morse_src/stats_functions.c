@@ -0,0 +1,88 @@
+#include "stats_functions.h"
+
+// reads from several servers can be in flight at once
+static uint8_t stats_buf[MORSE_PEER_MAX][MORSE_METRICS_SNAPSHOT_LENGTH];
+static uint16_t stats_len[MORSE_PEER_MAX];
+
+void stats_dump(const char *who, const morse_metrics *metrics, uint32_t uptime_s)
+{
+    ESP_LOGI(MORSE_TAG, "stats %s, up %lu s", who, (unsigned long)uptime_s);
+    for (int i = 0; i < MORSE_COUNTER_COUNT; i++)
+    {
+        if (metrics->counters[i])
+        {
+            ESP_LOGI(MORSE_TAG, "stats %s: %s %lu", who, morse_metrics_counter_name(i), (unsigned long)metrics->counters[i]);
+        }
+    }
+    for (int i = 0; i < MORSE_HIST_COUNT; i++)
+    {
+        if (metrics->histograms[i].count)
+        {
+            ESP_LOGI(MORSE_TAG, "stats %s: %s n %lu, p50 <= %lu, p90 <= %lu, max %lu", who, morse_metrics_hist_name(i),
+                     (unsigned long)metrics->histograms[i].count, (unsigned long)morse_metrics_percentile(metrics, i, 50),
+                     (unsigned long)morse_metrics_percentile(metrics, i, 90), (unsigned long)metrics->histograms[i].max);
+        }
+    }
+    for (int i = 0; i < MORSE_METRICS_ERRORS; i++)
+    {
+        if (metrics->errors[i].count)
+        {
+            ESP_LOGI(MORSE_TAG, "stats %s: error %u x %lu", who, (unsigned)metrics->errors[i].code, (unsigned long)metrics->errors[i].count);
+        }
+    }
+}
+
+void stats_dump_local()
+{
+    stats_dump("client", &morse_metrics_self, esp_timer_get_time() / 1000000);
+    // the poll event task calls this, after the sends and decodes that use the most of its stack
+    ESP_LOGI(MORSE_TAG, "stats client: poll task stack %u of %d bytes never used", (unsigned)uxTaskGetStackHighWaterMark(NULL),
+             CONFIG_MORSE_POLL_TASK_STACK);
+}
+
+static int stats_read_cb(uint16_t conn_handle, const struct ble_gatt_error *error, struct ble_gatt_attr *attr, void *arg)
+{
+    static morse_metrics server_metrics; // only logged, one at a time in the host task
+    struct ble_profile *profile = (struct ble_profile *)arg;
+    uint32_t uptime_s;
+    char who[16];
+
+    if (error->status == BLE_HS_EDONE)
+    {
+        if (morse_metrics_parse(stats_buf[profile->index], stats_len[profile->index], &server_metrics, &uptime_s) != 0)
+        {
+            ESP_LOGI(ERROR_TAG, "stats: server %u sent %u bytes in an unknown format", profile->index, stats_len[profile->index]);
+            return 0;
+        }
+        snprintf(who, sizeof(who), "server %u", profile->index);
+        stats_dump(who, &server_metrics, uptime_s);
+        return 0;
+    }
+    if (error->status != 0)
+    {
+        ESP_LOGI(ERROR_TAG, "stats read error = [handle, status] = [%d, %d]", error->att_handle, error->status);
+        return -1;
+    }
+
+    uint16_t len = OS_MBUF_PKTLEN(attr->om);
+    if (attr->offset + len > sizeof(stats_buf[0]))
+    {
+        len = (attr->offset < sizeof(stats_buf[0])) ? sizeof(stats_buf[0]) - attr->offset : 0;
+    }
+    os_mbuf_copydata(attr->om, 0, len, &stats_buf[profile->index][attr->offset]);
+    stats_len[profile->index] = attr->offset + len;
+    return 0;
+}
+
+int stats_read(struct ble_profile *profile)
+{
+    uint16_t handle = profile->characteristic[CHR_STATS].val_handle;
+
+    if (handle == 0)
+    {
+        return BLE_HS_ENOENT; // a server from before the stats characteristic
+    }
+    stats_len[profile->index] = 0;
+    // the snapshot fits in one read at the negotiated MTU, a long read also gets it through the default one
+    return ble_gattc_read_long(profile->conn_desc->conn_handle, handle, 0, stats_read_cb, profile);
+}
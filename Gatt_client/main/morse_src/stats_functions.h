@@ -0,0 +1,28 @@
+#ifndef STATS_FUNCTIONS_H
+#define STATS_FUNCTIONS_H
+
+#include "morse_common.h"
+#include "morse_metrics.h"
+
+/**
+ * Logs a set of metrics: the counters that aren't 0, the median, 90th percentile and max of every histogram with
+ * values, and the error codes seen. Percentiles are the top of their bucket, see morse_metrics.h.
+ * @param who whose metrics they are, for the log.
+ * @param uptime_s how long that board has been up.
+ */
+void stats_dump(const char *who, const morse_metrics *metrics, uint32_t uptime_s);
+
+/**
+ * Logs this client's own metrics, and the high water mark of the calling task's stack, the poll event task's.
+ */
+void stats_dump_local();
+
+/**
+ * Reads the server's metrics snapshot from its stats characteristic and logs it once it is in.
+ * @param profile the server connection, discovery must be done.
+ * @return 0 if the read was started, BLE_HS_ENOENT if the server has no stats characteristic, another BLE_HS_E*
+ * error otherwise.
+ */
+int stats_read(struct ble_profile *profile);
+
+#endif
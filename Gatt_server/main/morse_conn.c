@@ -0,0 +1,73 @@
+#include <string.h>
+#include "morse_conn.h"
+
+static struct morse_conn morse_conns[MORSE_CONN_MAX];
+
+void
+morse_conn_init(void)
+{
+    for (int i = 0; i < MORSE_CONN_MAX; i++) {
+        memset(&morse_conns[i], 0, sizeof(morse_conns[i]));
+        morse_conns[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    }
+}
+
+struct morse_conn *
+morse_conn_add(uint16_t conn_handle)
+{
+    struct morse_conn *conn = morse_conn_find(BLE_HS_CONN_HANDLE_NONE);
+
+    if (!conn) {
+        return NULL;
+    }
+    memset(conn, 0, sizeof(*conn));
+    conn->conn_handle = conn_handle;
+    return conn;
+}
+
+struct morse_conn *
+morse_conn_find(uint16_t conn_handle)
+{
+    /* a handful of slots, a search is cheaper than keeping an index */
+    for (int i = 0; i < MORSE_CONN_MAX; i++) {
+        if (morse_conns[i].conn_handle == conn_handle) {
+            return &morse_conns[i];
+        }
+    }
+    return NULL;
+}
+
+void
+morse_conn_remove(uint16_t conn_handle)
+{
+    struct morse_conn *conn = morse_conn_find(conn_handle);
+
+    if (!conn) {
+        return;
+    }
+    mbuf_drop_pending(&conn->pending);
+    memset(conn, 0, sizeof(*conn));
+    conn->conn_handle = BLE_HS_CONN_HANDLE_NONE;
+}
+
+int
+morse_conn_count(void)
+{
+    int count = 0;
+
+    for (int i = 0; i < MORSE_CONN_MAX; i++) {
+        if (morse_conns[i].conn_handle != BLE_HS_CONN_HANDLE_NONE) {
+            count++;
+        }
+    }
+    return count;
+}
+
+struct morse_conn *
+morse_conn_get(int index)
+{
+    if (index < 0 || index >= MORSE_CONN_MAX || morse_conns[index].conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+        return NULL;
+    }
+    return &morse_conns[index];
+}
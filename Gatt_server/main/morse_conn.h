@@ -0,0 +1,59 @@
+#ifndef MORSE_CONN_H
+#define MORSE_CONN_H
+
+#include <stdbool.h>
+#include "host/ble_hs.h"
+#include "sdkconfig.h"
+#include "morse_mbuf.h"
+
+/* clients connected at once, as many as NimBLE is configured for */
+#define MORSE_CONN_MAX CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+
+/* what the server keeps per connected client */
+struct morse_conn {
+    uint16_t conn_handle;         /* BLE_HS_CONN_HANDLE_NONE for a free slot */
+    bool notify;                  /* what the client asked for in the morse characteristic's CCCD */
+    bool indicate;
+    uint32_t history_since;       /* last sequence number the client has, written to the history characteristic */
+    uint16_t history_offset;      /* and how much of the message after it, when that one comes in pieces */
+    struct mbuf_pending pending;  /* message being reassembled from this client's chunks */
+    uint32_t messages;            /* messages stored from this client since the last report */
+    uint32_t bytes;
+};
+
+/**
+ * Frees every slot. Call once before advertising.
+ */
+void morse_conn_init(void);
+
+/**
+ * Takes a free slot for a new connection.
+ *
+ * @return the slot, NULL if all MORSE_CONN_MAX are taken.
+ */
+struct morse_conn *morse_conn_add(uint16_t conn_handle);
+
+/**
+ * @return the slot of conn_handle, NULL if it isn't connected.
+ */
+struct morse_conn *morse_conn_find(uint16_t conn_handle);
+
+/**
+ * Frees the slot of conn_handle and drops its half reassembled message.
+ */
+void morse_conn_remove(uint16_t conn_handle);
+
+/**
+ * @return the number of connected clients.
+ */
+int morse_conn_count(void);
+
+/**
+ * Walks the connected clients.
+ *
+ * @param index 0 up to MORSE_CONN_MAX - 1.
+ * @return the slot at index, NULL if it is free.
+ */
+struct morse_conn *morse_conn_get(int index);
+
+#endif
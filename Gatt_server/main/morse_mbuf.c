@@ -1,12 +1,19 @@
 #include "morse_mbuf.h"
+#include "morse_proto.h"
+#include "morse_metrics.h"
+#include "morse_log.h"
 #include "esp_log.h"
+#include "esp_random.h"
+#include "sdkconfig.h"
 
 #define MBUF_PKTHDR_OURUSER     0
 #define MBUF_PKTHDR_OVERHEAD    sizeof(struct os_mbuf_pkthdr) + MBUF_PKTHDR_OURUSER // replace ouruser header with sizeof when/if we use actual header
 #define MBUF_MEMBLOCK_OVERHEAD  sizeof(struct os_mbuf) + MBUF_PKTHDR_OVERHEAD
 
-#define MBUF_NUM_MBUFS      (8)
 #define MBUF_PAYLOAD_SIZE   (64)
+#define MBUF_MESSAGE_BLOCKS (MORSE_MESSAGE_MAX_LENGTH / MBUF_PAYLOAD_SIZE + 1)
+// room for several stored messages plus a MORSE_MESSAGE_MAX_LENGTH one being reassembled per connection
+#define MBUF_NUM_MBUFS      (32 + MBUF_MESSAGE_BLOCKS * CONFIG_BT_NIMBLE_MAX_CONNECTIONS)
 #define MBUF_BUF_SIZE       OS_ALIGN(MBUF_PAYLOAD_SIZE, 4)
 #define MBUF_MEMBLOCK_SIZE  (MBUF_BUF_SIZE + MBUF_MEMBLOCK_OVERHEAD)
 #define MBUF_MEMPOOL_SIZE   OS_MEMPOOL_SIZE(MBUF_NUM_MBUFS, MBUF_MEMBLOCK_SIZE)
@@ -16,7 +23,15 @@
 struct os_mbuf_pool g_mbuf_pool;
 struct os_mempool g_mbuf_mempool;
 os_membuf_t g_mbuf_buffer[MBUF_MEMPOOL_SIZE];
-static struct os_mbuf *morse_data_buf;
+/* ring of the last MBUF_SLOT_COUNT messages, oldest at mbuf_slot_oldest */
+static struct mbuf_slot {
+    struct os_mbuf *om;
+    uint32_t seq;
+} mbuf_slots[MBUF_SLOT_COUNT];
+static uint8_t mbuf_slot_oldest;
+static uint8_t mbuf_slot_count;
+static uint32_t mbuf_next_seq = 1;          // 0 is never used, so "since 0" means everything
+static uint32_t mbuf_epoch_value;           // drawn in mbuf_create_pool(), the sequence numbers above restart with it
 
 void
 mbuf_create_pool()
@@ -30,36 +45,171 @@ mbuf_create_pool()
     rc = os_mbuf_pool_init(&g_mbuf_pool, &g_mbuf_mempool, MBUF_MEMBLOCK_SIZE,
                            MBUF_NUM_MBUFS);
     assert(rc == 0);
+
+    /* 0 is what a client that never saw this server has */
+    do {
+        mbuf_epoch_value = esp_random();
+    } while (mbuf_epoch_value == 0);
+}
+
+/**
+ * Free the oldest stored message.
+ *
+ * @return 0 on success, -1 if nothing is stored.
+ */
+static int
+mbuf_evict_oldest()
+{
+    if (mbuf_slot_count == 0) {
+        return -1;
+    }
+    os_mbuf_free_chain(mbuf_slots[mbuf_slot_oldest].om);
+    mbuf_slots[mbuf_slot_oldest].om = NULL;
+    morse_metrics_count(MORSE_COUNTER_EVICTED);
+    mbuf_slot_oldest = (mbuf_slot_oldest + 1) % MBUF_SLOT_COUNT;
+    mbuf_slot_count--;
+    return 0;
+}
+
+/**
+ * Evict stored messages, oldest first, until the pool has room for length more bytes.
+ *
+ * @return 0 on success, -1 if the pool can't hold length bytes even when empty.
+ */
+static int
+mbuf_reserve(int length)
+{
+    /* one block per MBUF_BUF_SIZE bytes, plus one for the packet header / partly filled tail */
+    int blocks = (length + MBUF_BUF_SIZE - 1) / MBUF_BUF_SIZE + 1;
+
+    while (g_mbuf_mempool.mp_num_free < blocks) {
+        if (mbuf_evict_oldest() != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Add a complete message to the ring as the newest slot, evicting the oldest if the ring is full.
+ */
+static void
+mbuf_slot_push(struct os_mbuf *om)
+{
+    if (mbuf_slot_count == MBUF_SLOT_COUNT) {
+        mbuf_evict_oldest();
+    }
+    mbuf_slots[(mbuf_slot_oldest + mbuf_slot_count) % MBUF_SLOT_COUNT] = (struct mbuf_slot){
+        .om = om,
+        .seq = mbuf_next_seq++,
+    };
+    mbuf_slot_count++;
+    morse_metrics_count(MORSE_COUNTER_STORED);
+    morse_metrics_record(MORSE_HIST_MBUF_BLOCKS, MBUF_NUM_MBUFS - g_mbuf_mempool.mp_num_free);
 }
 
 struct os_mbuf *
 mbuf_return_mbuf() {
-    return morse_data_buf;
+    return mbuf_get_by_index(0, NULL);
 };
 
+int
+mbuf_count()
+{
+    return mbuf_slot_count;
+}
+
+uint32_t
+mbuf_latest_seq()
+{
+    return mbuf_next_seq - 1;
+}
+
+uint32_t
+mbuf_epoch()
+{
+    return mbuf_epoch_value;
+}
+
+struct os_mbuf *
+mbuf_get_by_index(int index, uint32_t *seq)
+{
+    struct mbuf_slot *slot;
+
+    if (index < 0 || index >= mbuf_slot_count) {
+        return NULL;
+    }
+    /* index 0 is the newest */
+    slot = &mbuf_slots[(mbuf_slot_oldest + mbuf_slot_count - 1 - index) % MBUF_SLOT_COUNT];
+    if (seq) {
+        *seq = slot->seq;
+    }
+    return slot->om;
+}
+
+int
+mbuf_append_since(uint32_t since_seq, int offset, struct os_mbuf *om, int max_length)
+{
+    int appended = 0;
+    int length = 0;
+    uint8_t header[MORSE_HISTORY_HEADER_LENGTH];
+
+    for (int i = 0; i < mbuf_slot_count; i++) {
+        struct mbuf_slot *slot = &mbuf_slots[(mbuf_slot_oldest + i) % MBUF_SLOT_COUNT];
+        int msg_length = OS_MBUF_PKTLEN(slot->om);
+        int start = 0;
+        int more = 0;
+
+        if (slot->seq <= since_seq) {
+            continue;
+        }
+        /* the rest of a message the last read ended part way through, if it is still stored */
+        if (slot->seq == since_seq + 1 && offset < msg_length) {
+            start = offset;
+        }
+        /* whole messages only, the client asks again from the last sequence it got */
+        if (length + MORSE_HISTORY_HEADER_LENGTH + msg_length - start > max_length) {
+            if (appended != 0) {
+                break;
+            }
+            /* a message bigger than one read on its own goes in pieces, the client asks for the next one */
+            more = MORSE_HISTORY_MORE;
+            msg_length = start + max_length - MORSE_HISTORY_HEADER_LENGTH;
+        }
+        MORSE_HISTORY_HEADER_PUT(header, slot->seq, (msg_length - start) | more);
+        if (os_mbuf_append(om, header, sizeof(header)) != 0 ||
+            os_mbuf_appendfrom(om, slot->om, start, msg_length - start) != 0) {
+            return -1;
+        }
+        length += MORSE_HISTORY_HEADER_LENGTH + msg_length - start;
+        appended++;
+        if (more) {
+            break;
+        }
+    }
+    return appended;
+}
+
 int
 mbuf_store(const void *mydata, int mydata_length)
 {
     int rc;
     struct os_mbuf *om;
-    uint8_t *src = mydata; // source pointer, typecast to uint8_t to allow char* as input
+    const uint8_t *src = mydata; // source pointer, typecast to uint8_t to allow char* as input
 
-    /* check that the data is not too large for our pool */
-    if (mydata_length + MBUF_MEMBLOCK_OVERHEAD > MBUF_MEMPOOL_SIZE) {
+    /* make room, evicting the oldest messages. Fails only if the message is larger than the whole pool */
+    if (mbuf_reserve(mydata_length) != 0) {
         /* Error! Would not be able to allocate enough mbufs for total packet length */
         ESP_LOGI(GATTS_TAG, "Huge Packet Detected! Would not be able to allocate enough mbufs for total packet length");
+        morse_metrics_count(MORSE_COUNTER_STORE_FAILED);
         return -1;
     }
 
-    /* free up the space of the last mbuf now that we have successfully created the new one, assuming the last mbuf exists */
-    if (morse_data_buf) {
-        os_mbuf_free(morse_data_buf);
-    }
-    
     /* get a packet header mbuf */
     om = os_mbuf_get_pkthdr(&g_mbuf_pool, MBUF_PKTHDR_OURUSER);
     if (!om) {
         ESP_LOGI(GATTS_TAG, "om pointer failed for creating a mbuf");
+        morse_metrics_count(MORSE_COUNTER_STORE_FAILED);
         return -1;
     }
     /*
@@ -71,12 +221,85 @@ mbuf_store(const void *mydata, int mydata_length)
     if (rc) {
         /* Error! Could not allocate enough mbufs for total packet length */
         ESP_LOGI(GATTS_TAG, "Could not allocate enough mbufs for total packet length");
+        os_mbuf_free_chain(om);
+        morse_metrics_count(MORSE_COUNTER_STORE_FAILED);
+        return -1;
+    }
+
+    mbuf_slot_push(om);
+    return 0;
+}
+
+void
+mbuf_drop_pending(struct mbuf_pending *pending)
+{
+    if (pending->om) {
+        os_mbuf_free_chain(pending->om);
+        pending->om = NULL;
+    }
+}
+
+int
+mbuf_store_chunk(struct mbuf_pending *pending, const void *chunk, int chunk_length)
+{
+    int rc;
+    const uint8_t *src = chunk;
+    uint8_t header;
+    uint8_t seq;
+
+    if (chunk_length < MORSE_CHUNK_HEADER_LENGTH) {
+        return -1;
+    }
+    header = src[0];
+    seq = header & MORSE_CHUNK_SEQ_MASK;
+
+    if (header & MORSE_CHUNK_FIRST) {
+        /* a new message replaces one that never got its last chunk */
+        mbuf_drop_pending(pending);
+        if (mbuf_reserve(chunk_length) != 0) {
+            morse_metrics_count(MORSE_COUNTER_STORE_FAILED);
+            return -1;
+        }
+        pending->om = os_mbuf_get_pkthdr(&g_mbuf_pool, MBUF_PKTHDR_OURUSER);
+        if (!pending->om) {
+            ESP_LOGI(GATTS_TAG, "om pointer failed for creating a mbuf");
+            morse_metrics_count(MORSE_COUNTER_STORE_FAILED);
+            return -1;
+        }
+    } else if (!pending->om || seq != ((pending->seq + 1) & MORSE_CHUNK_SEQ_MASK)) {
+        /* chunk lost or out of order, the message can't be rebuilt */
+        MORSE_LOG(MORSE_LOG_SERVER_CHUNK_SEQ, seq);
+        mbuf_drop_pending(pending);
+        morse_metrics_count(MORSE_COUNTER_CHUNKS_DROPPED);
+        return -1;
+    }
+    pending->seq = seq;
+
+    if (OS_MBUF_PKTLEN(pending->om) + chunk_length - MORSE_CHUNK_HEADER_LENGTH > MORSE_MESSAGE_MAX_LENGTH) {
+        ESP_LOGI(GATTS_TAG, "Huge Packet Detected! Message exceeds %d bytes", MORSE_MESSAGE_MAX_LENGTH);
+        mbuf_drop_pending(pending);
+        morse_metrics_count(MORSE_COUNTER_STORE_FAILED);
+        return -1;
+    }
+
+    /* older messages make way for the one arriving */
+    if (mbuf_reserve(chunk_length) != 0) {
+        mbuf_drop_pending(pending);
+        morse_metrics_count(MORSE_COUNTER_STORE_FAILED);
+        return -1;
+    }
+    rc = os_mbuf_append(pending->om, &src[MORSE_CHUNK_HEADER_LENGTH], chunk_length - MORSE_CHUNK_HEADER_LENGTH);
+    if (rc) {
+        ESP_LOGI(GATTS_TAG, "Could not allocate enough mbufs for total packet length");
+        mbuf_drop_pending(pending);
+        morse_metrics_count(MORSE_COUNTER_STORE_FAILED);
         return -1;
     }
 
-    /* if mbuf creation and copy is successfull, then reassign morse_data_buf */
-    morse_data_buf = om;
+    if (header & MORSE_CHUNK_LAST) {
+        /* message complete, it becomes the newest slot */
+        mbuf_slot_push(pending->om);
+        pending->om = NULL;
+    }
     return 0;
-    // /* Send packet to networking interface */
-    // send_pkt(om);
-}
\ No newline at end of file
+}
@@ -4,9 +4,19 @@
 #include <stdio.h>
 #include <os/os_mbuf.h>
 
+/* number of messages kept, oldest evicted first */
+#define MBUF_SLOT_COUNT 8
+
+/* a message being reassembled from chunks, one per connection */
+struct mbuf_pending {
+    struct os_mbuf *om;  /* NULL until the first chunk */
+    uint8_t seq;         /* sequence number of the last chunk appended */
+};
+
 /**
  * Create a singular mbuf pool. Current implementation is limited
- * and only supports one mempool at a time.
+ * and only supports one mempool at a time. Also draws the epoch of this boot.
+ * Call once at boot, the stored messages and the ones being reassembled live in the pool.
  * 
  * @return  
  * 
@@ -15,19 +25,69 @@
 void mbuf_create_pool();
 
 /**
- * Return a pointer to the memory buffer created in the morse_mbuf.c source file.
+ * Return a pointer to the newest message stored in the morse_mbuf.c source file.
  * 
- * @return  A pointer to the mbuf.
+ * @return  A pointer to the mbuf, NULL if nothing is stored.
  */
 struct os_mbuf *mbuf_return_mbuf();
 
 /**
- * Store the data at the given location and length into the mempool. 
- * Reassign the mbuf to the new membuf location.
- * Free up old memory.
+ * @return the number of messages stored, at most MBUF_SLOT_COUNT.
+ */
+int mbuf_count();
+
+/**
+ * @return the sequence number of the newest message, 0 if nothing was ever stored.
+ */
+uint32_t mbuf_latest_seq();
+
+/**
+ * @return the random, non-zero epoch of this boot, sent ahead of the history so clients notice the sequence
+ * numbers started again.
+ */
+uint32_t mbuf_epoch();
+
+/**
+ * Return a stored message by age.
+ *
+ * @param index 0 for the newest message, up to mbuf_count() - 1 for the oldest.
+ * @param seq receives the sequence number of the message, may be NULL.
+ * @return  A pointer to the mbuf, NULL if index is out of range.
+ */
+struct os_mbuf *mbuf_get_by_index(int index, uint32_t *seq);
+
+/**
+ * Append every stored message newer than since_seq to om, oldest first, each behind a history header
+ * (see morse_proto.h). Stops before the first message that would take om past max_length. A first message
+ * longer than that on its own is appended in part, with MORSE_HISTORY_MORE set.
+ *
+ * @param offset where message since_seq + 1 starts, the part an earlier read returned is skipped.
+ * @return the number of messages appended, negative on failure.
+ */
+int mbuf_append_since(uint32_t since_seq, int offset, struct os_mbuf *om, int max_length);
+
+/**
+ * Store the data at the given location and length into the mempool as the newest message
+ * with the next sequence number. 
+ * If the ring or the pool is full the oldest messages are freed to make room.
  * 
  * @return 0 on success, non-zero on failure.
  */
 int mbuf_store(const void *mydata, int mydata_length);
 
+/**
+ * Add one framed chunk (see morse_proto.h) to the message being reassembled.
+ * When the last chunk arrives the whole message is stored, as mbuf_store() would.
+ * A chunk out of sequence drops the partial message.
+ *
+ * @param pending the message of the connection the chunk came from.
+ * @return 0 on success, non-zero on failure.
+ */
+int mbuf_store_chunk(struct mbuf_pending *pending, const void *chunk, int chunk_length);
+
+/**
+ * Drop a message being reassembled, if any. For connections that go away half way through one.
+ */
+void mbuf_drop_pending(struct mbuf_pending *pending);
+
 #endif
\ No newline at end of file
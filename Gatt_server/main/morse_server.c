@@ -7,6 +7,7 @@
 #include "esp_event.h"
 #include "nvs_flash.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "esp_nimble_hci.h"
 #include "nimble/nimble_port.h"
@@ -16,17 +17,28 @@
 #include "services/gatt/ble_svc_gatt.h"
 #include "sdkconfig.h"
 #include "morse_mbuf.h"
+#include "morse_conn.h"
+#include "morse_proto.h"
+#include "morse_wire.h"
+#include "morse_link.h"
+#include "morse_metrics.h"
+#include "morse_log.h"
 
 
 #define GATTS_TAG "BLE-Server"
 #define ERROR_TAG "||| ERROR |||"
-static uint8_t white_list_count = 1;
+static uint8_t white_list_count = MORSE_CONN_MAX;
+
+// largest link layer payload, requested with data length extension on connect. Its air time depends on the PHY,
+// MORSE_LINK_TX_TIME_MAX in morse_link.h.
+#define LINK_TX_OCTETS_MAX 251
 
 static const ble_addr_t serverAddr = {
     .type = BLE_ADDR_RANDOM, // Example type value
-    .val = {0xDE, 0xCA, 0xFB, 0xEE, 0xFE, 0xD2}
+    .val = {0xDE + CONFIG_MORSE_SERVER_ID, 0xCA, 0xFB, 0xEE, 0xFE, 0xD2}
     };
 
+// the first client, the others add their CONFIG_MORSE_CLIENT_ID to the first byte
 static const ble_addr_t clientAddr = {
     .type = BLE_ADDR_RANDOM, // Example type value
     .val = {0xCA, 0xFF, 0xED, 0xBE, 0xEE, 0xEF}
@@ -35,6 +47,10 @@ static const ble_addr_t clientAddr = {
 static const ble_addr_t *serverPtr = &serverAddr;
 static const ble_addr_t *clientPtr = &clientAddr;
 
+#if CONFIG_MORSE_SERVER_REPORT_S
+static struct ble_npl_callout report_callout; // prints the message throughput every CONFIG_MORSE_SERVER_REPORT_S
+#endif
+
 // old 16 bits
 // #define SERVICE_UUID 0xCAFE
 // #define READ_UUID 0xCAFF
@@ -46,6 +62,81 @@ static const ble_addr_t *clientPtr = &clientAddr;
 
 void ble_app_advertise(void);
 
+static uint16_t morse_val_handle; // filled in by ble_gatts_add_svcs, matched against subscribe events
+
+/**
+ * Pushes the newest stored message to one subscribed client.
+ * Notifications are preferred, indications are only used when the client asked for nothing else.
+ */
+static void morse_push_latest_to(const struct morse_conn *conn, struct os_mbuf *msg)
+{
+    struct os_mbuf *om;
+    uint8_t header[MORSE_HISTORY_HEADER_LENGTH];
+    int length;
+    int room;
+    int rc;
+
+    if (!conn->notify && !conn->indicate) {
+        return;
+    }
+
+    // as much of the message as one packet holds, the client reads the rest if the header says there is more
+    length = OS_MBUF_PKTLEN(msg);
+    room = ble_att_mtu(conn->conn_handle) - MORSE_ATT_NOTIFY_OVERHEAD - MORSE_HISTORY_HEADER_LENGTH;
+    if (room < 0) {
+        room = 0;
+    }
+
+    om = ble_hs_mbuf_att_pkt();
+    if (!om) {
+        ESP_LOGI(GATTS_TAG, "no mbuf for the notification");
+        return;
+    }
+    MORSE_HISTORY_HEADER_PUT(header, mbuf_latest_seq(), length);
+    if (os_mbuf_append(om, header, sizeof(header)) != 0 ||
+        os_mbuf_appendfrom(om, msg, 0, length < room ? length : room) != 0) {
+        os_mbuf_free_chain(om);
+        ESP_LOGI(GATTS_TAG, "notification too large for the mbuf pool");
+        return;
+    }
+
+    // both consume om, also on error
+    if (conn->notify) {
+        rc = ble_gatts_notify_custom(conn->conn_handle, morse_val_handle, om);
+    } else {
+        rc = ble_gatts_indicate_custom(conn->conn_handle, morse_val_handle, om);
+    }
+    if (rc != 0) {
+        morse_metrics_count(MORSE_COUNTER_PUSH_FAILED);
+        morse_metrics_error_code(rc);
+        MORSE_LOG(MORSE_LOG_SERVER_PUSH_FAILED, mbuf_latest_seq(), conn->conn_handle, rc);
+    }
+}
+
+/**
+ * A message was stored. Counts it for the writer, and pushes it to every subscribed client: the writer gets it as
+ * the ack for its write, the others so they never have to read.
+ */
+static void morse_push_latest(uint16_t conn_handle)
+{
+    struct os_mbuf *msg = mbuf_return_mbuf();
+    struct morse_conn *writer = morse_conn_find(conn_handle);
+
+    if (!msg) {
+        return;
+    }
+    if (writer) {
+        writer->messages++;
+        writer->bytes += OS_MBUF_PKTLEN(msg);
+    }
+    for (int i = 0; i < MORSE_CONN_MAX; i++) {
+        struct morse_conn *conn = morse_conn_get(i);
+        if (conn) {
+            morse_push_latest_to(conn, msg);
+        }
+    }
+}
+
 // Read or write data from ESP32 defined as server
 static int device_morse(uint16_t con_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
 {
@@ -53,42 +144,80 @@ static int device_morse(uint16_t con_handle, uint16_t attr_handle, struct ble_ga
     switch(ctxt->op) {
         case BLE_GATT_ACCESS_OP_READ_CHR: {
             //os_mbuf_append(ctxt->om, "Data from the server", strlen("Data from the server"));
-            // rc = os_mbuf_copydata(morse_data_buf, 0, morse_data_buf->om_len, ctxt->om);
             struct os_mbuf *morse_data_buf = mbuf_return_mbuf();
+            if (!morse_data_buf) {
+                return 0; // nothing stored, empty value
+            }
 
-            rc = os_mbuf_append(ctxt->om, morse_data_buf->om_data, morse_data_buf->om_len);
-            printf("Data requested by client: %.*s\n", morse_data_buf->om_len, morse_data_buf->om_data);
-
-            // 11/3/24 mbuf testing to print longer values
-            // uint8_t count = 1;
-            // ESP_LOGI(GATTS_TAG, "Data requested by client: ");
-            // do {
-            //     rc = os_mbuf_append(ctxt->om, morse_data_buf->om_data, morse_data_buf->om_len);
-            //     if(rc != 0) {
-            //         ESP_LOGE(ERROR_TAG, "os_mbuf append error on line %d, err = %d", __LINE__, rc);
-            //         break;
-            //     }
-            //     ESP_LOGI(ERROR_TAG, "count %d", count++);
-            //     ESP_LOGI(GATTS_TAG, "%.*s", morse_data_buf->om_len, morse_data_buf->om_data);
-            //     morse_data_buf = morse_data_buf->om_next.sle_next;
-            // } while(morse_data_buf->om_next.sle_next != NULL);
-            // printf("\n");
-            
-            return rc;
+            /*
+            Copy the whole chain mbuf to mbuf, with no flat buffer in between. NimBLE applies the ATT offset of read
+            blob requests itself by trimming what we append, so every call returns the full value.
+            The stored chain can't be handed over by reference, os_mbufs have no reference count and the stack frees ctxt->om.
+            */
+            rc = os_mbuf_appendfrom(ctxt->om, morse_data_buf, 0, OS_MBUF_PKTLEN(morse_data_buf));
+            if (rc != 0) {
+                ESP_LOGE(ERROR_TAG, "os_mbuf_appendfrom error on line %d, err = %d", __LINE__, rc);
+                return BLE_ATT_ERR_INSUFFICIENT_RES;
+            }
+            MORSE_LOG(MORSE_LOG_SERVER_READ, con_handle, OS_MBUF_PKTLEN(morse_data_buf));
+            return 0;
         }
         case BLE_GATT_ACCESS_OP_WRITE_CHR: {
-            printf("Data from the client: %.*s\n", ctxt->om->om_len, ctxt->om->om_data);
+            // long writes and large MTUs arrive as a chain of mbufs, flatten the whole chain
+            static uint8_t write_buf[BLE_ATT_ATTR_MAX_LEN];
+            uint16_t write_len;
+            rc = ble_hs_mbuf_to_flat(ctxt->om, write_buf, sizeof(write_buf), &write_len);
+            if (rc != 0) {
+                ESP_LOGI(GATTS_TAG, "write too long for write_buf, error %d", rc);
+                return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+            }
+
+            if (write_len > 0 && MORSE_IS_CHUNK(write_buf[0])) {
+                // one piece of a message longer than the MTU, reassembled per client since several can be sending at once
+                struct morse_conn *conn = morse_conn_find(con_handle);
+                if (!conn) {
+                    return BLE_ATT_ERR_UNLIKELY;
+                }
+                rc = mbuf_store_chunk(&conn->pending, write_buf, write_len);
+                if (rc != 0) {
+                    ESP_LOGI(GATTS_TAG, "mbuf_store_chunk failed, error %d", rc);
+                    return BLE_ATT_ERR_UNLIKELY;
+                }
+                if (write_buf[0] & MORSE_CHUNK_LAST) {
+                    MORSE_LOG(MORSE_LOG_SERVER_CHUNKED, mbuf_latest_seq(), OS_MBUF_PKTLEN(mbuf_return_mbuf()));
+                    morse_push_latest(con_handle);
+                }
+                return 0;
+            }
+
+            if (write_len > 0 && MORSE_IS_WIRE(write_buf[0])) {
+                // packed message, stored packed so reads and notifications stay small. Unpacked to check it.
+                static char text[MORSE_WIRE_TEXT_MAX_LENGTH(BLE_ATT_ATTR_MAX_LEN)];
+                uint8_t seq;
+                int text_len = morse_wire_decode(write_buf, write_len, text, sizeof(text), &seq);
+                if (text_len < 0) {
+                    ESP_LOGI(GATTS_TAG, "malformed frame of %u bytes", write_len);
+                    return BLE_ATT_ERR_UNLIKELY;
+                }
+                MORSE_LOG(MORSE_LOG_SERVER_FRAME, con_handle, write_len, seq, text_len);
+                // the text goes through the uart only at debug level, the history characteristic has it
+                ESP_LOGD(GATTS_TAG, "message %u: %.*s", seq, text_len, text);
+            } else {
+                MORSE_LOG(MORSE_LOG_SERVER_PLAIN, con_handle, write_len);
+                ESP_LOGD(GATTS_TAG, "message: %.*s", write_len, write_buf);
+            }
             // rc = os_mbuf_copyinto(morse_data_buf, 0, ctxt->om->om_data, ctxt->om->om_len);
-            rc = mbuf_store(ctxt->om->om_data, ctxt->om->om_len);
+            rc = mbuf_store(write_buf, write_len);
             if (rc != 0) {
                 ESP_LOGI(GATTS_TAG, "mbuf_store failed, error %d", rc);
                 return rc;
             }
-            ESP_LOGI(GATTS_TAG, "mbuf_store successful");
+            MORSE_LOG(MORSE_LOG_SERVER_STORED, mbuf_latest_seq(), write_len);
+            morse_push_latest(con_handle);
             return rc;
         }
         default: {
-            printf("Bad Op: %u\n", ctxt->op);
+            MORSE_LOG(MORSE_LOG_SERVER_BAD_OP, ctxt->op);
             return ctxt->op; // this shouldn't ever come up in our usages.
         }
     }
@@ -97,21 +226,140 @@ static int device_morse(uint16_t con_handle, uint16_t attr_handle, struct ble_ga
     return 0;
 }
 
+// Catch up on stored messages. Write the last sequence number seen, then read everything after it.
+static int device_history(uint16_t con_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    struct morse_conn *conn = morse_conn_find(con_handle);
+    int rc;
+
+    if (!conn) {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+    switch(ctxt->op) {
+        case BLE_GATT_ACCESS_OP_READ_CHR: {
+            uint8_t epoch[MORSE_HISTORY_EPOCH_LENGTH];
+            uint32_t value = mbuf_epoch();
+
+            epoch[0] = value;
+            epoch[1] = value >> 8;
+            epoch[2] = value >> 16;
+            epoch[3] = value >> 24;
+            if (os_mbuf_append(ctxt->om, epoch, sizeof(epoch)) != 0) {
+                return BLE_ATT_ERR_INSUFFICIENT_RES;
+            }
+            // one read returns at most an attribute's worth, the client asks again from the last sequence it got
+            rc = mbuf_append_since(conn->history_since, conn->history_offset, ctxt->om, BLE_ATT_ATTR_MAX_LEN - sizeof(epoch));
+            if (rc < 0) {
+                return BLE_ATT_ERR_INSUFFICIENT_RES;
+            }
+            MORSE_LOG(MORSE_LOG_SERVER_HISTORY, con_handle, conn->history_since, rc);
+            return 0;
+        }
+        case BLE_GATT_ACCESS_OP_WRITE_CHR: {
+            uint8_t since[MORSE_HISTORY_SINCE_LENGTH + MORSE_HISTORY_OFFSET_LENGTH];
+            int len = OS_MBUF_PKTLEN(ctxt->om);
+            if (len != MORSE_HISTORY_SINCE_LENGTH && len != sizeof(since)) {
+                return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+            }
+            os_mbuf_copydata(ctxt->om, 0, len, since);
+            conn->history_since = MORSE_GET_LE32(since);
+            conn->history_offset = (len == sizeof(since)) ? MORSE_GET_LE16(&since[MORSE_HISTORY_SINCE_LENGTH]) : 0;
+            return 0;
+        }
+        default: {
+            MORSE_LOG(MORSE_LOG_SERVER_BAD_OP, ctxt->op);
+            return ctxt->op; // this shouldn't ever come up in our usages.
+        }
+    }
+}
+
+// The metrics snapshot, see morse_metrics.h. Built on every read, at the negotiated MTU it fits in one read response.
+static int device_stats(uint16_t con_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    static uint8_t snapshot[MORSE_METRICS_SNAPSHOT_LENGTH];
+    int length;
+
+    if (ctxt->op != BLE_GATT_ACCESS_OP_READ_CHR) {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+    length = morse_metrics_snapshot(&morse_metrics_self, esp_timer_get_time() / 1000000, snapshot);
+    if (os_mbuf_append(ctxt->om, snapshot, length) != 0) {
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+    return 0;
+}
+
 // Array of pointers to other service definitions
 // UUID - Universal Unique Identifier
 static const struct ble_gatt_svc_def gatt_svcs[] = {
     {.type = BLE_GATT_SVC_TYPE_PRIMARY,
-     .uuid = BLE_UUID128_DECLARE(0xFE, 0xCA, 0xFE, 0xCA, 0xFE, 0xCA, 0xFE, 0xCA, 0xFE, 0xCA, 0xFE, 0xCA, 0xFE, 0xCA, 0xFE, 0xCA), // Define UUID for device type
+     .uuid = BLE_UUID128_DECLARE(MORSE_SVC_UUID128), // Define UUID for device type
      .characteristics = (struct ble_gatt_chr_def[]){
-         {.uuid = BLE_UUID128_DECLARE(0xFF, 0xCA, 0xFF, 0xCA, 0xFF, 0xCA, 0xFF, 0xCA, 0xFF, 0xCA, 0xFF, 0xCA, 0xFF, 0xCA, 0xFF, 0xCA), // Define UUID for reading
-          .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
+         {.uuid = BLE_UUID128_DECLARE(MORSE_CHR_UUID128), // Define UUID for reading
+          .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP // write without response carries chunks
+                   | BLE_GATT_CHR_F_NOTIFY | BLE_GATT_CHR_F_INDICATE, // stored messages are pushed to subscribers
+          .val_handle = &morse_val_handle,
           .access_cb = device_morse},
+         {.uuid = BLE_UUID128_DECLARE(MORSE_HISTORY_UUID128), // Define UUID for catching up on stored messages
+          .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
+          .access_cb = device_history},
+         {.uuid = BLE_UUID128_DECLARE(MORSE_STATS_UUID128), // Define UUID for the metrics snapshot
+          .flags = BLE_GATT_CHR_F_READ,
+          .access_cb = device_stats},
          {0}}},
     {0}}; // remember that .type of 0 is BLE_GATT_SVC_TYPE_END, so we initialize everything to 0.
 
+/**
+ * Keeps advertising while there is a free slot for another client. Advertising stops on every connection.
+ */
+static void morse_advertise_if_free(void)
+{
+    if (morse_conn_count() < MORSE_CONN_MAX && !ble_gap_adv_active()) {
+        ble_app_advertise();
+    }
+}
+
+#if CONFIG_MORSE_SERVER_REPORT_S
+/**
+ * Prints how many messages each client stored since the last report and the total, then starts over.
+ * Runs in the host task, like the gap events.
+ */
+static void morse_report(struct ble_npl_event *ev)
+{
+    uint32_t messages = 0;
+    uint32_t bytes = 0;
+
+    for (int i = 0; i < MORSE_CONN_MAX; i++) {
+        struct morse_conn *conn = morse_conn_get(i);
+        if (!conn) {
+            continue;
+        }
+        if (conn->messages) {
+            ESP_LOGI(GATTS_TAG, "client %u: %lu messages in %d s, %lu bytes/s", conn->conn_handle, (unsigned long)conn->messages,
+                     CONFIG_MORSE_SERVER_REPORT_S, (unsigned long)(conn->bytes / CONFIG_MORSE_SERVER_REPORT_S));
+        }
+        messages += conn->messages;
+        bytes += conn->bytes;
+        conn->messages = 0;
+        conn->bytes = 0;
+    }
+    if (messages) {
+        ESP_LOGI(GATTS_TAG, "%d clients: %lu messages in %d s, %lu bytes/s", morse_conn_count(), (unsigned long)messages,
+                 CONFIG_MORSE_SERVER_REPORT_S, (unsigned long)(bytes / CONFIG_MORSE_SERVER_REPORT_S));
+    }
+    ble_npl_callout_reset(&report_callout, ble_npl_time_ms_to_ticks32(CONFIG_MORSE_SERVER_REPORT_S * 1000));
+}
+#endif
+
+// esp_timer times for the time to connect log
+static int64_t sync_time;
+static int64_t adv_start_time;
+
 // BLE event handling
 static int ble_gap_event(struct ble_gap_event *event, void *arg)
 {
+    int64_t connect_time;
+
     switch (event->type)
     {
     // Advertise if connected
@@ -119,17 +367,88 @@ static int ble_gap_event(struct ble_gap_event *event, void *arg)
         ESP_LOGI(GATTS_TAG, "BLE GAP EVENT CONNECT %s", event->connect.status == 0 ? "OK!" : "FAILED!");
         if (event->connect.status != 0) // if no good connection, readvertise
         {
-            ble_app_advertise();
+            morse_advertise_if_free();
+            break;
+        }
+        if (!morse_conn_add(event->connect.conn_handle))
+        {
+            // more connections than slots, NimBLE is configured for more than MORSE_CONN_MAX
+            ESP_LOGI(GATTS_TAG, "no slot for connection %u", event->connect.conn_handle);
+            ble_gap_terminate(event->connect.conn_handle, BLE_ERR_CONN_LIMIT);
+            break;
+        }
+        ESP_LOGI(GATTS_TAG, "%d of %d clients connected", morse_conn_count(), MORSE_CONN_MAX);
+        connect_time = esp_timer_get_time();
+        ESP_LOGI(GATTS_TAG, "connected %lld us after boot: sync at %lld, advertising since +%lld, connected +%lld us",
+                 connect_time, sync_time, adv_start_time - sync_time, connect_time - adv_start_time);
+        // the next client can connect while this one discovers
+        morse_advertise_if_free();
+        // longer link layer packets for our notifications and read responses, the client asks for its direction too
+        if (ble_gap_set_data_len(event->connect.conn_handle, LINK_TX_OCTETS_MAX, MORSE_LINK_TX_TIME_MAX) != 0)
+        {
+            ESP_LOGI(GATTS_TAG, "BLE set data length failed");
+        }
+        // clients that pick a connection profile connect on one, older ones get the interactive one from us
+        if (morse_link_log(GATTS_TAG, event->connect.conn_handle) == MORSE_LINK_NONE &&
+            morse_link_set(event->connect.conn_handle, MORSE_LINK_INTERACTIVE) != 0) {
+            ESP_LOGI(GATTS_TAG, "BLE connection parameter update failed to start");
+        }
+        break;
+    // new connection parameters, from either side
+    case BLE_GAP_EVENT_CONN_UPDATE:
+        if (event->conn_update.status != 0) {
+            ESP_LOGI(GATTS_TAG, "BLE connection parameter update failed, status %d", event->conn_update.status);
+            break;
+        }
+        morse_link_log(GATTS_TAG, event->conn_update.conn_handle);
+        break;
+#if CONFIG_BT_NIMBLE_50_FEATURE_SUPPORT
+    // the client asks for CONFIG_MORSE_PHY, we prefer it as well
+    case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
+        if (event->phy_updated.status != 0) {
+            ESP_LOGI(GATTS_TAG, "BLE PHY update failed, status %d", event->phy_updated.status);
+            break;
+        }
+        ESP_LOGI(GATTS_TAG, "BLE PHY updated on %u: tx %s, rx %s", event->phy_updated.conn_handle,
+                 morse_link_phy_name(event->phy_updated.tx_phy), morse_link_phy_name(event->phy_updated.rx_phy));
+        break;
+#endif
+    // the client starts the MTU exchange right after connecting
+    case BLE_GAP_EVENT_MTU:
+        ESP_LOGI(GATTS_TAG, "BLE MTU updated: %u, %u bytes per write", event->mtu.value, event->mtu.value - 3);
+        break;
+#ifdef BLE_GAP_EVENT_DATA_LEN_CHG
+    case BLE_GAP_EVENT_DATA_LEN_CHG:
+        ESP_LOGI(GATTS_TAG, "BLE data length updated: tx %u bytes, rx %u bytes", event->data_len_chg.max_tx_octets, event->data_len_chg.max_rx_octets);
+        break;
+#endif
+    // the client wrote the CCCD of a characteristic
+    case BLE_GAP_EVENT_SUBSCRIBE:
+        if (event->subscribe.attr_handle == morse_val_handle) {
+            struct morse_conn *conn = morse_conn_find(event->subscribe.conn_handle);
+            if (!conn) {
+                break;
+            }
+            conn->notify = event->subscribe.cur_notify;
+            conn->indicate = event->subscribe.cur_indicate;
+            ESP_LOGI(GATTS_TAG, "BLE subscribe %u: notify %d, indicate %d", conn->conn_handle, conn->notify, conn->indicate);
+        }
+        break;
+    case BLE_GAP_EVENT_NOTIFY_TX:
+        // for indications this reports the client's confirmation, or BLE_HS_ETIMEOUT
+        if (event->notify_tx.indication && event->notify_tx.status != BLE_HS_EDONE && event->notify_tx.status != 0) {
+            ESP_LOGI(GATTS_TAG, "BLE indication failed, status %d", event->notify_tx.status);
         }
         break;
     // Advertise again after completion of the event
     case BLE_GAP_EVENT_DISCONNECT:
-        ESP_LOGI(GATTS_TAG, "BLE GAP EVENT DISCONNECTED"); //breaks after first disconnect 
-        ble_app_advertise();
+        ESP_LOGI(GATTS_TAG, "BLE GAP EVENT DISCONNECTED %u", event->disconnect.conn.conn_handle);
+        morse_conn_remove(event->disconnect.conn.conn_handle);
+        morse_advertise_if_free();
         break;
     case BLE_GAP_EVENT_ADV_COMPLETE:
         ESP_LOGI(GATTS_TAG, "BLE GAP EVENT");
-        ble_app_advertise();
+        morse_advertise_if_free();
         break;
     default:
         ESP_LOGI(GATTS_TAG, "This event is not supported: %u", event->type);
@@ -141,6 +460,19 @@ static int ble_gap_event(struct ble_gap_event *event, void *arg)
 // Define the BLE connection
 void ble_app_advertise(void)
 {
+    // right after boot advertise fast until the burst is over, the adv complete event then restarts us slower
+    int64_t now = esp_timer_get_time();
+    int64_t burst_end = CONFIG_MORSE_ADV_BURST_S * 1000000LL;
+    int32_t duration = BLE_HS_FOREVER;
+    int itvl_ms = CONFIG_MORSE_ADV_ITVL_MS;
+    int rc;
+
+    if (now < burst_end)
+    {
+        duration = (burst_end - now) / 1000 + 1;
+        itvl_ms = CONFIG_MORSE_ADV_BURST_ITVL_MS;
+    }
+
     // GAP - device name definition
     struct ble_hs_adv_fields fields;
     const char *device_name;
@@ -158,7 +490,16 @@ void ble_app_advertise(void)
     adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN; // discoverable or non-discoverable
     // adv_params.filter_policy = BLE_HCI_SCAN_FILT_USE_WL; // ***USE A WHITELIST***
     adv_params.filter_policy = BLE_HCI_SCAN_FILT_NO_WL; // ***DONT USE A WHITELIST***
-    ble_gap_adv_start(BLE_OWN_ADDR_RANDOM, NULL, BLE_HS_FOREVER, &adv_params, ble_gap_event, NULL);
+    adv_params.itvl_min = BLE_GAP_ADV_ITVL_MS(itvl_ms);
+    adv_params.itvl_max = BLE_GAP_ADV_ITVL_MS(itvl_ms);
+    rc = ble_gap_adv_start(BLE_OWN_ADDR_RANDOM, NULL, duration, &adv_params, ble_gap_event, NULL);
+    if (rc != 0)
+    {
+        ESP_LOGI(GATTS_TAG, "BLE advertising failed to start, rc = %d", rc);
+        return;
+    }
+    adv_start_time = now;
+    ESP_LOGI(GATTS_TAG, "advertising every %d ms %lld us after boot", itvl_ms, now);
 }
 
 // The application
@@ -167,31 +508,40 @@ void ble_app_on_sync(void)
     uint8_t err;
     //ble_hs_id_infer_auto(0, &ble_addr_type); // Determines the best address type automatically
 
+    sync_time = esp_timer_get_time();
+    ESP_LOGI(GATTS_TAG, "host synced %lld us after boot", sync_time);
+
     err = ble_hs_id_set_rnd(serverPtr->val); 
     if (err != 0)
     {
         ESP_LOGI(GATTS_TAG, "BLE gap set random address failed %d", err);
     }
 
-    err = ble_gap_wl_set(clientPtr, white_list_count); // sets white list for connection to other device
+    err = morse_link_phy_init();
     if (err != 0)
     {
-        ESP_LOGI(GATTS_TAG, "BLE gap set whitelist failed %d", err);
+        ESP_LOGI(GATTS_TAG, "BLE set preferred PHY failed %d", err);
     }
 
-    // create pool
-    mbuf_create_pool();
-    // create the initial mbuf
-    char greetings[] = "Hello World!";
-    char *initial_buf_data = greetings;
-    uint8_t initial_buf_len = sizeof(greetings);
-    err = mbuf_store(initial_buf_data, initial_buf_len);
+    // one address per client that can be connected at once, the first one and the ones after it
+    ble_addr_t white_list[MORSE_CONN_MAX];
+    for (int i = 0; i < white_list_count; i++)
+    {
+        white_list[i] = *clientPtr;
+        white_list[i].val[0] += i;
+    }
+    err = ble_gap_wl_set(white_list, white_list_count); // sets white list for connection to other devices
     if (err != 0)
     {
-        ESP_LOGI(GATTS_TAG, "initial mbuf data fail %d", err);
+        ESP_LOGI(GATTS_TAG, "BLE gap set whitelist failed %d", err);
     }
 
-    ble_app_advertise(); // Define the BLE connection
+#if CONFIG_MORSE_SERVER_REPORT_S
+    ble_npl_callout_init(&report_callout, nimble_port_get_dflt_eventq(), morse_report, NULL);
+    ble_npl_callout_reset(&report_callout, ble_npl_time_ms_to_ticks32(CONFIG_MORSE_SERVER_REPORT_S * 1000));
+#endif
+
+    morse_advertise_if_free(); // Define the BLE connection
 }
 
 // The infinite task
@@ -204,6 +554,20 @@ void host_task(void *param)
 
 void app_main()
 {
+    // before anything that logs through it
+    if (morse_log_start() != 0)
+    {
+        ESP_LOGI(GATTS_TAG, "log task failed to start");
+    }
+    morse_conn_init();                         // no clients connected
+    // create pool, once: a resync after a controller reset keeps the stored messages and their sequence numbers
+    mbuf_create_pool();
+    // create the initial mbuf
+    char greetings[] = "Hello World!";
+    if (mbuf_store(greetings, sizeof(greetings)) != 0)
+    {
+        ESP_LOGI(GATTS_TAG, "initial mbuf data fail");
+    }
     nvs_flash_init(); // 1 - Initialize NVS flash using
     // esp_nimble_hci_and_controller_init();      // 2 - Initialize ESP controller
     nimble_port_init();                        // 3 - Initialize the host stack
@@ -212,6 +576,7 @@ void app_main()
     ble_svc_gatt_init();                       // 4 - Initialize NimBLE configuration - gatt service
     ble_gatts_count_cfg(gatt_svcs);            // 4 - Initialize NimBLE configuration - config gatt services
     ble_gatts_add_svcs(gatt_svcs);             // 4 - Initialize NimBLE configuration - queues gatt services.
+    ble_att_set_preferred_mtu(BLE_ATT_MTU_MAX); // 4 - Initialize NimBLE configuration - largest MTU offered in the exchange
     ble_hs_cfg.sync_cb = ble_app_on_sync;      // 5 - Initialize application
     nimble_port_freertos_init(host_task);      // 6 - Run the thread
 }
\ No newline at end of file
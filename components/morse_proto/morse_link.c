@@ -0,0 +1,135 @@
+#include "morse_link.h"
+#include "esp_log.h"
+
+static const struct
+{
+    const char *name;
+    uint16_t itvl_min;
+    uint16_t itvl_max;
+    uint16_t latency;
+    uint16_t supervision_timeout; // more than (1 + latency) * itvl_max * 2, as the spec asks
+} link_profiles[MORSE_LINK_PROFILE_COUNT] = {
+    [MORSE_LINK_INTERACTIVE] = {"interactive", 6, 12, 0, 200},
+    [MORSE_LINK_IDLE] = {"idle", 320, 400, 4, 600},
+};
+
+void morse_link_params(uint8_t profile, struct ble_gap_upd_params *params)
+{
+    params->itvl_min = link_profiles[profile].itvl_min;
+    params->itvl_max = link_profiles[profile].itvl_max;
+    params->latency = link_profiles[profile].latency;
+    params->supervision_timeout = link_profiles[profile].supervision_timeout;
+    params->min_ce_len = 0;
+    params->max_ce_len = 0;
+}
+
+void morse_link_conn_params(uint8_t profile, struct ble_gap_conn_params *params)
+{
+    params->scan_itvl = BLE_GAP_SCAN_FAST_INTERVAL_MIN;
+    params->scan_window = BLE_GAP_SCAN_FAST_WINDOW;
+    params->itvl_min = link_profiles[profile].itvl_min;
+    params->itvl_max = link_profiles[profile].itvl_max;
+    params->latency = link_profiles[profile].latency;
+    params->supervision_timeout = link_profiles[profile].supervision_timeout;
+    params->min_ce_len = 0;
+    params->max_ce_len = 0;
+}
+
+int morse_link_set(uint16_t conn_handle, uint8_t profile)
+{
+    struct ble_gap_upd_params params;
+
+    if (profile >= MORSE_LINK_PROFILE_COUNT)
+    {
+        return BLE_HS_EINVAL;
+    }
+    morse_link_params(profile, &params);
+    return ble_gap_update_params(conn_handle, &params);
+}
+
+uint8_t morse_link_match(uint16_t itvl, uint16_t latency)
+{
+    for (uint8_t i = 0; i < MORSE_LINK_PROFILE_COUNT; i++)
+    {
+        if (itvl >= link_profiles[i].itvl_min && itvl <= link_profiles[i].itvl_max && latency == link_profiles[i].latency)
+        {
+            return i;
+        }
+    }
+    return MORSE_LINK_NONE;
+}
+
+const char *morse_link_name(uint8_t profile)
+{
+    return (profile < MORSE_LINK_PROFILE_COUNT) ? link_profiles[profile].name : "none";
+}
+
+uint8_t morse_link_log(const char *tag, uint16_t conn_handle)
+{
+    struct ble_gap_conn_desc desc;
+    uint8_t profile;
+
+    if (ble_gap_conn_find(conn_handle, &desc) != 0)
+    {
+        return MORSE_LINK_NONE;
+    }
+    profile = morse_link_match(desc.conn_itvl, desc.conn_latency);
+    // the interval in 1.25 ms units, printed in us to stay with integers
+    ESP_LOGI(tag, "link %u: interval %u us, latency %u, timeout %u ms (%s)", conn_handle, desc.conn_itvl * 1250,
+             desc.conn_latency, desc.supervision_timeout * 10, morse_link_name(profile));
+    return profile;
+}
+
+int morse_link_phy_init()
+{
+#if CONFIG_BT_NIMBLE_50_FEATURE_SUPPORT
+    return ble_gap_set_prefered_default_le_phy(MORSE_LINK_PHY_MASK, MORSE_LINK_PHY_MASK);
+#else
+    return 0;
+#endif
+}
+
+int morse_link_phy_set(uint16_t conn_handle)
+{
+#if CONFIG_BT_NIMBLE_50_FEATURE_SUPPORT
+    // every connection starts on 1M
+    if (MORSE_LINK_PHY_MASK == BLE_GAP_LE_PHY_1M_MASK)
+    {
+        return 0;
+    }
+    return ble_gap_set_prefered_le_phy(conn_handle, MORSE_LINK_PHY_MASK, MORSE_LINK_PHY_MASK, MORSE_LINK_PHY_OPTS);
+#else
+    return 0;
+#endif
+}
+
+const char *morse_link_phy_name(uint8_t phy)
+{
+    switch (phy)
+    {
+    case BLE_GAP_LE_PHY_1M:
+        return "1M";
+    case BLE_GAP_LE_PHY_2M:
+        return "2M";
+    case BLE_GAP_LE_PHY_CODED:
+        return MORSE_LINK_CODED_NAME;
+    default:
+        return "unknown";
+    }
+}
+
+uint8_t morse_link_phy_log(const char *tag, uint16_t conn_handle)
+{
+    uint8_t tx_phy = BLE_GAP_LE_PHY_1M;
+    uint8_t rx_phy = BLE_GAP_LE_PHY_1M;
+
+#if CONFIG_BT_NIMBLE_50_FEATURE_SUPPORT
+    if (ble_gap_read_le_phy(conn_handle, &tx_phy, &rx_phy) != 0)
+    {
+        ESP_LOGI(tag, "link %u: PHY unknown", conn_handle);
+        return BLE_GAP_LE_PHY_1M;
+    }
+#endif
+    ESP_LOGI(tag, "link %u: PHY tx %s, rx %s", conn_handle, morse_link_phy_name(tx_phy), morse_link_phy_name(rx_phy));
+    return tx_phy;
+}
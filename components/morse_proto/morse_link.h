@@ -0,0 +1,116 @@
+#ifndef MORSE_LINK_H
+#define MORSE_LINK_H
+
+/*
+ * Named connection parameter profiles, the same on both sides so a log of the active parameters says which one a
+ * connection is on. Intervals are in 1.25 ms units, supervision timeouts in 10 ms units, as the controller takes them.
+ *
+ * MORSE_LINK_INTERACTIVE  7.5 to 15 ms interval, no peripheral latency. A write gets its response in one or two
+ *                         intervals, for keying and sending.
+ * MORSE_LINK_IDLE         400 to 500 ms interval, the peripheral may skip 4 events. The radio wakes a few times a
+ *                         second instead of a hundred, a notification still reaches the client within the interval.
+ *
+ * The central applies a profile with ble_gap_update_params(), which takes effect a few connection events later,
+ * so switching to interactive costs up to a few idle intervals. The client switches on the first key edge and is
+ * fast by the time the message is sent.
+ */
+
+#include "host/ble_gap.h"
+#include "sdkconfig.h"
+
+/*
+ * The PHY both sides prefer, from CONFIG_MORSE_PHY. 2M halves the air time of every packet, for long messages and
+ * catch ups. Coded spends 2 (S2) or 8 (S8) symbols per bit for about twice or four times the range of 1M.
+ * Both need BLE 5 in the controller, BT_NIMBLE_50_FEATURE_SUPPORT. Without it, or if the peer can't, the link
+ * stays on 1M.
+ */
+#if CONFIG_MORSE_PHY_CODED
+#define MORSE_LINK_PHY_MASK BLE_GAP_LE_PHY_CODED_MASK
+#if CONFIG_MORSE_PHY_CODED_S2
+#define MORSE_LINK_PHY_OPTS BLE_GAP_LE_PHY_CODED_S2
+#define MORSE_LINK_CODED_NAME "coded S2"
+#else
+#define MORSE_LINK_PHY_OPTS BLE_GAP_LE_PHY_CODED_S8
+#define MORSE_LINK_CODED_NAME "coded S8"
+#endif
+// air time of a 251 byte packet at S8, what data length extension has to allow for full packets
+#define MORSE_LINK_TX_TIME_MAX 17040
+#elif CONFIG_MORSE_PHY_2M
+#define MORSE_LINK_PHY_MASK BLE_GAP_LE_PHY_2M_MASK
+#define MORSE_LINK_PHY_OPTS BLE_GAP_LE_PHY_CODED_ANY
+#define MORSE_LINK_TX_TIME_MAX 2120 // the 1M time of a 251 byte packet covers 2M twice over
+#else
+#define MORSE_LINK_PHY_MASK BLE_GAP_LE_PHY_1M_MASK
+#define MORSE_LINK_PHY_OPTS BLE_GAP_LE_PHY_CODED_ANY
+#define MORSE_LINK_TX_TIME_MAX 2120 // air time of a 251 byte packet on the 1M PHY
+#endif
+#ifndef MORSE_LINK_CODED_NAME
+#define MORSE_LINK_CODED_NAME "coded"
+#endif
+
+#define MORSE_LINK_INTERACTIVE 0
+#define MORSE_LINK_IDLE 1
+#define MORSE_LINK_PROFILE_COUNT 2
+#define MORSE_LINK_NONE 0xFF // no profile requested yet, or parameters the stack picked
+
+/**
+ * Fills in the parameters of a profile for ble_gap_update_params().
+ * @param profile a MORSE_LINK_ value.
+ */
+void morse_link_params(uint8_t profile, struct ble_gap_upd_params *params);
+
+/**
+ * Fills in the parameters of a profile for ble_gap_connect(), with fast scan parameters, so a connection starts
+ * on the profile instead of the stack's defaults.
+ * @param profile a MORSE_LINK_ value.
+ */
+void morse_link_conn_params(uint8_t profile, struct ble_gap_conn_params *params);
+
+/**
+ * Asks for a profile on a connection. The result arrives as BLE_GAP_EVENT_CONN_UPDATE.
+ * @return 0 if the update was started, a BLE_HS_E* error otherwise.
+ */
+int morse_link_set(uint16_t conn_handle, uint8_t profile);
+
+/**
+ * @return the profile the parameters of a connection fall into, MORSE_LINK_NONE if neither.
+ */
+uint8_t morse_link_match(uint16_t itvl, uint16_t latency);
+
+/**
+ * @return the name of a profile for the log, "none" for MORSE_LINK_NONE.
+ */
+const char *morse_link_name(uint8_t profile);
+
+/**
+ * Makes CONFIG_MORSE_PHY the preferred PHY of every connection. Call once the host is synced.
+ * @return 0 on success, a BLE_HS_E* error otherwise. 0 without BLE 5 support, there is nothing to prefer.
+ */
+int morse_link_phy_init();
+
+/**
+ * Asks for CONFIG_MORSE_PHY on a connection. The result arrives as BLE_GAP_EVENT_PHY_UPDATE_COMPLETE.
+ * @return 0 if the update was started or the PHY is 1M anyway, a BLE_HS_E* error otherwise.
+ */
+int morse_link_phy_set(uint16_t conn_handle);
+
+/**
+ * @return the name of a BLE_GAP_LE_PHY_ value for the log.
+ */
+const char *morse_link_phy_name(uint8_t phy);
+
+/**
+ * Logs the PHY a connection is on now.
+ * @param tag the log tag of the caller.
+ * @return the transmit PHY, BLE_GAP_LE_PHY_1M if it can't be read.
+ */
+uint8_t morse_link_phy_log(const char *tag, uint16_t conn_handle);
+
+/**
+ * Logs the parameters a connection is on now and the profile they belong to. Call on BLE_GAP_EVENT_CONN_UPDATE.
+ * @param tag the log tag of the caller.
+ * @return the profile, as morse_link_match().
+ */
+uint8_t morse_link_log(const char *tag, uint16_t conn_handle);
+
+#endif
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "morse_log.h"
+
+#ifdef MORSE_HOST_BUILD
+#include "morse_host_port.h" // esp_timer_get_time and IRAM_ATTR
+#else
+#include "esp_attr.h"
+#include "esp_timer.h"
+#endif
+
+#define MORSE_LOG_CLIENT_TAG "Morse code tag"
+#define MORSE_LOG_SERVER_TAG "BLE-Server"
+#define MORSE_LOG_ERROR_TAG "||| ERROR |||"
+
+morse_log morse_log_self;
+
+static const struct
+{
+    const char *tag;
+    const char *format;
+} morse_log_events[MORSE_LOG_EVENT_COUNT] = {
+    [MORSE_LOG_DROPPED] = {MORSE_LOG_ERROR_TAG, "log: %u entries dropped, the ring was full"},
+    [MORSE_LOG_EDGE_DROPPED] = {MORSE_LOG_ERROR_TAG, "edge of type %u dropped, the edge ring was full"},
+    [MORSE_LOG_SEND_PRESS] = {MORSE_LOG_CLIENT_TAG, "send press to write: %u us"},
+    [MORSE_LOG_SEND_SINGLE] = {MORSE_LOG_CLIENT_TAG, "send: %u bytes to server %u in a single write, mtu %u"},
+    [MORSE_LOG_SEND_CHUNKED] = {MORSE_LOG_CLIENT_TAG, "send: %u bytes to server %u in %u chunks, mtu %u"},
+    [MORSE_LOG_SEND_LONG] = {MORSE_LOG_CLIENT_TAG, "send: %u bytes to server %u as a long write, mtu %u"},
+    [MORSE_LOG_STILL_OUT] = {MORSE_LOG_CLIENT_TAG, "send: the last message is still out with %u of %u servers"},
+    [MORSE_LOG_GOODPUT] = {MORSE_LOG_CLIENT_TAG, "goodput server %u: %u bytes in %u us = %u bytes/s"},
+    [MORSE_LOG_GOODPUT_LINK] = {MORSE_LOG_CLIENT_TAG, "goodput server %u: %u ATT writes, ~%u link packets (%u octets each, PHY %u)"},
+    [MORSE_LOG_DELIVERED] = {MORSE_LOG_CLIENT_TAG, "send: delivered to %u of %u servers in %u us"},
+    [MORSE_LOG_SERVER_READ] = {MORSE_LOG_SERVER_TAG, "Data requested by client %u: %u bytes"},
+    [MORSE_LOG_SERVER_FRAME] = {MORSE_LOG_SERVER_TAG, "Data from client %u: %u bytes, message %u, %u characters"},
+    [MORSE_LOG_SERVER_PLAIN] = {MORSE_LOG_SERVER_TAG, "Data from client %u: %u bytes of text"},
+    [MORSE_LOG_SERVER_STORED] = {MORSE_LOG_SERVER_TAG, "message %u stored, %u bytes"},
+    [MORSE_LOG_SERVER_CHUNKED] = {MORSE_LOG_SERVER_TAG, "chunked message %u of %u bytes stored"},
+    [MORSE_LOG_SERVER_HISTORY] = {MORSE_LOG_SERVER_TAG, "History for %u since %u: %u messages"},
+    [MORSE_LOG_SERVER_BAD_OP] = {MORSE_LOG_SERVER_TAG, "Bad Op: %u"},
+    [MORSE_LOG_SERVER_CHUNK_SEQ] = {MORSE_LOG_SERVER_TAG, "Chunk %u out of sequence, dropping message"},
+    [MORSE_LOG_SERVER_PUSH_FAILED] = {MORSE_LOG_SERVER_TAG, "push of message %u to %u failed, rc = %d"},
+};
+
+void morse_log_init(morse_log *log)
+{
+    atomic_init(&log->head, 0);
+    log->tail = 0;
+    atomic_init(&log->dropped, 0);
+    for (uint32_t i = 0; i < MORSE_LOG_LENGTH; i++)
+    {
+        atomic_init(&log->slots[i].seq, i);
+    }
+}
+
+bool IRAM_ATTR morse_log_write(morse_log *log, uint16_t event, const uint32_t *args, int count)
+{
+    uint32_t head = atomic_load_explicit(&log->head, memory_order_relaxed);
+    morse_log_slot *slot;
+
+    for (;;)
+    {
+        slot = &log->slots[head & MORSE_LOG_MASK];
+        // acquire pairs with the reader's release of seq, so the slot is no longer being read
+        int32_t diff = (int32_t)(atomic_load_explicit(&slot->seq, memory_order_acquire) - head);
+
+        if (diff == 0)
+        {
+            // on failure head is reloaded, another writer took the slot
+            if (atomic_compare_exchange_weak_explicit(&log->head, &head, head + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // the slot still holds the entry from a lap ago
+            atomic_fetch_add_explicit(&log->dropped, 1, memory_order_relaxed);
+            return false;
+        }
+        else
+        {
+            head = atomic_load_explicit(&log->head, memory_order_relaxed);
+        }
+    }
+
+    slot->entry.time = esp_timer_get_time();
+    slot->entry.event = event;
+    for (int i = 0; i < MORSE_LOG_ARGS; i++)
+    {
+        slot->entry.args[i] = (i < count) ? args[i] : 0;
+    }
+    // release publishes the entry before the reader can see the slot as written
+    atomic_store_explicit(&slot->seq, head + 1, memory_order_release);
+    return true;
+}
+
+bool morse_log_read(morse_log *log, morse_log_entry *entry)
+{
+    morse_log_slot *slot = &log->slots[log->tail & MORSE_LOG_MASK];
+
+    // acquire pairs with the writer's release, so the entry is fully written
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != log->tail + 1)
+    {
+        return false;
+    }
+    *entry = slot->entry;
+    // release hands the slot to the writer of the next lap only after it has been read
+    atomic_store_explicit(&slot->seq, log->tail + MORSE_LOG_LENGTH, memory_order_release);
+    log->tail++;
+    return true;
+}
+
+uint32_t morse_log_take_dropped(morse_log *log)
+{
+    return atomic_exchange_explicit(&log->dropped, 0, memory_order_relaxed);
+}
+
+int morse_log_format(const morse_log_entry *entry, char *buf, size_t size)
+{
+    const uint32_t *a = entry->args;
+
+    if (entry->event >= MORSE_LOG_EVENT_COUNT || !morse_log_events[entry->event].format)
+    {
+        return snprintf(buf, size, "unknown event %u: %" PRIx32 " %" PRIx32 " %" PRIx32 " %" PRIx32 " %" PRIx32 " %" PRIx32,
+                        entry->event, a[0], a[1], a[2], a[3], a[4], a[5]);
+    }
+    // every conversion in the table takes an int sized argument, surplus ones are ignored
+    return snprintf(buf, size, morse_log_events[entry->event].format, (unsigned)a[0], (unsigned)a[1], (unsigned)a[2], (unsigned)a[3],
+                    (unsigned)a[4], (unsigned)a[5]);
+}
+
+const char *morse_log_tag(const morse_log_entry *entry)
+{
+    if (entry->event >= MORSE_LOG_EVENT_COUNT || !morse_log_events[entry->event].tag)
+    {
+        return MORSE_LOG_ERROR_TAG;
+    }
+    return morse_log_events[entry->event].tag;
+}
+
+int morse_log_encode(const morse_log_entry *entry, char *buf, size_t size)
+{
+    const uint32_t *a = entry->args;
+
+    return snprintf(buf, size, MORSE_LOG_LINE "%" PRIx64 " %x %" PRIx32 " %" PRIx32 " %" PRIx32 " %" PRIx32 " %" PRIx32 " %" PRIx32,
+                    (uint64_t)entry->time, entry->event, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+int morse_log_decode(const char *line, morse_log_entry *entry)
+{
+    const char *p = strstr(line, MORSE_LOG_LINE);
+    uint64_t time;
+    unsigned event;
+    uint32_t *a = entry->args;
+
+    if (!p)
+    {
+        return -1;
+    }
+    if (sscanf(p + strlen(MORSE_LOG_LINE), "%" SCNx64 " %x %" SCNx32 " %" SCNx32 " %" SCNx32 " %" SCNx32 " %" SCNx32 " %" SCNx32,
+               &time, &event, &a[0], &a[1], &a[2], &a[3], &a[4], &a[5]) != 2 + MORSE_LOG_ARGS || event > UINT16_MAX)
+    {
+        return -1;
+    }
+    entry->time = (int64_t)time;
+    entry->event = event;
+    return 0;
+}
@@ -0,0 +1,142 @@
+#ifndef MORSE_LOG_H
+#define MORSE_LOG_H
+
+/*
+ * Binary event log for the hot paths of both boards. A log call stores the time, an event id and up to
+ * MORSE_LOG_ARGS integers in a ring and returns, it doesn't format anything or touch the uart, so the interrupts,
+ * the NimBLE host task and the poll event task can log on every symbol and message. A low priority task drains the
+ * ring, see morse_log_start(), and prints each entry with the event's format string, or as a MORSE_LOG_LINE hex line
+ * with CONFIG_MORSE_LOG_BINARY, which host/log_decode turns back into the same text.
+ *
+ * The ring takes any number of writers on either core, a slot is claimed with a compare and swap on the head and
+ * handed to the reader with the slot's sequence number. A writer only retries when another one claimed the same
+ * slot first. A full ring drops the entry and counts it, the drain task logs the count.
+ *
+ * Arguments are 32 bit integers, the formats take them with %u, %d, %x or %c. No strings, a pointer may not be
+ * valid by the time the entry is printed.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define MORSE_LOG_LENGTH 128 // entries, a power of 2
+#define MORSE_LOG_MASK (MORSE_LOG_LENGTH - 1)
+#define MORSE_LOG_ARGS 6
+#define MORSE_LOG_TEXT_MAX 160 // longest formatted entry, without the time
+#define MORSE_LOG_LINE "MLOG "
+
+// events, ids stay the same across versions so old captures still decode
+#define MORSE_LOG_DROPPED 0       // both: entries lost to a full ring
+#define MORSE_LOG_EDGE_DROPPED 1  // client: edge lost to a full edge ring, from the interrupt
+#define MORSE_LOG_SEND_PRESS 2    // client: send press to write
+#define MORSE_LOG_SEND_SINGLE 3   // client: message in one write
+#define MORSE_LOG_SEND_CHUNKED 4  // client: message in chunked writes
+#define MORSE_LOG_SEND_LONG 5     // client: message as a long write
+#define MORSE_LOG_STILL_OUT 6     // client: send while the last message is out
+#define MORSE_LOG_GOODPUT 7       // client: bytes and time of one server's write
+#define MORSE_LOG_GOODPUT_LINK 8  // client: what that write took on the link
+#define MORSE_LOG_DELIVERED 9     // client: a message is done with every server
+#define MORSE_LOG_SERVER_READ 10  // server: read of the latest message
+#define MORSE_LOG_SERVER_FRAME 11 // server: packed message written
+#define MORSE_LOG_SERVER_PLAIN 12 // server: plain text message written
+#define MORSE_LOG_SERVER_STORED 13 // server: message stored
+#define MORSE_LOG_SERVER_CHUNKED 14 // server: chunked message complete and stored
+#define MORSE_LOG_SERVER_HISTORY 15 // server: history read
+#define MORSE_LOG_SERVER_BAD_OP 16  // server: access op the characteristic doesn't handle
+#define MORSE_LOG_SERVER_CHUNK_SEQ 17 // server: chunk out of sequence
+#define MORSE_LOG_SERVER_PUSH_FAILED 18 // server: notification or indication failed
+#define MORSE_LOG_EVENT_COUNT 19
+
+typedef struct morse_log_entry
+{
+    int64_t time; // esp_timer_get_time()
+    uint32_t args[MORSE_LOG_ARGS];
+    uint16_t event;
+} morse_log_entry;
+
+typedef struct morse_log_slot
+{
+    atomic_uint_least32_t seq; // the head value that may write the slot, one more once it is written
+    morse_log_entry entry;
+} morse_log_slot;
+
+typedef struct morse_log
+{
+    atomic_uint_least32_t head; // next slot a writer claims
+    uint32_t tail;              // next slot the reader takes, the drain task is the only reader
+    atomic_uint_least32_t dropped;
+    morse_log_slot slots[MORSE_LOG_LENGTH];
+} morse_log;
+
+// this board's log
+extern morse_log morse_log_self;
+
+/**
+ * Empties the log. Call before the first entry, from one task.
+ */
+void morse_log_init(morse_log *log);
+
+/**
+ * Adds an entry, from any task or interrupt.
+ * @param event a MORSE_LOG_ value.
+ * @param args count integers, the rest of the entry's arguments are 0.
+ * @return false if the log was full and the entry was dropped.
+ */
+bool morse_log_write(morse_log *log, uint16_t event, const uint32_t *args, int count);
+
+/**
+ * Takes the oldest entry. One reader only.
+ * @return false if the log is empty.
+ */
+bool morse_log_read(morse_log *log, morse_log_entry *entry);
+
+/**
+ * @return entries dropped since the last call, the count starts over.
+ */
+uint32_t morse_log_take_dropped(morse_log *log);
+
+/**
+ * Formats an entry with its event's format string.
+ * @param buf receives the text, without the time, MORSE_LOG_TEXT_MAX bytes are enough.
+ * @return the text length, as snprintf().
+ */
+int morse_log_format(const morse_log_entry *entry, char *buf, size_t size);
+
+/**
+ * @return the log tag of an entry's event, the tag the line had before it went through the log.
+ */
+const char *morse_log_tag(const morse_log_entry *entry);
+
+/**
+ * Writes an entry as a MORSE_LOG_LINE line, time, event and arguments in hex, without the newline.
+ * @param buf MORSE_LOG_TEXT_MAX bytes are enough.
+ * @return the line length, as snprintf().
+ */
+int morse_log_encode(const morse_log_entry *entry, char *buf, size_t size);
+
+/**
+ * Reads a line written by morse_log_encode() back. Anything before MORSE_LOG_LINE is skipped, a monitor adds
+ * its own prefix.
+ * @return 0 on success, -1 if the line has no entry.
+ */
+int morse_log_decode(const char *line, morse_log_entry *entry);
+
+/**
+ * Starts the task that drains morse_log_self to the uart every CONFIG_MORSE_LOG_DRAIN_MS, at a priority below
+ * everything else the board runs. Only on the board, the host has no task for it.
+ * @return 0 on success, -1 if the task couldn't be created.
+ */
+int morse_log_start();
+
+// logs an event with up to MORSE_LOG_ARGS integer arguments in morse_log_self
+#define MORSE_LOG(event, ...)                                                                        \
+    do                                                                                               \
+    {                                                                                                \
+        const uint32_t morse_log_args_[] = {__VA_ARGS__};                                            \
+        morse_log_write(&morse_log_self, (event), morse_log_args_,                                   \
+                        sizeof(morse_log_args_) / sizeof(morse_log_args_[0]));                       \
+    } while (0)
+
+#endif
@@ -0,0 +1,60 @@
+#include <stdio.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#include "morse_log.h"
+
+#define MORSE_LOG_TASK_STACK 3072 // snprintf and esp_log
+
+/**
+ * Prints an entry as text, or as a hex line for host/log_decode with CONFIG_MORSE_LOG_BINARY.
+ */
+static void morse_log_print(const morse_log_entry *entry)
+{
+    static char text[MORSE_LOG_TEXT_MAX];
+
+#if CONFIG_MORSE_LOG_BINARY
+    morse_log_encode(entry, text, sizeof(text));
+    printf("%s\n", text);
+#else
+    morse_log_format(entry, text, sizeof(text));
+    ESP_LOGI(morse_log_tag(entry), "[%lld us] %s", entry->time, text);
+#endif
+}
+
+static void morse_log_task(void *param)
+{
+    morse_log_entry entry;
+    uint32_t dropped;
+
+    for (;;)
+    {
+        while (morse_log_read(&morse_log_self, &entry))
+        {
+            morse_log_print(&entry);
+        }
+        dropped = morse_log_take_dropped(&morse_log_self);
+        if (dropped)
+        {
+            // not through the ring, it may be full again
+            entry = (morse_log_entry){.time = esp_timer_get_time(), .event = MORSE_LOG_DROPPED, .args = {dropped}};
+            morse_log_print(&entry);
+        }
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_MORSE_LOG_DRAIN_MS));
+    }
+}
+
+int morse_log_start()
+{
+    morse_log_init(&morse_log_self);
+    // idle + 1, the uart only gets the time nothing else wants
+    if (xTaskCreate(morse_log_task, "Morse Log Task", MORSE_LOG_TASK_STACK, NULL, tskIDLE_PRIORITY + 1, NULL) != pdPASS)
+    {
+        return -1;
+    }
+    return 0;
+}
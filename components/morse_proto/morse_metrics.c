@@ -0,0 +1,240 @@
+#include <string.h>
+
+#include "morse_metrics.h"
+#include "morse_proto.h" // for MORSE_GET_LE16 and MORSE_GET_LE32
+
+morse_metrics morse_metrics_self;
+
+static const char *const morse_counter_names[MORSE_COUNTER_COUNT] = {
+    [MORSE_COUNTER_EDGES] = "edges",
+    [MORSE_COUNTER_EDGES_DROPPED] = "edges dropped",
+    [MORSE_COUNTER_SYMBOLS] = "symbols",
+    [MORSE_COUNTER_CHARACTERS] = "characters",
+    [MORSE_COUNTER_INVALID_CHARS] = "invalid characters",
+    [MORSE_COUNTER_WRITES] = "writes",
+    [MORSE_COUNTER_WRITE_RETRIES] = "write retries",
+    [MORSE_COUNTER_WRITE_ERRORS] = "write errors",
+    [MORSE_COUNTER_STORED] = "stored",
+    [MORSE_COUNTER_EVICTED] = "evicted",
+    [MORSE_COUNTER_STORE_FAILED] = "store failed",
+    [MORSE_COUNTER_CHUNKS_DROPPED] = "chunks dropped",
+    [MORSE_COUNTER_PUSH_FAILED] = "push failed",
+};
+
+static const char *const morse_hist_names[MORSE_HIST_COUNT] = {
+    [MORSE_HIST_ISR_CYCLES] = "isr cycles",
+    [MORSE_HIST_DECODE_US] = "decode us",
+    [MORSE_HIST_SYMBOLS_PER_S] = "symbols/s",
+    [MORSE_HIST_WRITE_RTT_US] = "write rtt us",
+    [MORSE_HIST_MBUF_BLOCKS] = "mbuf blocks",
+};
+
+void morse_metrics_error_code(uint16_t code)
+{
+    int i;
+
+    for (i = 0; i < MORSE_METRICS_ERRORS - 1; i++)
+    {
+        uint32_t slot = __atomic_load_n(&morse_metrics_self.errors[i].code, __ATOMIC_RELAXED);
+        uint32_t free_code = 0;
+
+        if (slot == code)
+        {
+            break;
+        }
+        // another task may claim the same free slot, then this one looks at what it claimed
+        if (slot == 0 && (__atomic_compare_exchange_n(&morse_metrics_self.errors[i].code, &free_code, code, false, __ATOMIC_RELAXED,
+                                                      __ATOMIC_RELAXED) ||
+                          free_code == code))
+        {
+            break;
+        }
+    }
+    // the last slot keeps the code it was first given and counts every code that found no slot
+    if (i == MORSE_METRICS_ERRORS - 1)
+    {
+        uint32_t free_code = 0;
+        __atomic_compare_exchange_n(&morse_metrics_self.errors[i].code, &free_code, code, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&morse_metrics_self.errors[i].count, 1, __ATOMIC_RELAXED);
+}
+
+static uint8_t *morse_metrics_put32(uint8_t *buf, uint32_t value)
+{
+    buf[0] = (uint8_t)value;
+    buf[1] = (uint8_t)(value >> 8);
+    buf[2] = (uint8_t)(value >> 16);
+    buf[3] = (uint8_t)(value >> 24);
+    return buf + 4;
+}
+
+static uint8_t *morse_metrics_put16(uint8_t *buf, uint32_t value)
+{
+    buf[0] = (uint8_t)value;
+    buf[1] = (uint8_t)(value >> 8);
+    return buf + 2;
+}
+
+int morse_metrics_snapshot(const morse_metrics *metrics, uint32_t uptime_s, uint8_t *buf)
+{
+    uint8_t *p = buf;
+
+    *p++ = MORSE_METRICS_VERSION;
+    *p++ = MORSE_COUNTER_COUNT;
+    *p++ = MORSE_HIST_COUNT;
+    *p++ = MORSE_METRICS_BUCKETS;
+    *p++ = MORSE_METRICS_ERRORS;
+    p = morse_metrics_put32(p, uptime_s);
+    for (int i = 0; i < MORSE_COUNTER_COUNT; i++)
+    {
+        p = morse_metrics_put32(p, metrics->counters[i]);
+    }
+    for (int i = 0; i < MORSE_HIST_COUNT; i++)
+    {
+        const morse_histogram *h = &metrics->histograms[i];
+        uint32_t largest = 0;
+        uint8_t shift = 0;
+
+        for (int b = 0; b < MORSE_METRICS_BUCKETS; b++)
+        {
+            largest = (h->buckets[b] > largest) ? h->buckets[b] : largest;
+        }
+        while ((largest >> shift) > UINT16_MAX)
+        {
+            shift++;
+        }
+        p = morse_metrics_put32(p, h->count);
+        p = morse_metrics_put32(p, h->max);
+        *p++ = shift;
+        for (int b = 0; b < MORSE_METRICS_BUCKETS; b++)
+        {
+            p = morse_metrics_put16(p, h->buckets[b] >> shift);
+        }
+    }
+    for (int i = 0; i < MORSE_METRICS_ERRORS; i++)
+    {
+        p = morse_metrics_put16(p, metrics->errors[i].code);
+        p = morse_metrics_put32(p, metrics->errors[i].count);
+    }
+    return p - buf;
+}
+
+int morse_metrics_parse(const uint8_t *buf, int length, morse_metrics *metrics, uint32_t *uptime_s)
+{
+    int counters;
+    int hists;
+    int buckets;
+    int errors;
+    const uint8_t *p = buf + MORSE_METRICS_HEADER_LENGTH;
+
+    if (length < MORSE_METRICS_HEADER_LENGTH || buf[0] != MORSE_METRICS_VERSION)
+    {
+        return -1;
+    }
+    counters = buf[1];
+    hists = buf[2];
+    buckets = buf[3];
+    errors = buf[4];
+    if (length < MORSE_METRICS_HEADER_LENGTH + counters * 4 + hists * (9 + 2 * buckets) + errors * 6)
+    {
+        return -1;
+    }
+
+    memset(metrics, 0, sizeof(*metrics));
+    *uptime_s = MORSE_GET_LE32(&buf[5]);
+    for (int i = 0; i < counters; i++, p += 4)
+    {
+        if (i < MORSE_COUNTER_COUNT)
+        {
+            metrics->counters[i] = MORSE_GET_LE32(p);
+        }
+    }
+    for (int i = 0; i < hists; i++)
+    {
+        morse_histogram *h = (i < MORSE_HIST_COUNT) ? &metrics->histograms[i] : NULL;
+        uint8_t shift = p[8] & 31;
+
+        if (h)
+        {
+            h->count = MORSE_GET_LE32(p);
+            h->max = MORSE_GET_LE32(p + 4);
+        }
+        p += 9;
+        for (int b = 0; b < buckets; b++, p += 2)
+        {
+            // a writer with more buckets has a longer open last bucket, fold them into ours
+            if (h)
+            {
+                h->buckets[(b < MORSE_METRICS_BUCKETS) ? b : MORSE_METRICS_BUCKETS - 1] += (uint32_t)MORSE_GET_LE16(p) << shift;
+            }
+        }
+    }
+    for (int i = 0; i < errors; i++, p += 6)
+    {
+        if (i < MORSE_METRICS_ERRORS)
+        {
+            metrics->errors[i].code = MORSE_GET_LE16(p);
+            metrics->errors[i].count = MORSE_GET_LE32(p + 2);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @return the largest value bucket of hist holds, UINT32_MAX for the open last one.
+ */
+static uint32_t morse_metrics_bucket_top(int hist, int bucket)
+{
+    if (bucket == MORSE_METRICS_BUCKETS - 1)
+    {
+        return UINT32_MAX;
+    }
+    if (morse_metrics_width[hist])
+    {
+        return (bucket + 1) * morse_metrics_width[hist] - 1;
+    }
+    return bucket ? (1u << bucket) - 1 : 0;
+}
+
+uint32_t morse_metrics_percentile(const morse_metrics *metrics, int hist, int pct)
+{
+    const morse_histogram *h = &metrics->histograms[hist];
+    uint64_t total = 0;
+    uint64_t rank;
+    uint64_t seen = 0;
+
+    // from the buckets rather than count, a parsed snapshot's buckets are rounded down by their shift
+    for (int b = 0; b < MORSE_METRICS_BUCKETS; b++)
+    {
+        total += h->buckets[b];
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+    rank = (total * pct + 99) / 100;
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+    for (int b = 0; b < MORSE_METRICS_BUCKETS; b++)
+    {
+        seen += h->buckets[b];
+        if (seen >= rank)
+        {
+            uint32_t top = morse_metrics_bucket_top(hist, b);
+            return (top < h->max) ? top : h->max;
+        }
+    }
+    return h->max;
+}
+
+const char *morse_metrics_counter_name(int counter)
+{
+    return (counter >= 0 && counter < MORSE_COUNTER_COUNT) ? morse_counter_names[counter] : "unknown";
+}
+
+const char *morse_metrics_hist_name(int hist)
+{
+    return (hist >= 0 && hist < MORSE_HIST_COUNT) ? morse_hist_names[hist] : "unknown";
+}
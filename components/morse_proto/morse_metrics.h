@@ -0,0 +1,188 @@
+#ifndef MORSE_METRICS_H
+#define MORSE_METRICS_H
+
+/*
+ * Counters and fixed bucket histograms for the hot paths of both boards, left on in production. Each board fills
+ * the ones it has in its own morse_metrics_self, the others stay 0. Updates are a few instructions and inline, so the
+ * interrupt handlers can make them from IRAM. morse_metrics_add(), morse_metrics_count() and morse_metrics_record()
+ * are not atomic and are for metrics with a single writer, the ISRs, the poll event task or the NimBLE host task.
+ * A counter more than one task updates, like the client's write errors from the poll task and the host task, goes
+ * through morse_metrics_count_shared(), and morse_metrics_error_code() is safe from any task. A snapshot taken
+ * elsewhere may be a count behind.
+ *
+ * A histogram bucket holds the values of one bit length, bucket 0 the value 0 and bucket n those from 2^(n-1) to
+ * 2^n - 1, or of one step of a linear width if the histogram has one. The last bucket takes everything above.
+ *
+ * The server serves its metrics as a snapshot on the stats characteristic (MORSE_STATS_UUID128), little endian:
+ *
+ *     byte 0      MORSE_METRICS_VERSION
+ *     byte 1      counters, C
+ *     byte 2      histograms, H
+ *     byte 3      buckets per histogram, B
+ *     byte 4      error slots, E
+ *     bytes 5-8   uptime in seconds
+ *     C x 4       counters
+ *     H x 9 + 2B  count, max, a shift and the buckets shifted right by it, so the largest fits 16 bits
+ *     E x 6       error code and count, code 0 for an unused slot
+ *
+ * A reader with more or fewer metrics than the writer takes the ones both know, by position.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MORSE_METRICS_VERSION 1
+#define MORSE_METRICS_HEADER_LENGTH 9
+#define MORSE_METRICS_BUCKETS 20
+#define MORSE_METRICS_ERRORS 8 // distinct error codes kept, later ones are counted in the last slot
+
+// counters, never reset
+#define MORSE_COUNTER_EDGES 0           // client: key and button edges the interrupts queued
+#define MORSE_COUNTER_EDGES_DROPPED 1   // client: edges lost to a full ring
+#define MORSE_COUNTER_SYMBOLS 2         // client: dots and dashes decoded
+#define MORSE_COUNTER_CHARACTERS 3      // client: characters decoded
+#define MORSE_COUNTER_INVALID_CHARS 4   // client: of those, codes with no character
+#define MORSE_COUNTER_WRITES 5          // client: messages written to a server
+#define MORSE_COUNTER_WRITE_RETRIES 6   // client: chunks sent again because the stack was out of buffers
+#define MORSE_COUNTER_WRITE_ERRORS 7    // client: writes that failed to start or were answered with an error
+#define MORSE_COUNTER_STORED 8          // server: messages stored
+#define MORSE_COUNTER_EVICTED 9         // server: stored messages freed for newer ones
+#define MORSE_COUNTER_STORE_FAILED 10   // server: messages the mbuf pool couldn't take
+#define MORSE_COUNTER_CHUNKS_DROPPED 11 // server: messages dropped for a chunk out of sequence
+#define MORSE_COUNTER_PUSH_FAILED 12    // server: notifications and indications that failed
+#define MORSE_COUNTER_COUNT 13
+
+// histograms
+#define MORSE_HIST_ISR_CYCLES 0     // client: CPU cycles per key, send or read interrupt
+#define MORSE_HIST_DECODE_US 1      // client: morse_process_input() calls that decoded at least one edge
+#define MORSE_HIST_SYMBOLS_PER_S 2  // client: keying speed of each message sent, first press to last release
+#define MORSE_HIST_WRITE_RTT_US 3   // client: a message's first write to its write response
+#define MORSE_HIST_MBUF_BLOCKS 4    // server: mbuf pool blocks in use after each store
+#define MORSE_HIST_COUNT 5
+
+// linear bucket width per histogram, 0 for bit length buckets
+static const uint16_t morse_metrics_width[MORSE_HIST_COUNT] = {
+    [MORSE_HIST_SYMBOLS_PER_S] = 1,
+    [MORSE_HIST_MBUF_BLOCKS] = 8,
+};
+
+typedef struct morse_histogram
+{
+    uint32_t count;
+    uint32_t max;
+    uint32_t buckets[MORSE_METRICS_BUCKETS];
+} morse_histogram;
+
+typedef struct morse_metrics_error
+{
+    uint32_t code; // a uint16_t code, in a word so it can be claimed with a compare and swap
+    uint32_t count;
+} morse_metrics_error;
+
+typedef struct morse_metrics
+{
+    uint32_t counters[MORSE_COUNTER_COUNT];
+    morse_histogram histograms[MORSE_HIST_COUNT];
+    morse_metrics_error errors[MORSE_METRICS_ERRORS];
+} morse_metrics;
+
+// this board's metrics
+extern morse_metrics morse_metrics_self;
+
+/**
+ * Adds to a counter.
+ * @param counter a MORSE_COUNTER_ value.
+ */
+static inline void morse_metrics_add(int counter, uint32_t n)
+{
+    morse_metrics_self.counters[counter] += n;
+}
+
+static inline void morse_metrics_count(int counter)
+{
+    morse_metrics_self.counters[counter]++;
+}
+
+/**
+ * Counts one for a counter that more than one task updates, atomically.
+ * @param counter a MORSE_COUNTER_ value.
+ */
+static inline void morse_metrics_count_shared(int counter)
+{
+    __atomic_fetch_add(&morse_metrics_self.counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @return the bucket value falls into in the histogram.
+ */
+static inline int morse_metrics_bucket(int hist, uint32_t value)
+{
+    uint32_t bucket;
+
+    if (morse_metrics_width[hist])
+    {
+        bucket = value / morse_metrics_width[hist];
+    }
+    else
+    {
+        bucket = value ? 32 - __builtin_clz(value) : 0;
+    }
+    return (bucket < MORSE_METRICS_BUCKETS) ? bucket : MORSE_METRICS_BUCKETS - 1;
+}
+
+/**
+ * Adds a value to a histogram.
+ * @param hist a MORSE_HIST_ value.
+ */
+static inline void morse_metrics_record(int hist, uint32_t value)
+{
+    morse_histogram *h = &morse_metrics_self.histograms[hist];
+
+    h->count++;
+    h->buckets[morse_metrics_bucket(hist, value)]++;
+    if (value > h->max)
+    {
+        h->max = value;
+    }
+}
+
+/**
+ * Counts an error code, a BLE_HS_E* or ATT error. Safe from several tasks at once, a free slot is claimed with a
+ * compare and swap and counts are added atomically. Not for interrupts, it searches the slots.
+ */
+void morse_metrics_error_code(uint16_t code);
+
+#define MORSE_METRICS_SNAPSHOT_LENGTH \
+    (MORSE_METRICS_HEADER_LENGTH + MORSE_COUNTER_COUNT * 4 + MORSE_HIST_COUNT * (9 + 2 * MORSE_METRICS_BUCKETS) + MORSE_METRICS_ERRORS * 6)
+
+/**
+ * Writes a snapshot of metrics in the layout above.
+ * @param uptime_s seconds since boot, for rates.
+ * @param buf receives the snapshot, MORSE_METRICS_SNAPSHOT_LENGTH bytes.
+ * @return the snapshot length.
+ */
+int morse_metrics_snapshot(const morse_metrics *metrics, uint32_t uptime_s, uint8_t *buf);
+
+/**
+ * Reads a snapshot back. Metrics the snapshot doesn't have are left 0.
+ * @return 0 on success, -1 if the snapshot is short or of another version.
+ */
+int morse_metrics_parse(const uint8_t *buf, int length, morse_metrics *metrics, uint32_t *uptime_s);
+
+/**
+ * @return an upper bound of the pct percentile of a histogram, the top of the bucket it falls in, at most the max.
+ * 0 if the histogram is empty.
+ */
+uint32_t morse_metrics_percentile(const morse_metrics *metrics, int hist, int pct);
+
+/**
+ * @return the name of a counter for the log.
+ */
+const char *morse_metrics_counter_name(int counter);
+
+/**
+ * @return the name of a histogram for the log.
+ */
+const char *morse_metrics_hist_name(int hist);
+
+#endif
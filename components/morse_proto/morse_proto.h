@@ -0,0 +1,97 @@
+#ifndef MORSE_PROTO_H
+#define MORSE_PROTO_H
+
+/*
+ * Definitions shared by the client and the server for messages written to the morse characteristic.
+ * Both projects pick this component up through EXTRA_COMPONENT_DIRS.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// largest message the server reassembles from chunks, in bytes
+#define MORSE_MESSAGE_MAX_LENGTH 1024
+
+#define MORSE_MAX_SYMBOLS 7 // longest code decoded or carried on the wire
+// builds the leading-1 decimal value of a morse code from its dots (DIT) and dashes (DAH) at compile time
+#define DIT 0
+#define DAH 1
+#define MORSE_1(a) (2 | (a))
+#define MORSE_2(a, b) ((MORSE_1(a) << 1) | (b))
+#define MORSE_3(a, b, c) ((MORSE_2(a, b) << 1) | (c))
+#define MORSE_4(a, b, c, d) ((MORSE_3(a, b, c) << 1) | (d))
+#define MORSE_5(a, b, c, d, e) ((MORSE_4(a, b, c, d) << 1) | (e))
+#define MORSE_6(a, b, c, d, e, f) ((MORSE_5(a, b, c, d, e) << 1) | (f))
+#define MORSE_7(a, b, c, d, e, f, g) ((MORSE_6(a, b, c, d, e, f) << 1) | (g))
+
+// prosigns with no printable character are decoded to ascii control characters
+#define MORSE_PROSIGN_KA 0x02 // -.-.- starting signal, STX
+#define MORSE_PROSIGN_SK 0x04 // ...-.- end of work, EOT
+#define MORSE_PROSIGN_SN 0x06 // ...-. understood, ACK
+
+/*
+Messages longer than one ATT payload are split into chunks, each starting with a one byte header.
+Plain messages are ascii text and never start with a byte >= 0x80, so the marker bit tells the two apart.
+
+    bit 7       MORSE_CHUNK_MARKER
+    bit 6       first chunk of a message
+    bit 5       last chunk of a message
+    bits 4-0    sequence number, incremented per chunk and wrapping
+*/
+#define MORSE_CHUNK_HEADER_LENGTH 1
+#define MORSE_CHUNK_MARKER 0x80
+#define MORSE_CHUNK_FIRST 0x40
+#define MORSE_CHUNK_LAST 0x20
+#define MORSE_CHUNK_SEQ_MASK 0x1F
+
+#define MORSE_CHUNK_HEADER(first, last, seq) \
+    (MORSE_CHUNK_MARKER | ((first) ? MORSE_CHUNK_FIRST : 0) | ((last) ? MORSE_CHUNK_LAST : 0) | ((seq) & MORSE_CHUNK_SEQ_MASK))
+#define MORSE_IS_CHUNK(first_byte) (((first_byte) & MORSE_CHUNK_MARKER) != 0)
+
+// 128-bit UUIDs, least significant byte first as BLE_UUID128_DECLARE takes them
+#define MORSE_SVC_UUID128 0xFE, 0xCA, 0xFE, 0xCA, 0xFE, 0xCA, 0xFE, 0xCA, 0xFE, 0xCA, 0xFE, 0xCA, 0xFE, 0xCA, 0xFE, 0xCA
+#define MORSE_CHR_UUID128 0xFF, 0xCA, 0xFF, 0xCA, 0xFF, 0xCA, 0xFF, 0xCA, 0xFF, 0xCA, 0xFF, 0xCA, 0xFF, 0xCA, 0xFF, 0xCA
+#define MORSE_HISTORY_UUID128 0xED, 0xFE, 0xED, 0xFE, 0xED, 0xFE, 0xED, 0xFE, 0xED, 0xFE, 0xED, 0xFE, 0xED, 0xFE, 0xED, 0xFE
+// read only, the server's metrics snapshot, see morse_metrics.h
+#define MORSE_STATS_UUID128 0x57, 0xA7, 0x57, 0xA7, 0x57, 0xA7, 0x57, 0xA7, 0x57, 0xA7, 0x57, 0xA7, 0x57, 0xA7, 0x57, 0xA7
+
+/*
+History characteristic. Writing a 4 byte little endian sequence number selects the messages after it, reading
+returns the server's epoch, 4 bytes little endian, then the messages oldest first, each behind a header:
+
+    bytes 0-3   sequence number, little endian
+    bytes 4-5   length of the bytes that follow, little endian, MORSE_HISTORY_MORE set if the message goes on
+
+A read returns whole messages up to an attribute's worth. A message that doesn't fit in one read on its own comes in
+pieces: the read ends with its first bytes and MORSE_HISTORY_MORE. The client then writes the sequence number before
+it followed by the offset of the next piece, 2 bytes little endian. If that message is still stored it continues at
+the offset, otherwise the read starts with the next whole one.
+
+The epoch is a random number the server draws at boot, its sequence numbers start again from 1 with every new one.
+A client that sees a different epoch than the one its last sequence number came with asks again from 0.
+*/
+#define MORSE_HISTORY_SINCE_LENGTH 4
+#define MORSE_HISTORY_OFFSET_LENGTH 2
+#define MORSE_HISTORY_EPOCH_LENGTH 4
+#define MORSE_HISTORY_HEADER_LENGTH 6
+#define MORSE_HISTORY_MORE 0x8000
+#define MORSE_HISTORY_LENGTH_MASK 0x7FFF
+#define MORSE_HISTORY_HEADER_PUT(buf, seq, length) do { \
+        (buf)[0] = (uint8_t)(seq); (buf)[1] = (uint8_t)((seq) >> 8); \
+        (buf)[2] = (uint8_t)((seq) >> 16); (buf)[3] = (uint8_t)((seq) >> 24); \
+        (buf)[4] = (uint8_t)(length); (buf)[5] = (uint8_t)((length) >> 8); \
+    } while (0)
+#define MORSE_GET_LE32(buf) ((uint32_t)(buf)[0] | ((uint32_t)(buf)[1] << 8) | ((uint32_t)(buf)[2] << 16) | ((uint32_t)(buf)[3] << 24))
+#define MORSE_GET_LE16(buf) ((uint16_t)((buf)[0] | ((buf)[1] << 8)))
+
+// ATT write request/command header: opcode and attribute handle
+#define MORSE_ATT_WRITE_OVERHEAD 3
+// ATT notification/indication header: opcode and attribute handle
+#define MORSE_ATT_NOTIFY_OVERHEAD 3
+
+/*
+Notifications and indications on the morse characteristic carry the newest stored message behind the history
+header. The header length is the whole message, if it is more than what follows the client reads the rest.
+*/
+
+#endif
@@ -0,0 +1,276 @@
+#include "morse_wire.h"
+#include "morse_proto.h" // for the MORSE_n code macros and the prosigns
+
+/*
+Characters with a 6-bit code, the code number first. The morse code is the leading-1 decimal value. The lists are
+expanded into the lookup tables below at compile time, so they are the only place a code is written down and
+nothing has to be built before the first frame, from whichever task that is.
+*/
+#define WIRE_MORSE_CHARS(X) \
+    X(1, 'a', MORSE_2(DIT, DAH)) X(2, 'b', MORSE_4(DAH, DIT, DIT, DIT)) X(3, 'c', MORSE_4(DAH, DIT, DAH, DIT)) \
+    X(4, 'd', MORSE_3(DAH, DIT, DIT)) X(5, 'e', MORSE_1(DIT)) X(6, 'f', MORSE_4(DIT, DIT, DAH, DIT)) \
+    X(7, 'g', MORSE_3(DAH, DAH, DIT)) X(8, 'h', MORSE_4(DIT, DIT, DIT, DIT)) X(9, 'i', MORSE_2(DIT, DIT)) \
+    X(10, 'j', MORSE_4(DIT, DAH, DAH, DAH)) X(11, 'k', MORSE_3(DAH, DIT, DAH)) \
+    X(12, 'l', MORSE_4(DIT, DAH, DIT, DIT)) X(13, 'm', MORSE_2(DAH, DAH)) X(14, 'n', MORSE_2(DAH, DIT)) \
+    X(15, 'o', MORSE_3(DAH, DAH, DAH)) X(16, 'p', MORSE_4(DIT, DAH, DAH, DIT)) \
+    X(17, 'q', MORSE_4(DAH, DAH, DIT, DAH)) X(18, 'r', MORSE_3(DIT, DAH, DIT)) \
+    X(19, 's', MORSE_3(DIT, DIT, DIT)) X(20, 't', MORSE_1(DAH)) X(21, 'u', MORSE_3(DIT, DIT, DAH)) \
+    X(22, 'v', MORSE_4(DIT, DIT, DIT, DAH)) X(23, 'w', MORSE_3(DIT, DAH, DAH)) \
+    X(24, 'x', MORSE_4(DAH, DIT, DIT, DAH)) X(25, 'y', MORSE_4(DAH, DIT, DAH, DAH)) \
+    X(26, 'z', MORSE_4(DAH, DAH, DIT, DIT)) X(27, '0', MORSE_5(DAH, DAH, DAH, DAH, DAH)) \
+    X(28, '1', MORSE_5(DIT, DAH, DAH, DAH, DAH)) X(29, '2', MORSE_5(DIT, DIT, DAH, DAH, DAH)) \
+    X(30, '3', MORSE_5(DIT, DIT, DIT, DAH, DAH)) X(31, '4', MORSE_5(DIT, DIT, DIT, DIT, DAH)) \
+    X(32, '5', MORSE_5(DIT, DIT, DIT, DIT, DIT)) X(33, '6', MORSE_5(DAH, DIT, DIT, DIT, DIT)) \
+    X(34, '7', MORSE_5(DAH, DAH, DIT, DIT, DIT)) X(35, '8', MORSE_5(DAH, DAH, DAH, DIT, DIT)) \
+    X(36, '9', MORSE_5(DAH, DAH, DAH, DAH, DIT)) X(37, '.', MORSE_6(DIT, DAH, DIT, DAH, DIT, DAH)) \
+    X(38, ',', MORSE_6(DAH, DAH, DIT, DIT, DAH, DAH)) X(39, ':', MORSE_6(DAH, DAH, DAH, DIT, DIT, DIT)) \
+    X(40, '?', MORSE_6(DIT, DIT, DAH, DAH, DIT, DIT)) X(41, '\'', MORSE_6(DIT, DAH, DAH, DAH, DAH, DIT)) \
+    X(42, '-', MORSE_6(DAH, DIT, DIT, DIT, DIT, DAH)) X(43, '/', MORSE_5(DAH, DIT, DIT, DAH, DIT)) \
+    X(44, '(', MORSE_5(DAH, DIT, DAH, DAH, DIT)) X(45, ')', MORSE_6(DAH, DIT, DAH, DAH, DIT, DAH)) \
+    X(46, '"', MORSE_6(DIT, DAH, DIT, DIT, DAH, DIT)) X(47, '=', MORSE_5(DAH, DIT, DIT, DIT, DAH)) \
+    X(48, '+', MORSE_5(DIT, DAH, DIT, DAH, DIT)) X(49, '@', MORSE_6(DIT, DAH, DAH, DIT, DAH, DIT)) \
+    X(50, '!', MORSE_6(DAH, DIT, DAH, DIT, DAH, DAH)) X(51, '&', MORSE_5(DIT, DAH, DIT, DIT, DIT)) \
+    X(52, ';', MORSE_6(DAH, DIT, DAH, DIT, DAH, DIT)) X(53, '_', MORSE_6(DIT, DIT, DAH, DAH, DIT, DAH)) \
+    X(54, '$', MORSE_7(DIT, DIT, DIT, DAH, DIT, DIT, DAH)) \
+    X(55, MORSE_PROSIGN_KA, MORSE_5(DAH, DIT, DAH, DIT, DAH)) \
+    X(56, MORSE_PROSIGN_SK, MORSE_6(DIT, DIT, DIT, DAH, DIT, DAH)) \
+    X(57, MORSE_PROSIGN_SN, MORSE_5(DIT, DIT, DIT, DAH, DIT))
+
+// no morse code, escaped in the morse format
+#define WIRE_PLAIN_CHARS(X) \
+    X(58, ' ', 0) X(59, '#', 0)
+
+#define WIRE_SIXBIT_CODES 59 // the highest code in the lists
+
+#define WIRE_FORMATS 2
+#define WIRE_MORSE_COUNT_BITS 3
+#define WIRE_RAW_BITS 8
+#define WIRE_SIXBIT_ESCAPED_BITS (6 + WIRE_RAW_BITS)
+#define WIRE_MORSE_ESCAPED_BITS (WIRE_MORSE_COUNT_BITS + WIRE_RAW_BITS)
+
+// number of symbols in a leading-1 morse code, its highest bit
+#define WIRE_SYMBOL_COUNT(morse) \
+    ((morse) >= 128 ? 7 : (morse) >= 64 ? 6 : (morse) >= 32 ? 5 : (morse) >= 16 ? 4 : (morse) >= 8 ? 3 : (morse) >= 4 ? 2 : 1)
+// the morse format of a code: the count goes where the leading 1 was
+#define WIRE_MORSE_VALUE(morse) \
+    ((WIRE_SYMBOL_COUNT(morse) << WIRE_SYMBOL_COUNT(morse)) | ((morse) & ((1 << WIRE_SYMBOL_COUNT(morse)) - 1)))
+
+/*
+Per character, the bits to emit in each format and how many, both kept relative to the escape: the value xor the
+escaped character, the count less the escape's. The characters the lists don't have are left 0 and come out
+escaped, with a lookup and no test.
+*/
+#define WIRE_SIXBIT_ESCAPED(c) ((MORSE_WIRE_SIXBIT_ESCAPE << WIRE_RAW_BITS) | (uint8_t)(c))
+#define WIRE_SIXBIT_ENTRY(code, letter, morse) [(uint8_t)(letter)] = (code) ^ WIRE_SIXBIT_ESCAPED(letter),
+#define WIRE_SIXBIT_BITS_ENTRY(code, letter, morse) [(uint8_t)(letter)] = 6 - WIRE_SIXBIT_ESCAPED_BITS,
+#define WIRE_MORSE_ENTRY(code, letter, morse) [(uint8_t)(letter)] = WIRE_MORSE_VALUE(morse) ^ (uint8_t)(letter),
+#define WIRE_MORSE_BITS_ENTRY(code, letter, morse) \
+    [(uint8_t)(letter)] = WIRE_MORSE_COUNT_BITS + WIRE_SYMBOL_COUNT(morse) - WIRE_MORSE_ESCAPED_BITS,
+static const uint16_t wire_value[WIRE_FORMATS][256] = {
+    [MORSE_WIRE_FORMAT_SIXBIT] = {WIRE_MORSE_CHARS(WIRE_SIXBIT_ENTRY) WIRE_PLAIN_CHARS(WIRE_SIXBIT_ENTRY)},
+    [MORSE_WIRE_FORMAT_MORSE] = {WIRE_MORSE_CHARS(WIRE_MORSE_ENTRY)},
+};
+static const int8_t wire_bits[WIRE_FORMATS][256] = {
+    [MORSE_WIRE_FORMAT_SIXBIT] = {WIRE_MORSE_CHARS(WIRE_SIXBIT_BITS_ENTRY) WIRE_PLAIN_CHARS(WIRE_SIXBIT_BITS_ENTRY)},
+    [MORSE_WIRE_FORMAT_MORSE] = {WIRE_MORSE_CHARS(WIRE_MORSE_BITS_ENTRY)},
+};
+// what a character the tables don't have takes: the escape, then the raw character
+static const uint16_t wire_escape[WIRE_FORMATS] = {
+    [MORSE_WIRE_FORMAT_SIXBIT] = MORSE_WIRE_SIXBIT_ESCAPE << WIRE_RAW_BITS,
+    [MORSE_WIRE_FORMAT_MORSE] = 0, // count 0
+};
+static const uint8_t wire_escape_bits[WIRE_FORMATS] = {
+    [MORSE_WIRE_FORMAT_SIXBIT] = WIRE_SIXBIT_ESCAPED_BITS,
+    [MORSE_WIRE_FORMAT_MORSE] = WIRE_MORSE_ESCAPED_BITS,
+};
+
+// and back: six bit code to character, leading-1 decimal value to character, 0 if none
+#define WIRE_SIXBIT_LETTER_ENTRY(code, letter, morse) [(code)] = (letter),
+#define WIRE_MORSE_LETTER_ENTRY(code, letter, morse) [(morse)] = (letter),
+static const char wire_sixbit_letter[WIRE_SIXBIT_CODES + 1] = {
+    WIRE_MORSE_CHARS(WIRE_SIXBIT_LETTER_ENTRY) WIRE_PLAIN_CHARS(WIRE_SIXBIT_LETTER_ENTRY)};
+static const char wire_morse_letter[1 << (MORSE_MAX_SYMBOLS + 1)] = {WIRE_MORSE_CHARS(WIRE_MORSE_LETTER_ENTRY)};
+
+/**
+ * The bits a character takes in a format.
+ * @param bits receives how many.
+ * @return the bits, right aligned.
+ */
+static inline uint32_t wire_code(int format, uint8_t c, int *bits)
+{
+    *bits = wire_escape_bits[format] + wire_bits[format][c];
+    return wire_value[format][c] ^ (wire_escape[format] | c);
+}
+
+/**
+ * Picks the shorter format for MORSE_WIRE_FORMAT_AUTO, the six bit one when they tie.
+ */
+static int wire_pick_format(const char *text, int length, int format)
+{
+    if (format != MORSE_WIRE_FORMAT_AUTO)
+    {
+        return format;
+    }
+    if (morse_wire_length(text, length, MORSE_WIRE_FORMAT_MORSE) < morse_wire_length(text, length, MORSE_WIRE_FORMAT_SIXBIT))
+    {
+        return MORSE_WIRE_FORMAT_MORSE;
+    }
+    return MORSE_WIRE_FORMAT_SIXBIT;
+}
+
+int morse_wire_length(const char *text, int length, int format)
+{
+    uint32_t bits = 0;
+    int char_bits;
+
+    format = wire_pick_format(text, length, format);
+    for (int i = 0; i < length; i++)
+    {
+        wire_code(format, (uint8_t)text[i], &char_bits);
+        bits += char_bits;
+    }
+    return MORSE_WIRE_HEADER_LENGTH + (bits + 7) / 8;
+}
+
+int morse_wire_encode(const char *text, int length, uint8_t seq, int format, uint8_t *frame, int frame_max)
+{
+    uint32_t acc = 0; // bits not yet written, right aligned
+    int acc_bits = 0;
+    int end = MORSE_WIRE_HEADER_LENGTH;
+    int char_bits;
+
+    format = wire_pick_format(text, length, format);
+    if (morse_wire_length(text, length, format) > frame_max)
+    {
+        return -1;
+    }
+
+    frame[0] = MORSE_WIRE_TAG | (MORSE_WIRE_VERSION << 1) | format;
+    frame[1] = seq;
+    for (int i = 0; i < length; i++)
+    {
+        uint32_t code = wire_code(format, (uint8_t)text[i], &char_bits);
+
+        acc = (acc << char_bits) | code;
+        acc_bits += char_bits;
+        while (acc_bits >= 8)
+        {
+            acc_bits -= 8;
+            frame[end++] = acc >> acc_bits;
+        }
+    }
+    if (acc_bits > 0)
+    {
+        frame[end++] = acc << (8 - acc_bits); // pad with 0 bits
+    }
+    return end;
+}
+
+/**
+ * Reads bits msb first from a frame. Callers check there are enough left with wire_bits_left.
+ */
+struct wire_reader
+{
+    const uint8_t *data;
+    uint32_t pos;  // in bits
+    uint32_t bits; // total
+};
+
+static uint32_t wire_read(struct wire_reader *r, int count)
+{
+    uint32_t value = 0;
+
+    for (int i = 0; i < count; i++, r->pos++)
+    {
+        value = (value << 1) | ((r->data[r->pos >> 3] >> (7 - (r->pos & 7))) & 1);
+    }
+    return value;
+}
+
+#define wire_bits_left(r) ((r)->bits - (r)->pos)
+
+int morse_wire_decode(const uint8_t *frame, int frame_length, char *text, int text_max, uint8_t *seq)
+{
+    struct wire_reader r;
+    int format;
+    int length = 0;
+
+    if (frame_length < MORSE_WIRE_HEADER_LENGTH || !MORSE_IS_WIRE(frame[0]) || ((frame[0] >> 1) & 0x07) != MORSE_WIRE_VERSION)
+    {
+        return -1;
+    }
+    format = frame[0] & 1;
+    if (seq)
+    {
+        *seq = frame[1];
+    }
+    r.data = frame + MORSE_WIRE_HEADER_LENGTH;
+    r.pos = 0;
+    r.bits = (frame_length - MORSE_WIRE_HEADER_LENGTH) * 8;
+
+    while (1)
+    {
+        uint32_t code;
+        char c;
+
+        if (format == MORSE_WIRE_FORMAT_SIXBIT)
+        {
+            if (wire_bits_left(&r) < 6 || (code = wire_read(&r, 6)) == 0)
+            {
+                break; // end or padding
+            }
+            if (code == MORSE_WIRE_SIXBIT_ESCAPE)
+            {
+                if (wire_bits_left(&r) < WIRE_RAW_BITS)
+                {
+                    return -1;
+                }
+                c = wire_read(&r, WIRE_RAW_BITS);
+            }
+            else if (code <= WIRE_SIXBIT_CODES)
+            {
+                c = wire_sixbit_letter[code];
+            }
+            else
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            if (wire_bits_left(&r) < WIRE_MORSE_COUNT_BITS)
+            {
+                break;
+            }
+            code = wire_read(&r, WIRE_MORSE_COUNT_BITS);
+            if (code == 0)
+            {
+                // padding is at most 7 zero bits, too short for an escaped character
+                if (wire_bits_left(&r) < WIRE_RAW_BITS)
+                {
+                    break;
+                }
+                c = wire_read(&r, WIRE_RAW_BITS);
+            }
+            else
+            {
+                if (wire_bits_left(&r) < code)
+                {
+                    return -1;
+                }
+                c = wire_morse_letter[(1 << code) | wire_read(&r, code)];
+                if (c == 0)
+                {
+                    return -1;
+                }
+            }
+        }
+
+        if (length >= text_max)
+        {
+            return -1;
+        }
+        text[length++] = c;
+    }
+    return length;
+}
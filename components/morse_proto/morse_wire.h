@@ -0,0 +1,73 @@
+#ifndef MORSE_WIRE_H
+#define MORSE_WIRE_H
+
+/*
+ * Compact binary frames for morse messages. A frame replaces the ascii text written to the morse characteristic:
+ *
+ *     byte 0      0x10 | version << 1 | format
+ *     byte 1      sequence number, set by the sender and wrapping
+ *     byte 2..    the characters, packed msb first and padded with 0 bits to a whole byte
+ *
+ * MORSE_WIRE_FORMAT_SIXBIT packs every character as a 6-bit code. Code 0 is padding, MORSE_WIRE_SIXBIT_ESCAPE
+ * is followed by the raw 8-bit character.
+ * MORSE_WIRE_FORMAT_MORSE packs every character as its morse code: a 3-bit symbol count, then one bit per
+ * symbol (DIT 0, DAH 1). A count of 0 is followed by the raw 8-bit character. Short codes are the common
+ * letters, so english text comes out under 6 bits per character.
+ *
+ * Ascii text never starts with a byte in 0x10-0x1F and chunks start with MORSE_CHUNK_MARKER, so the three kinds
+ * of write are told apart by their first byte. A framed message longer than the MTU is chunked like any other.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MORSE_WIRE_VERSION 1
+#define MORSE_WIRE_HEADER_LENGTH 2
+#define MORSE_WIRE_TAG 0x10
+#define MORSE_IS_WIRE(first_byte) (((first_byte) & 0xF0) == MORSE_WIRE_TAG)
+
+#define MORSE_WIRE_FORMAT_SIXBIT 0
+#define MORSE_WIRE_FORMAT_MORSE 1
+#define MORSE_WIRE_FORMAT_AUTO -1 // whichever of the two is shorter for the message
+
+#define MORSE_WIRE_SIXBIT_ESCAPE 63
+
+// largest frame for a message of length characters, every character escaped
+#define MORSE_WIRE_MAX_LENGTH(length) (MORSE_WIRE_HEADER_LENGTH + ((length) * 14 + 7) / 8)
+// most characters a frame of frame_length bytes unpacks to: 'e' and 't' take 4 bits in MORSE_WIRE_FORMAT_MORSE,
+// 2 per byte. MORSE_WIRE_FORMAT_SIXBIT tops out at 4 per 3 bytes.
+#define MORSE_WIRE_TEXT_MAX_LENGTH(frame_length) (((frame_length) - MORSE_WIRE_HEADER_LENGTH) * 2)
+
+/**
+ * Size of the frame morse_wire_encode() would build, without building it.
+ * @param text the message.
+ * @param length number of characters in text.
+ * @param format MORSE_WIRE_FORMAT_SIXBIT, MORSE_WIRE_FORMAT_MORSE or MORSE_WIRE_FORMAT_AUTO.
+ * @return the frame length in bytes.
+ */
+int morse_wire_length(const char *text, int length, int format);
+
+/**
+ * Packs a message into a frame.
+ * @param text the message.
+ * @param length number of characters in text.
+ * @param seq sequence number for the header.
+ * @param format MORSE_WIRE_FORMAT_SIXBIT, MORSE_WIRE_FORMAT_MORSE or MORSE_WIRE_FORMAT_AUTO.
+ * @param frame receives the frame.
+ * @param frame_max size of frame, MORSE_WIRE_MAX_LENGTH(length) always suffices.
+ * @return the frame length, or -1 if it doesn't fit in frame_max.
+ */
+int morse_wire_encode(const char *text, int length, uint8_t seq, int format, uint8_t *frame, int frame_max);
+
+/**
+ * Unpacks a frame back into the message.
+ * @param frame the frame, starting with the header.
+ * @param frame_length length of frame in bytes.
+ * @param text receives the characters, not NUL terminated.
+ * @param text_max size of text.
+ * @param seq receives the sequence number, may be NULL.
+ * @return the number of characters, or -1 if the frame is malformed, of an unknown version or too long for text.
+ */
+int morse_wire_decode(const uint8_t *frame, int frame_length, char *text, int text_max, uint8_t *seq);
+
+#endif